@@ -0,0 +1,562 @@
+#define _GNU_SOURCE // cpu_set_t, pthread_setaffinity_np
+#include "defs.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#define AFFINITY_NODE_PATH "/sys/devices/system/node"
+
+// A set of resources shared by the same systems, placed on one node as a whole
+typedef struct AffinityGroup
+{
+    int root;   // Resource id standing for the group
+    int weight; // Systems using the group's resources
+} AffinityGroup;
+
+// Helper functions just used by this C file to clean up our code
+
+static int affinity_parse_list(const char *list, int **cpus, int *count);
+static int affinity_add_cpu(int **cpus, int *count, int *capacity, int cpu);
+static void affinity_read_nodes(Affinity *affinity, int *node_ids);
+static int affinity_find(int *parents, int id);
+static int affinity_compare_groups(const void *a, const void *b);
+static int affinity_least_loaded(const Affinity *affinity, const int *loads, const int *cpu_counts, int weight);
+static void affinity_allocate(Affinity *affinity, Manager *manager);
+
+/**
+ * Initializes an `Affinity` from a CPU list such as "0-3,8-11".
+ *
+ * CPUs the process may not run on are skipped with a warning. The NUMA node of every CPU
+ * is read from sysfs, a machine without that information is treated as a single node.
+ *
+ * @param[out] affinity  Pointer to the `Affinity` to initialize.
+ * @param[in]  list      Comma separated CPU numbers and ranges, in the order threads take them.
+ * @return               0 on success, -1 if the list is malformed or none of its CPUs can be used.
+ */
+int affinity_init(Affinity *affinity, const char *list)
+{
+    int *requested = NULL, requested_count = 0;
+    int *node_ids = NULL;
+    cpu_set_t allowed;
+
+    memset(affinity, 0, sizeof(*affinity));
+
+    if (affinity_parse_list(list, &requested, &requested_count) != 0 || requested_count == 0)
+    {
+        fprintf(stderr, "Invalid CPU list \"%s\", expected e.g. 0-3,8-11\n", list);
+        free(requested);
+        return -1;
+    }
+
+    affinity->cpus = malloc(sizeof(int) * requested_count);
+    affinity->cpu_nodes = malloc(sizeof(int) * requested_count);
+    affinity->nodes = malloc(sizeof(int) * requested_count);
+    node_ids = malloc(sizeof(int) * requested_count);
+    if (affinity->cpus == NULL || affinity->cpu_nodes == NULL || affinity->nodes == NULL || node_ids == NULL)
+    {
+        perror("Failed to allocate memory for the CPU list");
+        goto fail;
+    }
+
+    // Keep the CPUs this process is allowed on, a pinned thread could not run elsewhere
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+    {
+        perror("Failed to read the CPUs of the process");
+        goto fail;
+    }
+    for (int i = 0; i < requested_count; i++)
+    {
+        int cpu = requested[i];
+        if (cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &allowed))
+        {
+            fprintf(stderr, "CPU %d is not available, skipped\n", cpu);
+            continue;
+        }
+        affinity->cpus[affinity->cpu_count++] = cpu;
+    }
+    if (affinity->cpu_count == 0)
+    {
+        fprintf(stderr, "None of the CPUs in \"%s\" is available\n", list);
+        goto fail;
+    }
+
+    // Number the nodes of the configured CPUs densely, in the order they first appear
+    affinity_read_nodes(affinity, node_ids);
+    for (int i = 0; i < affinity->cpu_count; i++)
+    {
+        int node = 0;
+        while (node < affinity->node_count && affinity->nodes[node] != node_ids[i])
+            node++;
+        if (node == affinity->node_count)
+            affinity->nodes[affinity->node_count++] = node_ids[i];
+        affinity->cpu_nodes[i] = node;
+    }
+
+    free(requested);
+    free(node_ids);
+    return 0;
+
+fail:
+    free(requested);
+    free(node_ids);
+    affinity_clean(affinity);
+    return -1;
+}
+
+/**
+ * Releases the CPU list and the node-local memory of an `Affinity`.
+ *
+ * Must only be called once no thread reads the resource amounts anymore.
+ *
+ * @param[in,out] affinity  Pointer to the `Affinity` to clean.
+ */
+void affinity_clean(Affinity *affinity)
+{
+    for (int i = 0; affinity->blocks != NULL && i < affinity->node_count; i++)
+    {
+        if (affinity->blocks[i] != NULL)
+            munmap(affinity->blocks[i], affinity->block_sizes[i]);
+    }
+    free(affinity->blocks);
+    free(affinity->block_sizes);
+    free(affinity->cpus);
+    free(affinity->cpu_nodes);
+    free(affinity->nodes);
+    memset(affinity, 0, sizeof(*affinity));
+}
+
+/**
+ * Places every system and resource on one of the nodes of the CPU list.
+ *
+ * Resources used by the same systems are joined into groups, so a system and all of its
+ * inputs and outputs always end up on one node. The groups are handed out from the largest
+ * to the node with the fewest systems per CPU. The amounts of each node's resources are
+ * then moved into a block of memory allocated on that node. Must be called once the
+ * scenario is loaded and before any thread is started.
+ *
+ * @param[in,out] affinity  Pointer to the initialized `Affinity`.
+ * @param[in,out] manager   Pointer to the loaded `Manager`.
+ */
+void affinity_place(Affinity *affinity, Manager *manager)
+{
+    int resource_count = manager->resource_array.size;
+    int system_count = manager->system_array.size;
+    int *parents = malloc(sizeof(int) * ALLOC_COUNT(resource_count));
+    int *weights = calloc(ALLOC_COUNT(resource_count), sizeof(int));
+    AffinityGroup *groups = malloc(sizeof(AffinityGroup) * ALLOC_COUNT(resource_count));
+    int *loads = calloc(affinity->node_count, sizeof(int));
+    int *cpu_counts = calloc(affinity->node_count, sizeof(int));
+    int *group_nodes = malloc(sizeof(int) * ALLOC_COUNT(resource_count));
+    int group_count = 0;
+
+    if (parents == NULL || weights == NULL || groups == NULL || loads == NULL || cpu_counts == NULL || group_nodes == NULL)
+    {
+        perror("Failed to allocate memory for the NUMA placement");
+        goto done;
+    }
+
+    for (int i = 0; i < affinity->cpu_count; i++)
+        cpu_counts[affinity->cpu_nodes[i]]++;
+
+    // Join the inputs and outputs of every system into one group
+    for (int i = 0; i < resource_count; i++)
+        parents[i] = i;
+    for (int i = 0; i < system_count; i++)
+    {
+        System *system = manager->system_array.systems[i];
+        int first = -1;
+
+        for (int r = 0; r < system->consumed_count + system->produced_count; r++)
+        {
+            Resource *resource = (r < system->consumed_count) ? system->consumed[r].resource
+                                                              : system->produced[r - system->consumed_count].resource;
+            if (resource == NULL)
+                continue;
+            int root = affinity_find(parents, resource->id);
+            if (first < 0)
+                first = root;
+            else if (root != first)
+                parents[root] = first;
+        }
+        if (first >= 0)
+            weights[affinity_find(parents, first)]++;
+    }
+
+    // Weights were counted on the roots of the moment, gather them on the final roots
+    for (int i = 0; i < resource_count; i++)
+    {
+        int root = affinity_find(parents, i);
+        if (root != i)
+        {
+            weights[root] += weights[i];
+            weights[i] = 0;
+        }
+    }
+    for (int i = 0; i < resource_count; i++)
+    {
+        if (parents[i] == i)
+            groups[group_count++] = (AffinityGroup){i, weights[i]};
+    }
+    qsort(groups, group_count, sizeof(AffinityGroup), affinity_compare_groups);
+
+    // Largest groups first, each to the node that is least busy once it has them
+    for (int i = 0; i < group_count; i++)
+    {
+        int node = affinity_least_loaded(affinity, loads, cpu_counts, groups[i].weight);
+        loads[node] += groups[i].weight;
+        group_nodes[groups[i].root] = node;
+    }
+    for (int i = 0; i < resource_count; i++)
+        manager->resource_array.resources[i]->numa_node = group_nodes[affinity_find(parents, i)];
+
+    // A system runs where its resources are, one without any goes where there is room
+    for (int i = 0; i < system_count; i++)
+    {
+        System *system = manager->system_array.systems[i];
+        Resource *resource = (system->consumed_count > 0) ? system->consumed[0].resource
+                             : (system->produced_count > 0) ? system->produced[0].resource
+                                                            : NULL;
+        if (resource != NULL)
+        {
+            system->numa_node = resource->numa_node;
+        }
+        else
+        {
+            system->numa_node = affinity_least_loaded(affinity, loads, cpu_counts, 1);
+            loads[system->numa_node]++;
+        }
+    }
+
+    affinity_allocate(affinity, manager);
+
+done:
+    free(parents);
+    free(weights);
+    free(groups);
+    free(loads);
+    free(cpu_counts);
+    free(group_nodes);
+}
+
+/**
+ * Pins a thread to one CPU of the list.
+ *
+ * @param[in] affinity  Pointer to the initialized `Affinity`.
+ * @param[in] thread    Thread to pin.
+ * @param[in] index     Position in the CPU list, wrapped around its length.
+ * @return              0 on success, -1 on failure.
+ */
+int affinity_pin_cpu(const Affinity *affinity, pthread_t thread, int index)
+{
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(affinity->cpus[index % affinity->cpu_count], &set);
+    if (pthread_setaffinity_np(thread, sizeof(set), &set) != 0)
+    {
+        fprintf(stderr, "Failed to pin a thread to CPU %d\n", affinity->cpus[index % affinity->cpu_count]);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Pins a thread to every CPU of the list on one node, leaving the scheduler to pick among them.
+ *
+ * @param[in] affinity  Pointer to the initialized `Affinity`.
+ * @param[in] thread    Thread to pin.
+ * @param[in] node      Index of the node in `affinity->nodes`, or -1 for every CPU of the list.
+ * @return              0 on success, -1 on failure.
+ */
+int affinity_pin_node(const Affinity *affinity, pthread_t thread, int node)
+{
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    for (int i = 0; i < affinity->cpu_count; i++)
+    {
+        if (node < 0 || affinity->cpu_nodes[i] == node)
+            CPU_SET(affinity->cpus[i], &set);
+    }
+    if (pthread_setaffinity_np(thread, sizeof(set), &set) != 0)
+    {
+        fprintf(stderr, "Failed to pin a thread to the CPUs of node %d\n", (node < 0) ? -1 : affinity->nodes[node]);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Moves the amounts of each node's resources into a block of memory bound to that node.
+ *
+ * The blocks are mapped and bound before they are first written, so their pages are taken
+ * from the node whatever thread touches them first. A kernel refusing the binding leaves
+ * the pages to first touch. Each block holds its node's resources in id order, a cache line
+ * each, so with a `ResourceTable` every node gets its own slice of the table in local memory
+ * and the manager's table, which the amounts moved out of, is emptied.
+ *
+ * @param[in,out] affinity  Pointer to the `Affinity` the resources were placed with.
+ * @param[in,out] manager   Pointer to the placed `Manager`.
+ */
+static void affinity_allocate(Affinity *affinity, Manager *manager)
+{
+    int resource_count = manager->resource_array.size;
+    long page_size = sysconf(_SC_PAGESIZE);
+
+    if (resource_count == 0)
+        return;
+
+    affinity->blocks = calloc(affinity->node_count, sizeof(void *));
+    affinity->block_sizes = calloc(affinity->node_count, sizeof(size_t));
+    if (affinity->blocks == NULL || affinity->block_sizes == NULL)
+    {
+        perror("Failed to allocate memory for the node blocks");
+        return;
+    }
+    if (page_size <= 0)
+        page_size = 4096;
+
+    for (int node = 0; node < affinity->node_count; node++)
+    {
+        int count = 0;
+        for (int i = 0; i < resource_count; i++)
+            count += manager->resource_array.resources[i]->numa_node == node;
+        if (count == 0)
+            continue;
+
+        size_t size = (sizeof(ResourceCounter) * count + page_size - 1) / page_size * page_size;
+        void *block = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (block == MAP_FAILED)
+        {
+            perror("Failed to map the resource amounts of a node");
+            continue;
+        }
+
+        // Preferred rather than bound, a full node spills over instead of failing the run
+        int node_id = affinity->nodes[node];
+        unsigned long mask[node_id / (8 * sizeof(unsigned long)) + 1];
+        memset(mask, 0, sizeof(mask));
+        mask[node_id / (8 * sizeof(unsigned long))] = 1UL << (node_id % (8 * sizeof(unsigned long)));
+        syscall(SYS_mbind, block, size, MPOL_PREFERRED, mask, (unsigned long)(8 * sizeof(mask) + 1), 0);
+
+        affinity->blocks[node] = block;
+        affinity->block_sizes[node] = size;
+
+        ResourceCounter *counters = block;
+        int next = 0;
+        for (int i = 0; i < resource_count; i++)
+        {
+            Resource *resource = manager->resource_array.resources[i];
+            if (resource->numa_node != node)
+                continue;
+            atomic_init(&counters[next].value, atomic_load_explicit(resource->amount, memory_order_relaxed));
+            resource->amount = &counters[next].value;
+            next++;
+        }
+    }
+
+    resource_table_init(&manager->resource_table);
+}
+
+/**
+ * Parses a CPU list such as "0-3,8-11" into an array, growing it (doubling the size) as needed.
+ *
+ * @param[in]  list   Comma separated CPU numbers and ranges.
+ * @param[out] cpus   Set to the malloc'ed CPUs in list order, each once, NULL on failure.
+ * @param[out] count  Set to the number of CPUs.
+ * @return            0 on success, -1 if the list is malformed or memory ran out.
+ */
+static int affinity_parse_list(const char *list, int **cpus, int *count)
+{
+    int capacity = 0;
+    const char *cursor = list;
+
+    *cpus = NULL;
+    *count = 0;
+
+    while (*cursor != '\0')
+    {
+        char *end;
+        if (!isdigit((unsigned char)*cursor))
+            goto fail;
+        long first = strtol(cursor, &end, 10);
+        long last = first;
+        cursor = end;
+
+        if (*cursor == '-')
+        {
+            cursor++;
+            if (!isdigit((unsigned char)*cursor))
+                goto fail;
+            last = strtol(cursor, &end, 10);
+            cursor = end;
+        }
+        if (last < first || last >= CPU_SETSIZE)
+            goto fail;
+
+        for (long cpu = first; cpu <= last; cpu++)
+        {
+            if (affinity_add_cpu(cpus, count, &capacity, (int)cpu) != 0)
+                goto fail;
+        }
+
+        if (*cursor == ',')
+            cursor++;
+        else if (*cursor != '\0' && *cursor != '\n')
+            goto fail;
+        else
+            break;
+    }
+    return 0;
+
+fail:
+    free(*cpus);
+    *cpus = NULL;
+    *count = 0;
+    return -1;
+}
+
+/**
+ * Appends a CPU to a list unless it is in it already, growing it (doubling the size) when full.
+ *
+ * @param[in,out] cpus      Pointer to the malloc'ed list.
+ * @param[in,out] count     Number of CPUs in the list.
+ * @param[in,out] capacity  Number of CPUs the list has room for.
+ * @param[in]     cpu       CPU to add.
+ * @return                  0 on success, -1 if memory ran out.
+ */
+static int affinity_add_cpu(int **cpus, int *count, int *capacity, int cpu)
+{
+    for (int i = 0; i < *count; i++)
+    {
+        if ((*cpus)[i] == cpu)
+            return 0;
+    }
+
+    if (*count == *capacity)
+    {
+        int new_capacity = *capacity ? *capacity * 2 : 16;
+        int *new_cpus = malloc(sizeof(int) * new_capacity);
+        if (new_cpus == NULL)
+        {
+            perror("Failed to allocate memory for the CPU list");
+            return -1;
+        }
+        for (int i = 0; i < *count; i++)
+            new_cpus[i] = (*cpus)[i];
+        free(*cpus);
+        *cpus = new_cpus;
+        *capacity = new_capacity;
+    }
+
+    (*cpus)[(*count)++] = cpu;
+    return 0;
+}
+
+/**
+ * Looks up the NUMA node of every configured CPU in sysfs.
+ *
+ * @param[in]  affinity  Pointer to the `Affinity` with its CPUs set.
+ * @param[out] node_ids  Set to the node id of each CPU, 0 for CPUs sysfs does not list.
+ */
+static void affinity_read_nodes(Affinity *affinity, int *node_ids)
+{
+    DIR *directory = opendir(AFFINITY_NODE_PATH);
+    struct dirent *entry;
+    char path[512], line[4096];
+
+    for (int i = 0; i < affinity->cpu_count; i++)
+        node_ids[i] = 0;
+    if (directory == NULL)
+        return;
+
+    while ((entry = readdir(directory)) != NULL)
+    {
+        int node_id, *node_cpus, node_cpu_count;
+        if (sscanf(entry->d_name, "node%d", &node_id) != 1)
+            continue;
+
+        snprintf(path, sizeof(path), AFFINITY_NODE_PATH "/%s/cpulist", entry->d_name);
+        FILE *file = fopen(path, "r");
+        if (file == NULL)
+            continue;
+        int read = fgets(line, sizeof(line), file) != NULL;
+        fclose(file);
+
+        // Memory-only nodes have an empty list
+        if (!read || affinity_parse_list(line, &node_cpus, &node_cpu_count) != 0)
+            continue;
+        for (int i = 0; i < affinity->cpu_count; i++)
+        {
+            for (int c = 0; c < node_cpu_count; c++)
+            {
+                if (node_cpus[c] == affinity->cpus[i])
+                    node_ids[i] = node_id;
+            }
+        }
+        free(node_cpus);
+    }
+    closedir(directory);
+}
+
+/**
+ * Finds the root of a resource's group, halving the path on the way.
+ *
+ * @param[in,out] parents  Parent of every resource id, a root is its own parent.
+ * @param[in]     id       Resource id.
+ * @return                 Id of the root.
+ */
+static int affinity_find(int *parents, int id)
+{
+    while (parents[id] != id)
+    {
+        parents[id] = parents[parents[id]];
+        id = parents[id];
+    }
+    return id;
+}
+
+/**
+ * Orders groups by weight, heaviest first, then by root so the placement is repeatable.
+ *
+ * @param[in] a  Pointer to the first `AffinityGroup`.
+ * @param[in] b  Pointer to the second `AffinityGroup`.
+ * @return       Negative, zero or positive as for `qsort`.
+ */
+static int affinity_compare_groups(const void *a, const void *b)
+{
+    const AffinityGroup *first = a, *second = b;
+    if (first->weight != second->weight)
+        return second->weight - first->weight;
+    return first->root - second->root;
+}
+
+/**
+ * Picks the node with the fewest systems per CPU once `weight` more systems are added.
+ *
+ * @param[in] affinity    Pointer to the initialized `Affinity`.
+ * @param[in] loads       Systems placed on each node so far.
+ * @param[in] cpu_counts  Configured CPUs of each node, at least 1.
+ * @param[in] weight      Systems about to be placed.
+ * @return                Index of the node.
+ */
+static int affinity_least_loaded(const Affinity *affinity, const int *loads, const int *cpu_counts, int weight)
+{
+    int best = 0;
+
+    // a / b < c / d without dividing
+    for (int node = 1; node < affinity->node_count; node++)
+    {
+        if ((long long)(loads[node] + weight) * cpu_counts[best] < (long long)(loads[best] + weight) * cpu_counts[node])
+            best = node;
+    }
+    return best;
+}
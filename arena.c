@@ -0,0 +1,129 @@
+#include "defs.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+// A chunk of memory the arena hands out from, the data follows the header
+typedef struct ArenaBlock
+{
+    struct ArenaBlock *next;
+    size_t size; // Bytes available after the header
+    size_t used;
+} ArenaBlock;
+
+static ArenaBlock *arena_add_block(Arena *arena, size_t size);
+
+/**
+ * Initializes an empty `Arena`.
+ *
+ * No memory is allocated until the first `arena_alloc`.
+ *
+ * @param[out] arena  Pointer to the `Arena` to initialize.
+ */
+void arena_init(Arena *arena)
+{
+    arena->head = NULL;
+}
+
+/**
+ * Frees every block of the `Arena` at once.
+ *
+ * All pointers handed out by the arena become invalid.
+ *
+ * @param[in,out] arena  Pointer to the `Arena` to clean.
+ */
+void arena_clean(Arena *arena)
+{
+    if (arena == NULL)
+        return;
+
+    ArenaBlock *block = arena->head;
+    while (block != NULL)
+    {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->head = NULL;
+}
+
+/**
+ * Carves `size` bytes aligned to `alignment` out of the `Arena`.
+ *
+ * Objects allocated one after another end up next to each other in memory. Requests larger
+ * than `ARENA_BLOCK_SIZE` get a block of their own. The arena is not thread safe, it is
+ * meant to be filled while the simulation is loaded.
+ *
+ * @param[in,out] arena      Pointer to the `Arena`.
+ * @param[in]     size       Number of bytes needed.
+ * @param[in]     alignment  Required alignment, a power of two.
+ * @return                   Pointer to the memory, or NULL if it could not be allocated.
+ */
+void *arena_alloc(Arena *arena, size_t size, size_t alignment)
+{
+    ArenaBlock *block = arena->head;
+
+    if (block != NULL)
+    {
+        uintptr_t base = (uintptr_t)(block + 1);
+        uintptr_t start = (base + block->used + alignment - 1) & ~(uintptr_t)(alignment - 1);
+        if (start + size <= base + block->size)
+        {
+            block->used = start + size - base;
+            return (void *)start;
+        }
+    }
+
+    // Current block is full, start a new one with room for the alignment padding
+    block = arena_add_block(arena, (size + alignment > ARENA_BLOCK_SIZE) ? size + alignment : ARENA_BLOCK_SIZE);
+    if (block == NULL)
+        return NULL;
+
+    uintptr_t base = (uintptr_t)(block + 1);
+    uintptr_t start = (base + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    block->used = start + size - base;
+    return (void *)start;
+}
+
+/**
+ * Copies a string into the `Arena`.
+ *
+ * @param[in,out] arena   Pointer to the `Arena`.
+ * @param[in]     string  String to copy.
+ * @param[in]     length  Number of characters to copy, the copy is null terminated.
+ * @return                Pointer to the copy, or NULL if it could not be allocated.
+ */
+char *arena_strndup(Arena *arena, const char *string, size_t length)
+{
+    char *copy = arena_alloc(arena, length + 1, 1);
+    if (copy == NULL)
+        return NULL;
+
+    memcpy(copy, string, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+/**
+ * Allocates a new block and makes it the one the arena hands out from.
+ *
+ * @param[in,out] arena  Pointer to the `Arena`.
+ * @param[in]     size   Usable bytes in the block.
+ * @return               Pointer to the block, or NULL if it could not be allocated.
+ */
+static ArenaBlock *arena_add_block(Arena *arena, size_t size)
+{
+    ArenaBlock *block = malloc(sizeof(ArenaBlock) + size);
+    if (block == NULL)
+    {
+        perror("Failed to allocate memory for arena block");
+        return NULL;
+    }
+
+    block->next = arena->head;
+    block->size = size;
+    block->used = 0;
+    arena->head = block;
+    return block;
+}
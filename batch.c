@@ -0,0 +1,333 @@
+#include "defs.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+// Helper functions just used by this C file to clean up our code
+
+static int batch_spawn(Manager *manager, unsigned int seed, pid_t *pid);
+static void batch_child(Manager *manager, unsigned int seed, int fd);
+static void batch_vary(Manager *manager, unsigned int seed);
+static double batch_random(unsigned int *state);
+
+/**
+ * Runs `run_count` variations of the loaded scenario, `parallel` at a time, and prints a summary.
+ *
+ * Every run is a forked copy of this process. It shares the loaded scenario copy-on-write,
+ * so only the pages the run touches get copied. It varies the capacities and processing
+ * times by up to `BATCH_VARIATION` and runs on the discrete-event scheduler. Run `i` uses
+ * seed `i + 1`, and the same seed always gives the same run. Must be called before any
+ * thread is started.
+ *
+ * @param[in] manager    Pointer to the loaded `Manager` with its index built.
+ * @param[in] run_count  Number of runs.
+ * @param[in] parallel   Number of runs at the same time, 0 or less for one per CPU core.
+ * @return               0 if every run finished and reported back, 1 otherwise.
+ */
+int batch_run(Manager *manager, int run_count, int parallel)
+{
+    BatchResult *results = malloc(sizeof(BatchResult) * ALLOC_COUNT(run_count));
+
+    if (results == NULL)
+    {
+        perror("Failed to allocate memory for the batch");
+        return 1;
+    }
+
+    int collected = batch_execute(manager, 1, run_count, parallel, results);
+    batch_summarize(manager, results, run_count);
+
+    free(results);
+    return (collected == run_count) ? 0 : 1;
+}
+
+/**
+ * Runs the variations with seeds `first_seed` to `first_seed + run_count - 1`, `parallel` at a time.
+ *
+ * The part of `batch_run` that does the work, also used by nodes serving a distributed batch.
+ *
+ * @param[in]  manager     Pointer to the loaded `Manager` with its index built.
+ * @param[in]  first_seed  Seed of the first run, at least 1.
+ * @param[in]  run_count   Number of runs.
+ * @param[in]  parallel    Number of runs at the same time, 0 or less for one per CPU core.
+ * @param[out] results     `run_count` results in seed order, failed runs get a seed of 0.
+ * @return                 Number of runs that finished and reported back.
+ */
+int batch_execute(Manager *manager, unsigned int first_seed, int run_count, int parallel, BatchResult *results)
+{
+    pid_t *pids = malloc(sizeof(pid_t) * ALLOC_COUNT(run_count));
+    int *fds = malloc(sizeof(int) * ALLOC_COUNT(run_count));
+    int started = 0, running = 0, collected = 0, failed = 0;
+
+    if (pids == NULL || fds == NULL)
+    {
+        perror("Failed to allocate memory for the batch");
+        free(pids);
+        free(fds);
+        for (int i = 0; i < run_count; i++)
+            results[i].seed = 0;
+        return 0;
+    }
+
+    if (parallel <= 0)
+    {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        parallel = (cores > 0) ? (int)cores : 1;
+    }
+
+    // Output of the children would interleave with ours
+    fflush(stdout);
+
+    while (collected + failed < run_count)
+    {
+        // Keep `parallel` runs going
+        while (started < run_count && running < parallel)
+        {
+            fds[started] = batch_spawn(manager, first_seed + started, &pids[started]);
+            if (fds[started] < 0)
+            {
+                pids[started] = -1;
+                results[started].seed = 0;
+                failed++;
+            }
+            else
+            {
+                running++;
+            }
+            started++;
+        }
+        if (running == 0)
+            break;
+
+        int status;
+        pid_t pid = wait(&status);
+        if (pid < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("Failed to wait for a batch run");
+            break;
+        }
+
+        for (int i = 0; i < started; i++)
+        {
+            if (pids[i] != pid)
+                continue;
+
+            // The result is far smaller than a pipe buffer, it is all there once the child exited.
+            // Results stay in seed order whatever order the runs finish in.
+            if (WIFEXITED(status) && WEXITSTATUS(status) == 0 &&
+                read(fds[i], &results[i], sizeof(BatchResult)) == (ssize_t)sizeof(BatchResult))
+            {
+                collected++;
+            }
+            else
+            {
+                fprintf(stderr, "Batch run with seed %u failed\n", first_seed + i);
+                results[i].seed = 0;
+                failed++;
+            }
+            close(fds[i]);
+            pids[i] = -1;
+            running--;
+            break;
+        }
+    }
+
+    // Once waiting failed, the runs left are lost as well
+    for (int i = 0; i < run_count; i++)
+    {
+        if (i >= started || pids[i] >= 0)
+            results[i].seed = 0;
+        if (i < started && pids[i] >= 0)
+            close(fds[i]);
+    }
+
+    free(pids);
+    free(fds);
+    return collected;
+}
+
+/**
+ * Forks the process of one run.
+ *
+ * @param[in]  manager  Pointer to the loaded `Manager`.
+ * @param[in]  seed     Seed of the run.
+ * @param[out] pid      Set to the process id of the run.
+ * @return              Read end of the pipe the run reports on, or -1 on failure.
+ */
+static int batch_spawn(Manager *manager, unsigned int seed, pid_t *pid)
+{
+    int fds[2];
+
+    if (pipe(fds) != 0)
+    {
+        perror("Failed to create a pipe for a batch run");
+        return -1;
+    }
+
+    *pid = fork();
+    if (*pid < 0)
+    {
+        perror("Failed to fork a batch run");
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+
+    if (*pid == 0)
+    {
+        close(fds[0]);
+        batch_child(manager, seed, fds[1]);
+    }
+
+    close(fds[1]);
+    return fds[0];
+}
+
+/**
+ * Body of the process of one run, never returns.
+ *
+ * @param[in,out] manager  Pointer to this process' copy of the loaded `Manager`.
+ * @param[in]     seed     Seed of the run.
+ * @param[in]     fd       Write end of the pipe to report the `BatchResult` on.
+ */
+static void batch_child(Manager *manager, unsigned int seed, int fd)
+{
+    Simulation simulation;
+    BatchResult result;
+
+    // The event log of hundreds of runs is of no use, only the result is
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd >= 0)
+    {
+        dup2(null_fd, STDOUT_FILENO);
+        close(null_fd);
+    }
+
+    batch_vary(manager, seed);
+
+    simulation_init(&simulation, manager->system_array.size);
+    simulation.time_limit = BATCH_TIME_LIMIT;
+    simulation_run(&simulation, manager);
+
+    result.seed = seed;
+    result.end_resource = (manager->end_resource != NULL) ? manager->end_resource->id : -1;
+    result.end_status = manager->end_status;
+    result.time = simulation.clock;
+    result.tick_count = simulation.tick_count;
+    simulation_clean(&simulation);
+
+    // The parent frees everything, exit without running any cleanup twice
+    _exit(write(fd, &result, sizeof(result)) == (ssize_t)sizeof(result) ? 0 : 1);
+}
+
+/**
+ * Varies the capacities and processing times of the loaded scenario for one run.
+ *
+ * Every capacity and processing time is scaled by a factor drawn uniformly between
+ * `1 - BATCH_VARIATION` and `1 + BATCH_VARIATION`, in load order so a seed always
+ * gives the same scenario. Amounts are clamped to the new capacities.
+ *
+ * @param[in,out] manager  Pointer to the `Manager` to vary.
+ * @param[in]     seed     Seed of the run.
+ */
+static void batch_vary(Manager *manager, unsigned int seed)
+{
+    unsigned int state = seed * 2654435761u + 1;
+
+    for (int i = 0; i < manager->resource_array.size; i++)
+    {
+        Resource *resource = manager->resource_array.resources[i];
+        double factor = 1.0 + BATCH_VARIATION * (2.0 * batch_random(&state) - 1.0);
+        int capacity = (int)(resource->max_capacity * factor + 0.5);
+
+        resource->max_capacity = (capacity > 0) ? capacity : 1;
+        resource->low_threshold = (int)(THRESHOLD_RESOURCE_LOW * resource->max_capacity);
+        if (resource_get_amount(resource) > resource->max_capacity)
+            resource_set_amount(resource, resource->max_capacity);
+    }
+
+    for (int i = 0; i < manager->system_array.size; i++)
+    {
+        System *system = manager->system_array.systems[i];
+        double factor = 1.0 + BATCH_VARIATION * (2.0 * batch_random(&state) - 1.0);
+        int processing_time = (int)(system->processing_time * factor + 0.5);
+
+        system->processing_time = (processing_time > 0) ? processing_time : 1;
+    }
+}
+
+/**
+ * Draws a number between 0 and 1 from an xorshift32 generator.
+ *
+ * @param[in,out] state  Non-zero generator state.
+ * @return               Uniform number in [0, 1).
+ */
+static double batch_random(unsigned int *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state / 4294967296.0;
+}
+
+/**
+ * Prints one line per run and the runs grouped by what ended them.
+ *
+ * @param[in] manager  Pointer to the loaded `Manager`, for the resource names.
+ * @param[in] results  Results in seed order, failed runs have a seed of 0 and are skipped.
+ * @param[in] count    Number of entries in `results`.
+ */
+void batch_summarize(Manager *manager, const BatchResult *results, int count)
+{
+    int resource_count = manager->resource_array.size;
+    int finished = 0;
+
+    printf("Seed  Ended by             Virtual ms      Ticks\n");
+    for (int i = 0; i < count; i++)
+    {
+        const BatchResult *result = &results[i];
+        if (result->seed == 0)
+            continue;
+        finished++;
+        const char *name = (result->end_resource >= 0) ? manager->resource_array.resources[result->end_resource]->name
+                                                       : "time limit";
+        printf("%4u  %-20s %10lld %10lld\n", result->seed, name, result->time, result->tick_count);
+    }
+
+    // Group by the resource that ended the run, the last group is the time limit
+    printf("\n%d runs, capacities and processing times varied by up to %d%%\n", finished, (int)(BATCH_VARIATION * 100));
+    for (int group = 0; group <= resource_count; group++)
+    {
+        int id = (group < resource_count) ? group : -1;
+        long long min = 0, max = 0, sum = 0;
+        int runs = 0, status = STATUS_OK;
+
+        for (int i = 0; i < count; i++)
+        {
+            if (results[i].seed == 0 || results[i].end_resource != id)
+                continue;
+            if (runs == 0 || results[i].time < min)
+                min = results[i].time;
+            if (runs == 0 || results[i].time > max)
+                max = results[i].time;
+            sum += results[i].time;
+            status = results[i].end_status;
+            runs++;
+        }
+        if (runs == 0)
+            continue;
+
+        if (id < 0)
+            printf("  Unfinished after %d ms: %d runs\n", BATCH_TIME_LIMIT, runs);
+        else
+            printf("  %s %s: %d runs, min %lld ms, mean %lld ms, max %lld ms\n",
+                   manager->resource_array.resources[id]->name, status == STATUS_EMPTY ? "depleted" : "reached capacity",
+                   runs, min, sum / runs, max);
+    }
+}
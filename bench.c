@@ -0,0 +1,336 @@
+#include "defs.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Benchmarks of the event queue, resource contention and whole simulations.
+ *
+ *     make bench
+ *     ./p2_bench
+ *
+ * Built with optimization and without the thread sanitizer, so the numbers are comparable
+ * between the queue and locking variants, e.g. `make bench DEFINES=-DRESOURCE_USE_SEMAPHORE`.
+ */
+
+#define BENCH_MAX_THREADS 8
+#define BENCH_QUEUE_EVENTS 1000000  // Events pushed per queue run, split between the producers
+#define BENCH_RESOURCE_OPS 2000000  // Consume/store pairs per resource run, split between the threads
+#define BENCH_EVENT_RESOURCES 64    // Distinct resources the producers report about
+
+// Shared state of one queue run
+typedef struct QueueBench
+{
+    EventQueue queue;
+    System systems[BENCH_MAX_THREADS];
+    Resource resources[BENCH_EVENT_RESOURCES];
+    int events_per_producer;
+    atomic_int producers_left;
+    pthread_barrier_t start;
+} QueueBench;
+
+// A producer thread of a queue run
+typedef struct QueueProducer
+{
+    QueueBench *bench;
+    int index;
+} QueueProducer;
+
+// Shared state of one resource run
+typedef struct ResourceBench
+{
+    Resource first;
+    Resource second;
+    int pairs_per_thread;
+    int use_consume_all;
+    pthread_barrier_t start;
+} ResourceBench;
+
+static double bench_now_ms(void);
+static void bench_queue(int producer_count, int use_lanes);
+static void *bench_queue_producer(void *arg);
+static void bench_resources(int thread_count, int use_consume_all);
+static void *bench_resource_worker(void *arg);
+static void bench_simulation(int system_count);
+static void bench_build_scenario(Manager *manager, int system_count);
+
+int main(void)
+{
+    static const int thread_counts[] = {1, 2, 4, 8};
+    static const int system_counts[] = {10, 1000, 100000};
+
+    printf("%-34s %8s %14s %14s %10s %10s\n", "event queue", "threads", "accepted/s", "pushes/s", "merged", "dropped");
+    for (int lanes = 0; lanes <= 1; lanes++)
+    {
+        for (size_t i = 0; i < sizeof(thread_counts) / sizeof(thread_counts[0]); i++)
+            bench_queue(thread_counts[i], lanes);
+    }
+
+    printf("\n%-34s %8s %14s\n", "resource contention", "threads", "ops/s");
+    for (int consume_all = 0; consume_all <= 1; consume_all++)
+    {
+        for (size_t i = 0; i < sizeof(thread_counts) / sizeof(thread_counts[0]); i++)
+            bench_resources(thread_counts[i], consume_all);
+    }
+
+    printf("\n%-34s %8s %14s %14s %10s\n", "discrete-event simulation", "systems", "ticks/s", "events/s", "wall ms");
+    for (size_t i = 0; i < sizeof(system_counts) / sizeof(system_counts[0]); i++)
+        bench_simulation(system_counts[i]);
+
+    return 0;
+}
+
+/**
+ * Reads a monotonic clock in milliseconds.
+ *
+ * @return  Milliseconds since an arbitrary fixed point.
+ */
+static double bench_now_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+/**
+ * Pushes `BENCH_QUEUE_EVENTS` events from `producer_count` threads while this thread drains them.
+ *
+ * The consumer pops in batches like the manager does. Events repeat their keys, so with a
+ * slow consumer part of them are merged instead of queued, and full lanes drop events. The
+ * headline is the rate of pushes that were queued as events of their own, which is the same
+ * work for lanes and rings; the rate of all pushes, merged and dropped ones included, follows.
+ *
+ * @param[in] producer_count  Number of producer threads.
+ * @param[in] use_lanes       Non-zero to give every producer a lock-free lane.
+ */
+static void bench_queue(int producer_count, int use_lanes)
+{
+    static QueueBench bench;
+    pthread_t threads[BENCH_MAX_THREADS];
+    QueueProducer producers[BENCH_MAX_THREADS];
+    Event events[MANAGER_BATCH_SIZE];
+
+    memset(&bench, 0, sizeof(bench));
+    event_queue_init(&bench.queue);
+    if (use_lanes)
+        event_queue_attach_lanes(&bench.queue, producer_count);
+    for (int i = 0; i < BENCH_MAX_THREADS; i++)
+        bench.systems[i].id = i;
+    bench.events_per_producer = BENCH_QUEUE_EVENTS / producer_count;
+    atomic_init(&bench.producers_left, producer_count);
+    pthread_barrier_init(&bench.start, NULL, producer_count + 1);
+
+    for (int i = 0; i < producer_count; i++)
+    {
+        producers[i] = (QueueProducer){&bench, i};
+        pthread_create(&threads[i], NULL, bench_queue_producer, &producers[i]);
+    }
+
+    pthread_barrier_wait(&bench.start);
+    double start = bench_now_ms();
+
+    // Drain until every producer is done and nothing is left
+    while (1)
+    {
+        int done = atomic_load(&bench.producers_left) == 0;
+        int count = event_queue_pop_batch(&bench.queue, events, MANAGER_BATCH_SIZE);
+        if (count == 0 && done)
+            break;
+    }
+
+    double elapsed = bench_now_ms() - start;
+    for (int i = 0; i < producer_count; i++)
+        pthread_join(threads[i], NULL);
+
+    long long pushed = (long long)bench.events_per_producer * producer_count;
+    int merged = atomic_load(&bench.queue.coalesced_count);
+    int dropped = atomic_load(&bench.queue.overflow_count);
+    printf("%-34s %8d %14.0f %14.0f %10d %10d\n", use_lanes ? "push/pop, lock-free lanes" : "push/pop, shared rings",
+           producer_count, (pushed - merged - dropped) / elapsed * 1000.0, pushed / elapsed * 1000.0, merged, dropped);
+
+    pthread_barrier_destroy(&bench.start);
+    event_queue_clean(&bench.queue);
+}
+
+/**
+ * Thread function pushing the events of one producer.
+ *
+ * @param arg Pointer to the `QueueProducer` (cast from void*)
+ * @return Always returns NULL
+ */
+static void *bench_queue_producer(void *arg)
+{
+    QueueProducer *producer = (QueueProducer *)arg;
+    QueueBench *bench = producer->bench;
+    Event event;
+
+    pthread_barrier_wait(&bench->start);
+    for (int i = 0; i < bench->events_per_producer; i++)
+    {
+        event_init(&event, &bench->systems[producer->index], &bench->resources[i % BENCH_EVENT_RESOURCES],
+                   STATUS_LOW + i % 3, PRIORITY_LOW + i % PRIORITY_COUNT, i);
+        event_queue_push(&bench->queue, &event);
+    }
+
+    atomic_fetch_sub(&bench->producers_left, 1);
+    return NULL;
+}
+
+/**
+ * Consumes and stores back one unit of shared resources from `thread_count` threads.
+ *
+ * @param[in] thread_count     Number of threads hammering the resources.
+ * @param[in] use_consume_all  Non-zero to reserve two resources at once with `resource_consume_all`.
+ */
+static void bench_resources(int thread_count, int use_consume_all)
+{
+    static ResourceBench bench;
+    pthread_t threads[BENCH_MAX_THREADS];
+
+    resource_init(&bench.first, "First", 1000, 2000);
+    resource_init(&bench.second, "Second", 1000, 2000);
+    bench.first.id = 0;
+    bench.second.id = 1;
+    bench.pairs_per_thread = BENCH_RESOURCE_OPS / thread_count;
+    bench.use_consume_all = use_consume_all;
+    pthread_barrier_init(&bench.start, NULL, thread_count + 1);
+
+    for (int i = 0; i < thread_count; i++)
+        pthread_create(&threads[i], NULL, bench_resource_worker, &bench);
+
+    pthread_barrier_wait(&bench.start);
+    double start = bench_now_ms();
+    for (int i = 0; i < thread_count; i++)
+        pthread_join(threads[i], NULL);
+    double elapsed = bench_now_ms() - start;
+
+    // One consume and one store per pair and resource
+    long long ops = 2LL * bench.pairs_per_thread * thread_count * (use_consume_all ? 2 : 1);
+    printf("%-34s %8d %14.0f\n", use_consume_all ? "consume_all + store, 2 resources" : "consume + store, 1 resource",
+           thread_count, ops / elapsed * 1000.0);
+
+    pthread_barrier_destroy(&bench.start);
+    resource_destroy(&bench.first);
+    resource_destroy(&bench.second);
+}
+
+/**
+ * Thread function of a resource run.
+ *
+ * @param arg Pointer to the `ResourceBench` (cast from void*)
+ * @return Always returns NULL
+ */
+static void *bench_resource_worker(void *arg)
+{
+    ResourceBench *bench = (ResourceBench *)arg;
+    ResourceAmount amounts[2] = {{&bench->first, 1}, {&bench->second, 1}};
+    int failed_index, crossed[2];
+
+    pthread_barrier_wait(&bench->start);
+    for (int i = 0; i < bench->pairs_per_thread; i++)
+    {
+        if (bench->use_consume_all)
+        {
+            if (resource_consume_all(amounts, 2, &failed_index, crossed) != STATUS_OK)
+                continue;
+            for (int r = 0; r < 2; r++)
+            {
+                int one = 1;
+                resource_store(amounts[r].resource, &one, &crossed[r]);
+            }
+        }
+        else
+        {
+            int one = 1;
+            if (resource_consume(&bench->first, 1, &crossed[0]) == STATUS_OK)
+                resource_store(&bench->first, &one, &crossed[0]);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Runs a synthetic scenario of `system_count` systems on the discrete-event scheduler.
+ *
+ * Events are recorded into a telemetry stream going to /dev/null, so the terminal does
+ * not take part in the measurement.
+ *
+ * @param[in] system_count  Number of systems, plus the one ending the run.
+ */
+static void bench_simulation(int system_count)
+{
+    Manager manager;
+    Telemetry telemetry;
+    Simulation simulation;
+
+    manager_init(&manager);
+    bench_build_scenario(&manager, system_count);
+    manager_build_index(&manager);
+    if (telemetry_open(&telemetry, "/dev/null", MANAGER_DISPLAY_INTERVAL) == 0)
+        manager.telemetry = &telemetry;
+
+    simulation_init(&simulation, manager.system_array.size);
+    simulation_run(&simulation, &manager);
+
+    printf("%-34s %8d %14.0f %14.0f %10.1f\n", "ring of pools, 1000 ms virtual", system_count,
+           simulation.tick_count / simulation.wall_ms * 1000.0, simulation.event_count / simulation.wall_ms * 1000.0,
+           simulation.wall_ms);
+
+    simulation_clean(&simulation);
+    if (manager.telemetry != NULL)
+        telemetry_close(&telemetry);
+    manager_clean(&manager);
+}
+
+/**
+ * Builds a synthetic scenario of `system_count` systems into an empty `Manager`.
+ *
+ * Every ten systems share a pool resource, each system moves one unit from its pool to
+ * the next one around the ring, so pools keep filling up and running dry. A timer system
+ * fills a destination resource that ends the run after 1000 ms of virtual time.
+ *
+ * @param[in,out] manager       Pointer to an initialized `Manager`.
+ * @param[in]     system_count  Number of pool systems.
+ */
+static void bench_build_scenario(Manager *manager, int system_count)
+{
+    int pool_count = system_count / 10 + 1;
+    char name[32];
+    Resource **pools = malloc(sizeof(Resource *) * pool_count);
+    Resource *clock;
+    System *system;
+    ResourceAmount consumed, produced;
+
+    if (pools == NULL)
+    {
+        perror("Failed to allocate memory for the benchmark pools");
+        exit(1);
+    }
+
+    for (int i = 0; i < pool_count; i++)
+    {
+        snprintf(name, sizeof(name), "Pool %d", i);
+        resource_create(&pools[i], name, 50, 100, &manager->arena);
+        resource_array_add(&manager->resource_array, pools[i]);
+    }
+    resource_create(&clock, "Clock", 0, 100, &manager->arena);
+    clock->flags = RESOURCE_FLAG_DESTINATION;
+    resource_array_add(&manager->resource_array, clock);
+
+    for (int i = 0; i < system_count; i++)
+    {
+        snprintf(name, sizeof(name), "Mover %d", i);
+        resource_amount_init(&consumed, pools[i % pool_count], 1);
+        resource_amount_init(&produced, pools[(i + 1) % pool_count], 1);
+        system_create(&system, name, consumed, produced, 1 + i % 5, &manager->event_queue, &manager->arena);
+        system_array_add(&manager->system_array, system);
+    }
+
+    resource_amount_init(&consumed, NULL, 0);
+    resource_amount_init(&produced, clock, 1);
+    system_create(&system, "Timer", consumed, produced, 10, &manager->event_queue, &manager->arena);
+    system_array_add(&manager->system_array, system);
+
+    free(pools);
+}
@@ -0,0 +1,455 @@
+#include "defs.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Helper functions just used by this C file to clean up our code
+
+static int checkpoint_drain_events(Manager *manager, Event **events);
+static int checkpoint_entry_compare(const void *a, const void *b);
+static int checkpoint_write_all(int fd, const void *data, size_t size);
+static int checkpoint_validate(Manager *manager, const CheckpointHeader *header, const unsigned char *cursor);
+
+/**
+ * Saves the state of a discrete-event run to a checkpoint file.
+ *
+ * Writes the resource amounts, the state of every system, the pending events and the
+ * schedule. Called between two ticks of `simulation_run`, where nothing else runs, so the
+ * snapshot is consistent without stopping anything. The file is written next to `path`
+ * and renamed over it, so an interrupted save never leaves a torn checkpoint behind.
+ * Only the state is saved, restoring needs the same scenario to be loaded first.
+ *
+ * @param[in,out] manager     Pointer to the `Manager`, its pending events are put back as they were.
+ * @param[in]     simulation  Pointer to the `Simulation` being run.
+ * @param[in]     path        File to write.
+ * @return                    0 on success, -1 on failure.
+ */
+int checkpoint_save(Manager *manager, const Simulation *simulation, const char *path)
+{
+    CheckpointHeader header;
+    Event *events = NULL;
+    char temp_path[4096];
+    int status = 0;
+
+    int event_count = checkpoint_drain_events(manager, &events);
+    if (event_count < 0)
+        return -1;
+
+    header.magic = CHECKPOINT_MAGIC;
+    header.version = CHECKPOINT_VERSION;
+    header.resource_count = manager->resource_array.size;
+    header.system_count = manager->system_array.size;
+    header.event_count = event_count;
+    header.schedule_count = simulation->size;
+    header.fingerprint = cluster_structure_fingerprint(manager);
+    header.reserved = 0;
+    header.clock = simulation->clock;
+    header.tick_count = simulation->tick_count;
+
+    int32_t *amounts = malloc(sizeof(int32_t) * ALLOC_COUNT(header.resource_count));
+    CheckpointSystem *systems = malloc(sizeof(CheckpointSystem) * ALLOC_COUNT(header.system_count));
+    CheckpointEvent *saved_events = malloc(sizeof(CheckpointEvent) * ALLOC_COUNT(event_count));
+    SimulationEntry *sorted = malloc(sizeof(SimulationEntry) * ALLOC_COUNT(simulation->size));
+    CheckpointEntry *schedule = malloc(sizeof(CheckpointEntry) * ALLOC_COUNT(simulation->size));
+    if (amounts == NULL || systems == NULL || saved_events == NULL || sorted == NULL || schedule == NULL)
+    {
+        perror("Failed to allocate memory for the checkpoint");
+        status = -1;
+        goto done;
+    }
+
+    for (int i = 0; i < header.resource_count; i++)
+    {
+        amounts[i] = resource_get_amount(manager->resource_array.resources[i]);
+    }
+
+    for (int i = 0; i < header.system_count; i++)
+    {
+        System *system = manager->system_array.systems[i];
+        CheckpointSystem *saved = &systems[i];
+
+        memset(saved, 0, sizeof(*saved));
+        saved->status = system_get_status(system);
+        saved->phase = system->phase;
+        saved->consume_reported = system->consume_reported;
+        saved->store_reported = system->store_reported;
+        saved->parked = atomic_load(&system->parked);
+        saved->backoff = system->backoff;
+        saved->active_members = system->active_members;
+        saved->jitter = system->jitter;
+        saved->held_speed = system->held_speed;
+        saved->held_hold_ms = system->held_hold_ms;
+        saved->speed_held_until = system->speed_held_until;
+        for (int j = 0; j < system->produced_count; j++)
+        {
+            saved->amount_stored[j] = system->amount_stored[j];
+            saved->amount_reserved[j] = system->amount_reserved[j];
+        }
+    }
+
+    for (int i = 0; i < event_count; i++)
+    {
+        saved_events[i] = (CheckpointEvent){events[i].system->id, events[i].resource->id, events[i].status,
+                                            events[i].priority, events[i].amount};
+    }
+
+    // The heap order depends on how it was built, the order of scheduling does not
+    for (int i = 0; i < simulation->size; i++)
+        sorted[i] = simulation->heap[i];
+    qsort(sorted, simulation->size, sizeof(SimulationEntry), checkpoint_entry_compare);
+    for (int i = 0; i < simulation->size; i++)
+        schedule[i] = (CheckpointEntry){sorted[i].time, sorted[i].system->id, 0};
+
+    if (snprintf(temp_path, sizeof(temp_path), "%s.tmp", path) >= (int)sizeof(temp_path))
+    {
+        fprintf(stderr, "Checkpoint path too long: %s\n", path);
+        status = -1;
+        goto done;
+    }
+
+    int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        perror("Failed to open checkpoint file");
+        status = -1;
+        goto done;
+    }
+
+    if (checkpoint_write_all(fd, &header, sizeof(header)) != 0 ||
+        checkpoint_write_all(fd, amounts, sizeof(int32_t) * header.resource_count) != 0 ||
+        checkpoint_write_all(fd, systems, sizeof(CheckpointSystem) * header.system_count) != 0 ||
+        checkpoint_write_all(fd, saved_events, sizeof(CheckpointEvent) * event_count) != 0 ||
+        checkpoint_write_all(fd, schedule, sizeof(CheckpointEntry) * simulation->size) != 0)
+    {
+        perror("Failed to write checkpoint file");
+        status = -1;
+    }
+
+    if (close(fd) != 0 && status == 0)
+    {
+        perror("Failed to write checkpoint file");
+        status = -1;
+    }
+
+    if (status == 0 && rename(temp_path, path) != 0)
+    {
+        perror("Failed to replace checkpoint file");
+        status = -1;
+    }
+    if (status != 0)
+        unlink(temp_path);
+
+done:
+    free(amounts);
+    free(systems);
+    free(saved_events);
+    free(sorted);
+    free(schedule);
+    free(events);
+    return status;
+}
+
+/**
+ * Restores the state of a discrete-event run from a checkpoint file.
+ *
+ * The file is mapped instead of read, the records are copied straight out of the mapping.
+ * The scenario the checkpoint was taken from must be loaded and indexed, and `simulation`
+ * initialized and empty; `simulation_run` then carries on from the checkpoint's virtual time.
+ *
+ * @param[in,out] manager     Pointer to the loaded `Manager`.
+ * @param[in,out] simulation  Pointer to an initialized, empty `Simulation`.
+ * @param[in]     path        Checkpoint file to read.
+ * @return                    0 on success, -1 if the file cannot be read or does not match the scenario.
+ */
+int checkpoint_load(Manager *manager, Simulation *simulation, const char *path)
+{
+    struct stat info;
+    CheckpointHeader header;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        perror("Failed to open checkpoint file");
+        return -1;
+    }
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(CheckpointHeader))
+    {
+        fprintf(stderr, "Not a checkpoint file: %s\n", path);
+        close(fd);
+        return -1;
+    }
+
+    size_t size = (size_t)info.st_size;
+    unsigned char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        perror("Failed to map checkpoint file");
+        return -1;
+    }
+
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != CHECKPOINT_MAGIC || header.version != CHECKPOINT_VERSION)
+    {
+        fprintf(stderr, "Not a checkpoint file: %s\n", path);
+        munmap(data, size);
+        return -1;
+    }
+    if (header.resource_count != manager->resource_array.size || header.system_count != manager->system_array.size ||
+        header.event_count < 0 || header.schedule_count < 0 ||
+        size != sizeof(header) + sizeof(int32_t) * header.resource_count +
+                    sizeof(CheckpointSystem) * header.system_count + sizeof(CheckpointEvent) * header.event_count +
+                    sizeof(CheckpointEntry) * header.schedule_count)
+    {
+        fprintf(stderr, "Checkpoint %s was taken from a different scenario\n", path);
+        munmap(data, size);
+        return -1;
+    }
+    if (header.fingerprint != cluster_structure_fingerprint(manager))
+    {
+        fprintf(stderr, "Checkpoint %s was taken from a different scenario\n", path);
+        munmap(data, size);
+        return -1;
+    }
+
+    const unsigned char *cursor = data + sizeof(header);
+    if (checkpoint_validate(manager, &header, cursor) != 0)
+    {
+        fprintf(stderr, "Checkpoint %s holds a state the scenario cannot be in\n", path);
+        munmap(data, size);
+        return -1;
+    }
+
+    for (int i = 0; i < header.resource_count; i++, cursor += sizeof(int32_t))
+    {
+        int32_t amount;
+        memcpy(&amount, cursor, sizeof(amount));
+        resource_set_amount(manager->resource_array.resources[i], amount);
+    }
+
+    manager->held_count = 0;
+    for (int i = 0; i < header.system_count; i++, cursor += sizeof(CheckpointSystem))
+    {
+        System *system = manager->system_array.systems[i];
+        CheckpointSystem saved;
+
+        memcpy(&saved, cursor, sizeof(saved));
+        atomic_store(&system->status, saved.status);
+        system->phase = saved.phase;
+        system->consume_reported = saved.consume_reported;
+        system->store_reported = saved.store_reported;
+        atomic_store(&system->parked, saved.parked);
+        system->backoff = saved.backoff;
+        system->active_members = saved.active_members;
+        system->jitter = saved.jitter;
+        system->held_speed = saved.held_speed;
+        system->held_hold_ms = saved.held_hold_ms;
+        system->speed_held_until = saved.speed_held_until;
+        // Held speeds are applied in no particular order, system order is as good as any
+        if (system->held_speed >= 0)
+            manager->held[manager->held_count++] = system;
+        // The reserved capacity of a resource is what its producers hold
+        for (int j = 0; j < system->produced_count; j++)
+        {
+            system->amount_stored[j] = saved.amount_stored[j];
+            system->amount_reserved[j] = resource_reserve(system->produced[j].resource, saved.amount_reserved[j]);
+        }
+    }
+
+    for (int i = 0; i < header.event_count; i++, cursor += sizeof(CheckpointEvent))
+    {
+        CheckpointEvent saved;
+        Event event;
+
+        memcpy(&saved, cursor, sizeof(saved));
+        if (saved.system < 0 || saved.system >= header.system_count || saved.resource < 0 ||
+            saved.resource >= header.resource_count)
+            continue;
+        event_init(&event, manager->system_array.systems[saved.system], manager->resource_array.resources[saved.resource],
+                   saved.status, saved.priority, saved.amount);
+        event_queue_push(&manager->event_queue, &event);
+    }
+
+    // Scheduling in the saved order keeps ties between equal times resolved the same way
+    simulation->size = 0;
+    simulation->clock = header.clock;
+    simulation->tick_count = header.tick_count;
+    for (int i = 0; i < header.schedule_count; i++, cursor += sizeof(CheckpointEntry))
+    {
+        CheckpointEntry saved;
+
+        memcpy(&saved, cursor, sizeof(saved));
+        if (saved.system < 0 || saved.system >= header.system_count)
+            continue;
+        simulation_schedule(simulation, manager->system_array.systems[saved.system], saved.time);
+    }
+
+    munmap(data, size);
+    return 0;
+}
+
+/**
+ * Takes every pending event out of the manager's queue and puts it back.
+ *
+ * The events are put back with `event_queue_forward`, so a trace and the push statistics
+ * do not count them a second time. If memory runs out half way, the events drained so far
+ * are put back all the same.
+ *
+ * @param[in,out] manager  Pointer to the `Manager`.
+ * @param[out]    events   Set to a malloc'd copy of the pending events, in the order they are drained.
+ * @return                 Number of events, or -1 if memory could not be allocated.
+ */
+static int checkpoint_drain_events(Manager *manager, Event **events)
+{
+    int count = 0, capacity = MANAGER_BATCH_SIZE, status = 0;
+    Event *drained = malloc(sizeof(Event) * capacity);
+
+    if (drained == NULL)
+    {
+        perror("Failed to allocate memory for the checkpoint events");
+        return -1;
+    }
+
+    while (1)
+    {
+        // Grow the array (doubling the size) until a whole batch fits
+        if (count + MANAGER_BATCH_SIZE > capacity)
+        {
+            Event *new_drained = malloc(sizeof(Event) * capacity * 2);
+            if (new_drained == NULL)
+            {
+                perror("Failed to allocate memory for the checkpoint events");
+                status = -1;
+                break;
+            }
+            for (int i = 0; i < count; i++)
+                new_drained[i] = drained[i];
+            free(drained);
+            drained = new_drained;
+            capacity *= 2;
+        }
+
+        int popped = event_queue_pop_batch(&manager->event_queue, drained + count, MANAGER_BATCH_SIZE);
+        if (popped == 0)
+            break;
+        count += popped;
+    }
+
+    // Highest priority first, pushing them back in that order keeps each priority's order
+    for (int i = 0; i < count; i++)
+        event_queue_forward(&manager->event_queue, &drained[i]);
+
+    if (status != 0)
+    {
+        free(drained);
+        return -1;
+    }
+    *events = drained;
+    return count;
+}
+
+/**
+ * Checks the amounts and system states of a checkpoint before any of them is restored.
+ *
+ * Every amount must lie within its resource's capacity, every system state within the
+ * values the system can take, and each resource must have room for its amount plus what
+ * its producers hold reserved.
+ *
+ * @param[in] manager  Pointer to the loaded `Manager`, matching the checkpoint's counts.
+ * @param[in] header   Header of the checkpoint.
+ * @param[in] cursor   Start of the amounts in the mapped file, followed by the systems.
+ * @return             0 if the state can be restored, -1 otherwise.
+ */
+static int checkpoint_validate(Manager *manager, const CheckpointHeader *header, const unsigned char *cursor)
+{
+    int status = 0;
+    long long *used = malloc(sizeof(long long) * ALLOC_COUNT(header->resource_count));
+
+    if (used == NULL)
+    {
+        perror("Failed to allocate memory for the checkpoint");
+        return -1;
+    }
+
+    for (int i = 0; i < header->resource_count; i++, cursor += sizeof(int32_t))
+    {
+        int32_t amount;
+        memcpy(&amount, cursor, sizeof(amount));
+        if (amount < 0 || amount > manager->resource_array.resources[i]->max_capacity)
+            status = -1;
+        used[i] = amount;
+    }
+
+    for (int i = 0; i < header->system_count && status == 0; i++, cursor += sizeof(CheckpointSystem))
+    {
+        System *system = manager->system_array.systems[i];
+        CheckpointSystem saved;
+
+        memcpy(&saved, cursor, sizeof(saved));
+        if (saved.status < TERMINATE || saved.status > FAST ||
+            (saved.phase != SYSTEM_IDLE && saved.phase != SYSTEM_PROCESSING) || saved.active_members < 0 ||
+            saved.active_members > system->member_count || saved.held_speed < -1 || saved.held_speed > FAST)
+            status = -1;
+        for (int j = 0; j < system->produced_count; j++)
+        {
+            if (saved.amount_stored[j] < 0 || saved.amount_reserved[j] < 0)
+                status = -1;
+            used[system->produced[j].resource->id] += saved.amount_reserved[j];
+        }
+    }
+
+    for (int i = 0; i < header->resource_count && status == 0; i++)
+    {
+        if (used[i] > manager->resource_array.resources[i]->max_capacity)
+            status = -1;
+    }
+
+    free(used);
+    return status;
+}
+
+/**
+ * Orders two schedule entries by the order they were scheduled in, for `qsort`.
+ *
+ * @param[in] a  First `SimulationEntry`.
+ * @param[in] b  Second `SimulationEntry`.
+ * @return       Negative, zero or positive like `strcmp`.
+ */
+static int checkpoint_entry_compare(const void *a, const void *b)
+{
+    long long first = ((const SimulationEntry *)a)->sequence;
+    long long second = ((const SimulationEntry *)b)->sequence;
+    return (first > second) - (first < second);
+}
+
+/**
+ * Writes a whole buffer to a file descriptor, retrying short writes.
+ *
+ * @param[in] fd    File descriptor to write to.
+ * @param[in] data  Bytes to write.
+ * @param[in] size  Number of bytes.
+ * @return          0 on success, -1 on failure with `errno` set.
+ */
+static int checkpoint_write_all(int fd, const void *data, size_t size)
+{
+    const unsigned char *bytes = data;
+
+    while (size > 0)
+    {
+        ssize_t written = write(fd, bytes, size);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        bytes += written;
+        size -= (size_t)written;
+    }
+    return 0;
+}
@@ -0,0 +1,517 @@
+#include "defs.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+// Helper functions just used by this C file to clean up our code
+
+static int cluster_connect(char *address);
+static void cluster_session(Manager *manager, int fd, int parallel);
+static int cluster_send_job(Manager *manager, ClusterNode *node, unsigned int first_seed, int seed_count);
+static void cluster_dispatch(Manager *manager, ClusterNode *nodes, int node_count, unsigned int *next_seed,
+                             int run_count, ClusterJob *returned, int *returned_count);
+static void cluster_drop(ClusterNode *node, ClusterJob *returned, int *returned_count);
+static uint32_t cluster_hash(uint32_t hash, const void *data, size_t size);
+static int cluster_read_all(int fd, void *data, size_t size);
+static int cluster_write_all(int fd, const void *data, size_t size);
+
+/**
+ * Serves the batch runs of coordinators on a TCP port, never returns unless the port fails.
+ *
+ * Coordinators connect one at a time and send `ClusterJob`s. Every job is run like a local
+ * batch, `parallel` runs at a time, and answered with its results in one write. The node
+ * must have loaded the same scenario as the coordinator.
+ *
+ * @param[in] manager   Pointer to the loaded `Manager` with its index built.
+ * @param[in] port      TCP port to listen on.
+ * @param[in] parallel  Number of runs at the same time, 0 or less for one per CPU core.
+ * @return              1 once the port cannot be listened on or accepted from.
+ */
+int cluster_serve(Manager *manager, int port, int parallel)
+{
+    struct sockaddr_in address;
+    int one = 1;
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        perror("Failed to create the node socket");
+        return 1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons((uint16_t)port);
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(fd, CLUSTER_MAX_NODES) != 0)
+    {
+        perror("Failed to listen on the node port");
+        close(fd);
+        return 1;
+    }
+
+    printf("Serving batch runs on port %d\n", port);
+    fflush(stdout);
+
+    while (1)
+    {
+        int connection = accept(fd, NULL, NULL);
+        if (connection < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("Failed to accept a coordinator");
+            break;
+        }
+        setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        cluster_session(manager, connection, parallel);
+        close(connection);
+    }
+
+    close(fd);
+    return 1;
+}
+
+/**
+ * Answers the jobs of one coordinator until it says goodbye or goes away.
+ *
+ * @param[in] manager   Pointer to the loaded `Manager`.
+ * @param[in] fd        Connection to the coordinator.
+ * @param[in] parallel  Number of runs at the same time.
+ */
+static void cluster_session(Manager *manager, int fd, int parallel)
+{
+    ClusterJob job;
+
+    while (cluster_read_all(fd, &job, sizeof(job)))
+    {
+        if (job.magic != CLUSTER_MAGIC || job.version != CLUSTER_VERSION)
+        {
+            fprintf(stderr, "Not a coordinator of this version, closing the connection\n");
+            return;
+        }
+        if (job.resource_count != manager->resource_array.size || job.system_count != manager->system_array.size ||
+            job.fingerprint != cluster_fingerprint(manager))
+        {
+            fprintf(stderr, "The coordinator runs a different scenario, closing the connection\n");
+            return;
+        }
+        if (job.seed_count == 0)
+            return;
+        if (job.seed_count < 0 || job.seed_count > CLUSTER_MAX_JOB || job.first_seed == 0)
+        {
+            fprintf(stderr, "Invalid job of %d seeds from %u, closing the connection\n", job.seed_count, job.first_seed);
+            return;
+        }
+
+        BatchResult *results = malloc(sizeof(BatchResult) * job.seed_count);
+        if (results == NULL)
+        {
+            perror("Failed to allocate memory for a job");
+            return;
+        }
+
+        // Runs that fail keep a seed of 0, the coordinator counts them as failed
+        batch_execute(manager, job.first_seed, job.seed_count, parallel, results);
+        int sent = cluster_write_all(fd, results, sizeof(BatchResult) * job.seed_count);
+        free(results);
+        if (!sent)
+            return;
+    }
+}
+
+/**
+ * Runs a batch of `run_count` variations on the nodes listening at `addresses` and prints a summary.
+ *
+ * The seeds are handed out in chunks of `CLUSTER_CHUNK_SIZE`, a new one as soon as a node
+ * returns its results, so faster machines get more of the batch. The chunk of a node that
+ * fails goes to the others. Results are read straight into their place in the batch, so
+ * the summary is the same as that of `batch_run` with the same seeds.
+ *
+ * @param[in] manager    Pointer to the loaded `Manager`, for the scenario size and the names.
+ * @param[in] addresses  Comma separated host:port list of the nodes.
+ * @param[in] run_count  Number of runs.
+ * @return               0 if every run finished and reported back, 1 otherwise.
+ */
+int cluster_run(Manager *manager, const char *addresses, int run_count)
+{
+    ClusterNode nodes[CLUSTER_MAX_NODES];
+    ClusterJob returned[CLUSTER_MAX_NODES]; // Chunks of failed nodes, waiting for another node
+    struct pollfd polls[CLUSTER_MAX_NODES];
+    int node_count = 0, returned_count = 0, collected = 0;
+    unsigned int next_seed = 1;
+    char *saveptr;
+
+    char *list = strdup(addresses);
+    BatchResult *results = malloc(sizeof(BatchResult) * ALLOC_COUNT(run_count));
+    if (list == NULL || results == NULL)
+    {
+        perror("Failed to allocate memory for the batch");
+        free(list);
+        free(results);
+        return 1;
+    }
+    for (int i = 0; i < run_count; i++)
+        results[i].seed = 0;
+
+    for (char *address = strtok_r(list, ",", &saveptr); address != NULL && node_count < CLUSTER_MAX_NODES;
+         address = strtok_r(NULL, ",", &saveptr))
+    {
+        int fd = cluster_connect(address);
+        if (fd >= 0)
+            nodes[node_count++] = (ClusterNode){address, fd, 0, 0};
+    }
+    if (node_count == 0)
+    {
+        fprintf(stderr, "No node to run the batch on\n");
+        free(list);
+        free(results);
+        return 1;
+    }
+
+    cluster_dispatch(manager, nodes, node_count, &next_seed, run_count, returned, &returned_count);
+    while (1)
+    {
+        int poll_count = 0;
+        for (int i = 0; i < node_count; i++)
+        {
+            if (nodes[i].fd >= 0 && nodes[i].seed_count > 0)
+                polls[poll_count++] = (struct pollfd){nodes[i].fd, POLLIN, 0};
+        }
+        // Nothing in flight means all is done, or no node is left to do the rest
+        if (poll_count == 0)
+            break;
+
+        if (poll(polls, poll_count, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("Failed to wait for the nodes");
+            break;
+        }
+
+        for (int p = 0; p < poll_count; p++)
+        {
+            if (polls[p].revents == 0)
+                continue;
+
+            ClusterNode *node = NULL;
+            for (int i = 0; i < node_count; i++)
+            {
+                if (nodes[i].fd == polls[p].fd)
+                    node = &nodes[i];
+            }
+
+            // The node answers a whole chunk in one write, read it into its place
+            BatchResult *chunk = &results[node->first_seed - 1];
+            int valid = cluster_read_all(node->fd, chunk, sizeof(BatchResult) * node->seed_count);
+            for (int i = 0; valid && i < node->seed_count; i++)
+                valid = (chunk[i].seed == 0 || chunk[i].seed == node->first_seed + i);
+            if (!valid)
+            {
+                fprintf(stderr, "Node %s failed, its runs go to the other nodes\n", node->address);
+                for (int i = 0; i < node->seed_count; i++)
+                    chunk[i].seed = 0;
+                cluster_drop(node, returned, &returned_count);
+                continue;
+            }
+
+            for (int i = 0; i < node->seed_count; i++)
+                collected += (chunk[i].seed != 0);
+            node->seed_count = 0;
+        }
+
+        cluster_dispatch(manager, nodes, node_count, &next_seed, run_count, returned, &returned_count);
+    }
+
+    // The coordinator decides when the batch is over
+    for (int i = 0; i < node_count; i++)
+    {
+        if (nodes[i].fd < 0)
+            continue;
+        cluster_send_job(manager, &nodes[i], 0, 0);
+        close(nodes[i].fd);
+    }
+
+    batch_summarize(manager, results, run_count);
+
+    free(list);
+    free(results);
+    return (collected == run_count) ? 0 : 1;
+}
+
+/**
+ * Opens a connection to a node.
+ *
+ * @param[in,out] address  host:port of the node, the colon is temporarily cut.
+ * @return                 Connected socket, or -1 if the node cannot be reached.
+ */
+static int cluster_connect(char *address)
+{
+    struct addrinfo hints, *found;
+    int fd = -1, one = 1;
+
+    char *colon = strrchr(address, ':');
+    if (colon == NULL)
+    {
+        fprintf(stderr, "Node %s has no port, expected host:port\n", address);
+        return -1;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    *colon = '\0';
+    int error = getaddrinfo(address, colon + 1, &hints, &found);
+    *colon = ':';
+    if (error != 0)
+    {
+        fprintf(stderr, "Node %s: %s\n", address, gai_strerror(error));
+        return -1;
+    }
+
+    for (struct addrinfo *candidate = found; candidate != NULL && fd < 0; candidate = candidate->ai_next)
+    {
+        fd = socket(candidate->ai_family, candidate->ai_socktype, candidate->ai_protocol);
+        if (fd >= 0 && connect(fd, candidate->ai_addr, candidate->ai_addrlen) != 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(found);
+
+    if (fd < 0)
+    {
+        fprintf(stderr, "Node %s cannot be reached\n", address);
+        return -1;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+/**
+ * Sends a job to a node and remembers the chunk it runs.
+ *
+ * @param[in]     manager     Pointer to the loaded `Manager`, for the scenario size.
+ * @param[in,out] node        Pointer to the `ClusterNode`.
+ * @param[in]     first_seed  First seed of the chunk.
+ * @param[in]     seed_count  Seeds in the chunk, 0 to end the session.
+ * @return                    Non-zero if the job was sent.
+ */
+static int cluster_send_job(Manager *manager, ClusterNode *node, unsigned int first_seed, int seed_count)
+{
+    ClusterJob job = {CLUSTER_MAGIC, CLUSTER_VERSION, manager->resource_array.size, manager->system_array.size,
+                      cluster_fingerprint(manager), first_seed, seed_count};
+
+    node->first_seed = first_seed;
+    node->seed_count = seed_count;
+    return cluster_write_all(node->fd, &job, sizeof(job));
+}
+
+/**
+ * Hands a chunk to every idle node while seeds are left, those of failed nodes first.
+ *
+ * @param[in]     manager         Pointer to the loaded `Manager`.
+ * @param[in,out] nodes           The nodes of the batch.
+ * @param[in]     node_count      Number of entries in `nodes`.
+ * @param[in,out] next_seed       First seed no node was given yet.
+ * @param[in]     run_count       Number of runs in the batch.
+ * @param[in,out] returned        Chunks of failed nodes.
+ * @param[in,out] returned_count  Number of entries in `returned`.
+ */
+static void cluster_dispatch(Manager *manager, ClusterNode *nodes, int node_count, unsigned int *next_seed,
+                             int run_count, ClusterJob *returned, int *returned_count)
+{
+    for (int i = 0; i < node_count; i++)
+    {
+        if (nodes[i].fd < 0 || nodes[i].seed_count > 0)
+            continue;
+
+        unsigned int first_seed;
+        int seed_count;
+        if (*returned_count > 0)
+        {
+            (*returned_count)--;
+            first_seed = returned[*returned_count].first_seed;
+            seed_count = returned[*returned_count].seed_count;
+        }
+        else if (*next_seed <= (unsigned int)run_count)
+        {
+            first_seed = *next_seed;
+            seed_count = run_count - (int)first_seed + 1;
+            if (seed_count > CLUSTER_CHUNK_SIZE)
+                seed_count = CLUSTER_CHUNK_SIZE;
+            *next_seed += seed_count;
+        }
+        else
+        {
+            return;
+        }
+
+        if (!cluster_send_job(manager, &nodes[i], first_seed, seed_count))
+        {
+            fprintf(stderr, "Node %s failed, its runs go to the other nodes\n", nodes[i].address);
+            cluster_drop(&nodes[i], returned, returned_count);
+            // The chunk is back at the top of the stack, the next idle node takes it
+        }
+    }
+}
+
+/**
+ * Closes the connection of a failed node and gives back the chunk it was running.
+ *
+ * @param[in,out] node            Pointer to the failed `ClusterNode`.
+ * @param[in,out] returned        Chunks of failed nodes, with room for one per node.
+ * @param[in,out] returned_count  Number of entries in `returned`.
+ */
+static void cluster_drop(ClusterNode *node, ClusterJob *returned, int *returned_count)
+{
+    if (node->seed_count > 0)
+    {
+        returned[*returned_count].first_seed = node->first_seed;
+        returned[*returned_count].seed_count = node->seed_count;
+        (*returned_count)++;
+    }
+    close(node->fd);
+    node->fd = -1;
+    node->seed_count = 0;
+}
+
+/**
+ * Hashes what a run depends on, so a node or a trace replay can tell it loaded another scenario.
+ *
+ * @param[in] manager  Pointer to the loaded `Manager`.
+ * @return             FNV-1a hash of the structure and the current resource amounts.
+ */
+uint32_t cluster_fingerprint(Manager *manager)
+{
+    uint32_t hash = cluster_structure_fingerprint(manager);
+
+    for (int i = 0; i < manager->resource_array.size; i++)
+    {
+        int amount = resource_get_amount(manager->resource_array.resources[i]);
+        hash = cluster_hash(hash, &amount, sizeof(amount));
+    }
+    return hash;
+}
+
+/**
+ * Hashes the structure of the loaded scenario, everything but the amounts that change while it runs.
+ *
+ * Used by checkpoints, which are taken mid-run and restored over a freshly loaded scenario.
+ *
+ * @param[in] manager  Pointer to the loaded `Manager`.
+ * @return             FNV-1a hash of the resources, systems and rules in load order.
+ */
+uint32_t cluster_structure_fingerprint(Manager *manager)
+{
+    uint32_t hash = 2166136261u;
+
+    for (int i = 0; i < manager->resource_array.size; i++)
+    {
+        Resource *resource = manager->resource_array.resources[i];
+        int fields[2] = {resource->max_capacity, resource->flags};
+        hash = cluster_hash(hash, resource->name, strlen(resource->name) + 1);
+        hash = cluster_hash(hash, fields, sizeof(fields));
+    }
+    for (int i = 0; i < manager->system_array.size; i++)
+    {
+        System *system = manager->system_array.systems[i];
+        int fields[5] = {system->processing_time, system->member_count, system->reserve_outputs, system->consumed_count,
+                         system->produced_count};
+        hash = cluster_hash(hash, system->name, strlen(system->name) + 1);
+        hash = cluster_hash(hash, fields, sizeof(fields));
+        for (int j = 0; j < system->consumed_count; j++)
+        {
+            int link[2] = {system->consumed[j].resource->id, system->consumed[j].amount};
+            hash = cluster_hash(hash, link, sizeof(link));
+        }
+        for (int j = 0; j < system->produced_count; j++)
+        {
+            int link[2] = {system->produced[j].resource->id, system->produced[j].amount};
+            hash = cluster_hash(hash, link, sizeof(link));
+        }
+    }
+    for (RuleSpec *spec = manager->rule_specs; spec != NULL; spec = spec->next)
+    {
+        int rule[4] = {spec->resource->id, spec->status, spec->action, spec->hold_ms};
+        hash = cluster_hash(hash, rule, sizeof(rule));
+    }
+    return hash;
+}
+
+/**
+ * Adds bytes to an FNV-1a hash.
+ *
+ * @param[in] hash  Hash so far.
+ * @param[in] data  Bytes to add.
+ * @param[in] size  Number of bytes.
+ * @return          The updated hash.
+ */
+static uint32_t cluster_hash(uint32_t hash, const void *data, size_t size)
+{
+    const unsigned char *bytes = data;
+
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ bytes[i]) * 16777619u;
+    return hash;
+}
+
+/**
+ * Reads exactly `size` bytes from a socket.
+ *
+ * @param[in]  fd    Socket to read from.
+ * @param[out] data  Buffer of at least `size` bytes.
+ * @param[in]  size  Number of bytes to read.
+ * @return           Non-zero if everything was read, zero on an error or the end of the stream.
+ */
+static int cluster_read_all(int fd, void *data, size_t size)
+{
+    unsigned char *bytes = data;
+
+    while (size > 0)
+    {
+        ssize_t count = recv(fd, bytes, size, 0);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return 0;
+        bytes += count;
+        size -= (size_t)count;
+    }
+    return 1;
+}
+
+/**
+ * Writes exactly `size` bytes to a socket, without dying of SIGPIPE if the peer left.
+ *
+ * @param[in] fd    Socket to write to.
+ * @param[in] data  Bytes to write.
+ * @param[in] size  Number of bytes to write.
+ * @return          Non-zero if everything was written, zero on an error.
+ */
+static int cluster_write_all(int fd, const void *data, size_t size)
+{
+    const unsigned char *bytes = data;
+
+    while (size > 0)
+    {
+        ssize_t count = send(fd, bytes, size, MSG_NOSIGNAL);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return 0;
+        bytes += count;
+        size -= (size_t)count;
+    }
+    return 1;
+}
@@ -1,149 +1,776 @@
-#include <semaphore.h>
-
-// Don't worry about these! These are special codes that allow us to do some formatting in the terminal
-// Such as clearing the line before printing or moving the location of the "cursor" that will print.
-#define ANSI_CLEAR "\033[2J"
-#define ANSI_MV_TL "\033[H"
-#define ANSI_LN_CLR "\033[K"
-#define ANSI_MV_D1 "\033[1B"
-#define ANSI_SAVE "\033[s"
-#define ANSI_RESTORE "\033[u"
-
-#define TERMINATE 0
-#define DISABLED 1
-#define SLOW 2
-#define STANDARD 3
-#define FAST 4
-
-#define STATUS_OK -1
-#define STATUS_EMPTY 0
-#define STATUS_LOW 1
-#define STATUS_INSUFFICIENT 2
-#define STATUS_CAPACITY 3
-#define STATUS_PRODUCED 10
-
-#define THRESHOLD_RESOURCE_LOW 0.3 // Percentage of resource before it is considered low.
-#define MANAGER_WAIT_TIME 5        // Milliseconds for the manager to wait between popping the queue
-#define SYSTEM_WAIT_TIME 20        // Milliseconds between loops of the system when production cannot occur
-
-#define PRIORITY_HIGH 3
-#define PRIORITY_MED 2
-#define PRIORITY_LOW 1
-
-// Represents the resource amounts for the entire rocket
-typedef struct Resource
-{
-    char *name; // Dynamically allocated string
-    int amount;
-    int max_capacity;
-    sem_t mutex; // Semaphore for thread safety
-} Resource;
-
-// Represents the amount of a resource consumed/produced for a single system
-typedef struct ResourceAmount
-{
-    Resource *resource;
-    int amount;
-} ResourceAmount;
-
-// A system which consumes resources, waits for `processing_time` milliseconds, then produced the produced resource
-typedef struct System
-{
-    char *name; // Dynamically allocated string
-    ResourceAmount consumed;
-    ResourceAmount produced;
-    int amount_stored;
-    int processing_time;
-    int status;
-    struct EventQueue *event_queue; // Pointer to event queue shared by all systems and manager
-    sem_t status_mutex;
-} System;
-
-// Used to send notifications to the manager about an issue / state of the system
-typedef struct Event
-{
-    System *system;
-    Resource *resource;
-    int status;
-    int priority; // Higher values indicate higher priority
-    int amount;   // Amount of the resource in question
-} Event;
-
-// Linked List Node for the Event queue
-typedef struct EventNode
-{
-    Event event;
-    struct EventNode *next;
-} EventNode;
-
-// Linked List structure with a head and no tail, single instance shared by all systems
-typedef struct EventQueue
-{
-    EventNode *head;
-    int size;
-    sem_t mutex; // Semaphore for thread safety
-} EventQueue;
-
-// A basic dynamic array to store all of the systems in the simulation
-typedef struct SystemArray
-{
-    System **systems;
-    int size;
-    int capacity;
-} SystemArray;
-
-// A basic resource array to store all resources in the simulation
-typedef struct ResourceArray
-{
-    Resource **resources;
-    int size;
-    int capacity;
-} ResourceArray;
-
-// Container structure which contains all of the core data for our simulation
-typedef struct Manager
-{
-    int simulation_running; // non-zero if the simulation is running, zero if it should be stopped
-    SystemArray system_array;
-    ResourceArray resource_array;
-    EventQueue event_queue;
-} Manager;
-
-// Manager functions
-void manager_init(Manager *manager);
-void manager_clean(Manager *manager);
-void manager_run(Manager *manager);
-
-// System functions
-void system_create(System **system, const char *name, ResourceAmount consumed, ResourceAmount produced, int processing_time, EventQueue *event_queue);
-void system_destroy(System *system);
-void system_run(System *system);
-
-// Resource functions
-void resource_create(Resource **resource, const char *name, int amount, int max_capacity);
-void resource_destroy(Resource *resource);
-
-// ResourceAmount functions
-void resource_amount_init(ResourceAmount *resource_amount, Resource *resource, int amount);
-
-// Event functions
-void event_init(Event *event, System *system, Resource *resource, int status, int priority, int amount);
-
-// EventQueue functions
-void event_queue_init(EventQueue *queue);
-void event_queue_clean(EventQueue *queue);
-void event_queue_push(EventQueue *queue, const Event *event);
-int event_queue_pop(EventQueue *queue, Event *event);
-
-// Dynamic array functions for systems and resources
-void system_array_init(SystemArray *array);
-void system_array_clean(SystemArray *array);
-void system_array_add(SystemArray *array, System *system);
-
-void resource_array_init(ResourceArray *array);
-void resource_array_clean(ResourceArray *array);
-void resource_array_add(ResourceArray *array, Resource *resource);
-
-// Part 4 Multi-Threading Overhaul
-void *system_thread(void *arg);
-void *manager_thread(void *arg);
\ No newline at end of file
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// Don't worry about these! These are special codes that allow us to do some formatting in the terminal
+// Such as clearing the line before printing or moving the location of the "cursor" that will print.
+#define ANSI_CLEAR "\033[2J"
+#define ANSI_MV_TL "\033[H"
+#define ANSI_LN_CLR "\033[K"
+#define ANSI_MV_D1 "\033[1B"
+#define ANSI_SAVE "\033[s"
+#define ANSI_RESTORE "\033[u"
+
+#define TERMINATE 0
+#define DISABLED 1
+#define SLOW 2
+#define STANDARD 3
+#define FAST 4
+
+#define STATUS_OK -1
+#define STATUS_EMPTY 0
+#define STATUS_LOW 1
+#define STATUS_INSUFFICIENT 2
+#define STATUS_CAPACITY 3
+#define STATUS_PRODUCED 10
+#define STATUS_SPEED 11 // Message from another manager shard asking to change the speed of the event's system
+
+#define THRESHOLD_RESOURCE_LOW 0.3 // Percentage of resource before it is considered low.
+#define MANAGER_WAIT_TIME 5        // Milliseconds for the manager to wait between popping the queue
+#define MANAGER_DISPLAY_INTERVAL 1000 // Milliseconds between refreshes of the simulation display
+#define MANAGER_BATCH_SIZE 64      // Maximum number of events the manager drains per lock acquisition
+#define SYSTEM_WAIT_TIME 20        // Milliseconds between loops of the system when production cannot occur
+#define SYSTEM_BACKOFF_MIN 5       // Milliseconds before the first retry of a failed convert or store
+#define SYSTEM_BACKOFF_MAX 320     // Longest retry delay, reached after a few failures in a row
+#define ARENA_BLOCK_SIZE (64 * 1024) // Bytes in each block of the Manager's arena
+#define BATCH_VARIATION 0.2          // Capacities and processing times of batch runs vary by up to this fraction
+#define BATCH_TIME_LIMIT 3600000     // Virtual milliseconds after which a batch run counts as unfinished
+
+#define RULE_ACTION_TERMINATE 0 // Ends the simulation, a capacity event only once the resource is full
+#define RULE_ACTION_FAST 1      // Speeds up the producers of the resource
+#define RULE_ACTION_SLOW 2      // Slows down the producers of the resource
+#define RULE_ACTION_STANDARD 3  // Puts the producers of the resource back to the standard speed
+#define RULE_ACTION_DISABLE 4   // Parks the consumers of the resource once it is empty
+#define RULE_ACTION_ENABLE 5    // Brings back the parked consumers of the resource
+#define RULE_ACTION_COUNT 6
+#define RULE_STATUS_COUNT 5   // Event statuses with a rule slot, STATUS_EMPTY to STATUS_CAPACITY and STATUS_PRODUCED
+#define RULE_MAX_ACTIONS 4    // Actions a single (resource, status) rule can run
+#define RULE_DEFAULT_HOLD 100 // Milliseconds a producer keeps a new speed before the built-in rules change it again
+#define SHARD_SPEED_SHIFT 3   // A STATUS_SPEED message carries speed | hold_ms << SHARD_SPEED_SHIFT as its amount
+
+#define RESOURCE_FLAG_LIFE_SUPPORT 0x1 // Running out of the resource terminates the simulation
+#define RESOURCE_FLAG_DESTINATION 0x2  // Filling the resource to capacity terminates the simulation
+
+#define PRIORITY_HIGH 3
+#define PRIORITY_MED 2
+#define PRIORITY_LOW 1
+#define PRIORITY_COUNT 3 // Number of PRIORITY_* levels, each one gets its own ring in the EventQueue
+
+#define EVENT_QUEUE_CAPACITY 256 // Events that fit in a single priority ring, must be a power of two
+#define EVENT_LANE_CAPACITY 16   // Events per priority in a lock-free system lane, must be a power of two
+#define EVENT_COALESCE_SLOTS 1024 // Hash slots tracking the pending ring events, must be a power of two larger than all rings together
+#define EVENT_AMOUNT_TAKEN INT_MIN // Marks a lane slot the manager already popped, so it can no longer be coalesced into
+#define CACHE_LINE_SIZE 64       // Used to keep counters written by different threads on separate lines
+#define ALLOC_COUNT(n) ((n) > 0 ? (size_t)(n) : 1) // Elements to allocate for n items, never 0
+
+// Word of a resource: its amount, the capacity reserved by producers above it, and a lock bit on top
+#define RESOURCE_RESERVED_SHIFT 32
+#define RESOURCE_FIELD_MASK 0x7fffffffULL // Amount and reservations each fit an int
+#define RESOURCE_LOCKED (1ULL << 63)      // Set while a multi-input consumer holds the resource
+
+// The atomic word of a resource padded to a full cache line to avoid false sharing
+typedef struct ResourceCounter
+{
+    _Alignas(CACHE_LINE_SIZE) atomic_ullong value;
+} ResourceCounter;
+
+// Represents the resource amounts for the entire rocket
+typedef struct Resource
+{
+    char *name;         // Dynamically allocated string
+    int id;             // Index of the resource in the manager's ResourceArray, also its lock order
+    atomic_ullong *amount; // Amount and reservations, updated with compare-and-swap, points at `local_amount` or into a ResourceTable
+    int max_capacity;
+    int low_threshold; // Amounts below this are low, THRESHOLD_RESOURCE_LOW of the capacity
+    int flags;   // RESOURCE_FLAG_* roles the manager reacts to
+    struct EventQueue *event_queue; // Queue of the manager shard reacting to the resource, NULL for the reporting system's queue
+    int numa_node; // Index into Affinity.nodes of the node holding the amount, -1 unless placed with affinity_place
+    sem_t mutex; // Semaphore for thread safety, only guards `amount` when built with RESOURCE_USE_SEMAPHORE
+    ResourceCounter local_amount; // Storage of the amount until the resource is moved into a table
+} Resource;
+
+// Represents the amount of a resource consumed/produced for a single system
+typedef struct ResourceAmount
+{
+    Resource *resource;
+    int amount;
+} ResourceAmount;
+
+#define SYSTEM_IDLE 0       // Waiting to store its outputs or to start the next conversion
+#define SYSTEM_PROCESSING 1 // Inputs consumed, outputs appear once the processing time is over
+
+#define SYSTEM_MAX_RESOURCES 4 // Most inputs or outputs a single system can have
+
+// Processing time of one system compared to what it asked for, filled in with INSTRUMENT builds
+typedef struct SystemStats
+{
+    long long started;      // stats_now() when the current conversion started
+    long long requested_us; // Processing time the current conversion asked for
+    atomic_llong runs;
+    atomic_llong nominal_us; // Sum of the requested processing times
+    atomic_llong actual_us;  // Sum of the processing times it really took
+    atomic_llong max_us;
+} SystemStats;
+
+// A system which consumes resources, waits for `processing_time` milliseconds, then produced the produced resource
+typedef struct System
+{
+    char *name; // Dynamically allocated string
+    int id;     // Index of the system in the manager's SystemArray
+    ResourceAmount consumed[SYSTEM_MAX_RESOURCES]; // Inputs, all reserved together for each conversion
+    int consumed_count;
+    ResourceAmount produced[SYSTEM_MAX_RESOURCES]; // Outputs, stored independently of each other
+    int produced_count;
+    int amount_stored[SYSTEM_MAX_RESOURCES]; // Produced units of each output waiting to be stored
+    int amount_reserved[SYSTEM_MAX_RESOURCES]; // Capacity of each output reserved for the current conversion
+    int reserve_outputs; // Reserve output capacity before converting, so conversions that cannot be stored are skipped
+    int processing_time;
+    int member_count;   // Identical members this system stands for, ticked together as a group
+    int active_members; // Members whose inputs the current conversion reserved
+    atomic_int status; // Changed with system_set_status, which wakes the system from its sleep
+    int phase; // SYSTEM_IDLE or SYSTEM_PROCESSING, only touched by whoever runs the system
+    int consume_reported; // The current failure to reserve inputs was already reported
+    int store_reported;   // Bit i is set while output i is reported as full
+    atomic_int parked;    // Set while a pool or the scheduler holds the disabled system aside
+    int backoff;          // Retry window in milliseconds, doubled by every failure and reset by a success
+    unsigned int jitter;  // State of the generator spreading retries, seeded from the id
+    long long speed_held_until; // Manager time before which rules leave the speed alone
+    int held_speed;   // Speed a rule asked for during the hold, applied once it is over, -1 if none
+    int held_hold_ms; // Hold of that rule
+    int shard;        // Manager shard changing the speed of the system, 0 unless sharded
+    int numa_node;    // Index into Affinity.nodes of the node the system runs on, -1 unless placed with affinity_place
+    SystemStats stats;
+    struct EventQueue *event_queue; // Pointer to event queue shared by all systems and manager
+} System;
+
+// Used to send notifications to the manager about an issue / state of the system
+typedef struct Event
+{
+    System *system;
+    Resource *resource;
+    int status;
+    int priority; // Higher values indicate higher priority
+    int amount;   // Amount of the resource in question
+} Event;
+
+// Fixed size circular buffer holding the pending events of a single priority level
+typedef struct EventRing
+{
+    Event events[EVENT_QUEUE_CAPACITY];
+    unsigned int head; // Index of the oldest event, wraps with EVENT_QUEUE_CAPACITY
+    unsigned int tail; // Index the next event will be written to
+} EventRing;
+
+// Single-producer/single-consumer rings owned by one system, pushed to without taking the queue mutex
+typedef struct EventLane
+{
+    Event events[PRIORITY_COUNT][EVENT_LANE_CAPACITY];
+    atomic_int amounts[PRIORITY_COUNT][EVENT_LANE_CAPACITY]; // Amount of each slot, updated in place while pending
+    _Alignas(CACHE_LINE_SIZE) atomic_uint tail[PRIORITY_COUNT]; // Written only by the owning system
+    _Alignas(CACHE_LINE_SIZE) atomic_uint head[PRIORITY_COUNT]; // Written only by the manager
+} EventLane;
+
+// Where the pending ring event with a given (system, resource, status) key sits
+typedef struct EventCoalesceEntry
+{
+    System *system;
+    Resource *resource;
+    int status;
+    int ring;              // Index of the ring holding the event, -1 if the entry is free
+    unsigned int position; // Position of the event in that ring
+} EventCoalesceEntry;
+
+// Preallocated queue with one ring per priority level, single instance shared by all systems
+typedef struct EventQueue
+{
+    EventRing rings[PRIORITY_COUNT]; // Indexed by priority - PRIORITY_LOW
+    int size;
+    atomic_int overflow_count;  // Number of events rejected because their ring was full
+    atomic_int coalesced_count; // Number of events merged into one already pending
+    sem_t mutex;                // Semaphore for thread safety
+
+    // Open addressing table over the pending ring events, guarded by `mutex`
+    EventCoalesceEntry coalesce[EVENT_COALESCE_SLOTS];
+
+    // Optional lock-free channel, one lane per system id, drained round-robin by the manager
+    EventLane *lanes; // NULL when every push goes through the rings above
+    int lane_count;
+    int lane_cursor[PRIORITY_COUNT];          // Next lane to look at for each priority, manager only
+    atomic_int lane_pending[PRIORITY_COUNT];  // Events waiting in all lanes for each priority
+
+    // Lets the manager sleep until the next push instead of polling
+    sem_t wakeup;
+    atomic_int waiting; // Non-zero while the manager is (about to be) blocked on `wakeup`
+
+    struct Trace *trace; // Records every pushed event, NULL unless tracing
+} EventQueue;
+
+// A basic dynamic array to store all of the systems in the simulation
+typedef struct SystemArray
+{
+    System **systems;
+    int size;
+    int capacity;
+} SystemArray;
+
+// A basic resource array to store all resources in the simulation
+typedef struct ResourceArray
+{
+    Resource **resources;
+    int size;
+    int capacity;
+} ResourceArray;
+
+// Optional contiguous array of the resource amounts, indexed by resource id
+typedef struct ResourceTable
+{
+    ResourceCounter *amounts; // One cache line per amount, `Resource.amount` points here once built
+    int size;
+} ResourceTable;
+
+// Systems producing and consuming each resource, built once the simulation is loaded
+typedef struct ResourceIndex
+{
+    int *producer_start; // Producers of resource id r are producers[producer_start[r] .. producer_start[r + 1] - 1]
+    System **producers;
+    int *consumer_start; // Same layout for the consumers
+    System **consumers;
+    int resource_count;
+} ResourceIndex;
+
+struct Manager;
+
+// Handler of a rule action, returns non-zero to skip the remaining actions of the rule
+typedef int (*RuleHandler)(struct Manager *manager, const Event *event, int hold_ms);
+
+// One action of a rule, the handler and how long the speed it sets holds off others
+typedef struct RuleAction
+{
+    RuleHandler handler;
+    int hold_ms;
+} RuleAction;
+
+// Reaction of the manager to one status of one resource
+typedef struct Rule
+{
+    RuleAction actions[RULE_MAX_ACTIONS]; // Run in order
+    int action_count;
+} Rule;
+
+// A rule from the scenario file, kept until manager_build_index builds the table
+typedef struct RuleSpec
+{
+    Resource *resource;
+    int status;
+    int action; // One of the RULE_ACTION_* codes
+    int hold_ms;
+    struct RuleSpec *next;
+} RuleSpec;
+
+// Bump allocator, every entity and name of a simulation is carved from a few large blocks
+typedef struct Arena
+{
+    struct ArenaBlock *head; // Block currently handed out from, linked to the older ones
+} Arena;
+
+// Container structure which contains all of the core data for our simulation
+typedef struct Manager
+{
+    atomic_int simulation_running; // non-zero if the simulation is running, zero if it should be stopped, only the root's counts
+    SystemArray system_array;
+    ResourceArray resource_array;
+    EventQueue event_queue;
+    ResourceIndex resource_index; // Built by manager_build_index
+    Rule *rules; // Rule of resource id r and status slot s at rules[r * RULE_STATUS_COUNT + s], built by manager_build_index
+    RuleSpec *rule_specs; // Rules loaded from the scenario, replacing the built-in ones of their (resource, status)
+    System **held; // Systems with a held_speed waiting for their hold to end
+    int held_count;
+    long long now; // Milliseconds on the clock the systems run on, updated before events are handled
+    struct Manager *root;   // Manager owning the shared state, itself unless this is a shard
+    struct Manager *shards; // Shards 1 to shard_count - 1, each with its own queue and thread, NULL unless split
+    int shard_count;        // Managers handling events, 1 unless split with manager_split
+    int shard;              // Index of this manager among the shards, 0 for the root
+    pthread_t thread;       // Thread of a shard, started by manager_start_shards
+    ResourceTable resource_table; // Empty unless built with resource_table_build
+    Arena arena; // Owns every System, Resource and name, freed at once in manager_clean
+    struct Display *display; // Snapshot published for the display thread, NULL when nothing is drawn
+    struct Telemetry *telemetry; // Binary stream replacing all console output in headless mode, NULL otherwise
+    void (*unpark)(void *context, System *system); // Requeues a parked system, NULL when systems have threads
+    void *unpark_context; // Passed to `unpark`, the Pool or Simulation running the systems
+    Resource *end_resource; // Resource that terminated the simulation, NULL while it runs
+    int end_status;         // Status of the event that terminated it
+} Manager;
+
+// Lock-free snapshot of the simulation state, published by the manager and drawn by its own thread
+typedef struct Display
+{
+    Manager *manager;
+    int interval_ms; // Milliseconds between two frames
+    int resource_count;
+    int system_count;
+    atomic_uint sequence; // Seqlock, odd while the manager is writing the snapshot
+    atomic_int *amounts;  // Resource amounts, indexed like the manager's ResourceArray
+    atomic_int *statuses; // System statuses, indexed like the manager's SystemArray
+    char *frame;          // Whole frame, built in memory and written at once
+    size_t frame_size;
+    size_t frame_capacity;
+    sem_t stop; // Posted by display_stop to end the thread before its next frame
+    pthread_t thread;
+} Display;
+
+// Hot path counters, see stats.c
+#define STATS_CONVERT_OK 0
+#define STATS_CONVERT_EMPTY 1
+#define STATS_CONVERT_INSUFFICIENT 2
+#define STATS_STORE_CAPACITY 3
+#define STATS_EVENTS_PUSHED 4
+#define STATS_EVENTS_MERGED 5
+#define STATS_EVENTS_DROPPED 6
+#define STATS_EVENTS_POPPED 7
+#define STATS_COUNTER_COUNT 8
+
+// Hot path histograms
+#define STATS_LOCK_WAIT 0          // Nanoseconds waiting for a Resource mutex
+#define STATS_PROCESSING_OVERRUN 1 // Microseconds a conversion took beyond its processing time
+#define STATS_PUSH_LATENCY 2       // Nanoseconds in event_queue_push
+#define STATS_POP_LATENCY 3        // Nanoseconds in event_queue_pop_batch
+#define STATS_QUEUE_DEPTH 4        // Events waiting when the manager drains the queue
+#define STATS_HISTOGRAM_COUNT 5
+
+#define STATS_SUB_BITS 3 // Every power of two is split into 2^STATS_SUB_BITS buckets
+#define STATS_BUCKETS ((64 - STATS_SUB_BITS + 1) << STATS_SUB_BITS)
+#define STATS_SYSTEM_LINES 32 // Systems listed one by one in the report
+
+// Log-linear histogram in the style of HdrHistogram
+typedef struct StatsHistogram
+{
+    atomic_ullong buckets[STATS_BUCKETS];
+    atomic_ullong count;
+    atomic_ullong sum;
+    atomic_ullong max;
+} StatsHistogram;
+
+// Counters and histograms of a single thread, merged with the other threads in stats_dump
+typedef struct Stats
+{
+    atomic_ullong counters[STATS_COUNTER_COUNT];
+    StatsHistogram histograms[STATS_HISTOGRAM_COUNT];
+} Stats;
+
+// Recording compiles to nothing unless built with `make DEFINES=-DINSTRUMENT`
+#ifdef INSTRUMENT
+#define STATS_START(name) long long name = stats_now()
+#define STATS_RECORD(histogram, start) stats_record((histogram), stats_now() - (start))
+#define STATS_VALUE(histogram, value) stats_record((histogram), (value))
+#define STATS_COUNT(counter) stats_count((counter), 1)
+#define STATS_ADD(counter, amount) stats_count((counter), (amount))
+#else
+#define STATS_START(name)
+#define STATS_RECORD(histogram, start) ((void)0)
+#define STATS_VALUE(histogram, value) ((void)0)
+#define STATS_COUNT(counter) ((void)0)
+#define STATS_ADD(counter, amount) ((void)0)
+#endif
+
+#define TELEMETRY_MAGIC 0x4c545543u     // "CUTL" in a little-endian file
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_BUFFER_SIZE (1 << 20) // Bytes of the record ring, must be a power of two
+#define TELEMETRY_NAME_MAX 255          // Longer names are cut off in the stream
+
+// Telemetry record types, the payload is made of native int32 values unless noted
+#define TELEMETRY_RESOURCE 1  // id, max_capacity, then the name bytes
+#define TELEMETRY_SYSTEM 2    // id, then the name bytes
+#define TELEMETRY_EVENT 3     // system id, resource id, status, amount
+#define TELEMETRY_SNAPSHOT 4  // resource count, amounts..., system count, statuses...
+#define TELEMETRY_TERMINATE 5 // resource id, status that ended the simulation
+
+// Prefix of every telemetry record
+typedef struct TelemetryHeader
+{
+    uint32_t length; // Payload bytes following the header
+    uint32_t type;   // TELEMETRY_* record type
+    uint32_t time;   // Milliseconds since the stream was opened
+} TelemetryHeader;
+
+// Binary stream of events and snapshots, buffered in a ring and written out by its own thread
+typedef struct Telemetry
+{
+    int fd;
+    int interval_ms; // Milliseconds between snapshots and between writes
+    long long start_ms;
+    long long last_snapshot_ms; // Milliseconds since the stream was opened, or virtual time
+    const long long *clock;     // Virtual clock in milliseconds stamping the records in discrete mode, NULL for the wall clock
+    int32_t *snapshot; // Reused payload of the snapshot records
+    size_t snapshot_size;
+    unsigned char *buffer; // TELEMETRY_BUFFER_SIZE bytes, only the manager appends to it
+    atomic_size_t head;    // Bytes written out, only advanced by the telemetry thread
+    atomic_size_t tail;    // Bytes recorded, only advanced by the manager
+    atomic_int dropped;    // Records lost because the ring was full
+    atomic_int flush_requested; // Set once an early wakeup has been posted
+    atomic_int stopping;
+    sem_t wakeup;
+    pthread_t thread;
+} Telemetry;
+
+#define TRACE_MAGIC 0x52544355u // "UCTR" in a little-endian file
+#define TRACE_VERSION 1
+#define TRACE_CAPACITY (1 << 22) // Records a trace file has room for, later events are dropped
+#define TRACE_CHUNK_RECORDS 4096 // Records a thread claims at a time and fills on its own
+
+// Start of a trace file, followed by `capacity` TraceRecord slots of which the unused ones are zero
+typedef struct TraceHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    int32_t resource_count;
+    int32_t system_count;
+    int32_t capacity; // Record slots in the file, cut down to the claimed chunks when it is closed
+    int32_t chunk_records;
+    uint32_t fingerprint; // cluster_fingerprint of the recorded scenario
+    uint32_t reserved;
+} TraceHeader;
+
+// One pushed event, the ids index the manager's arrays of the recorded scenario
+typedef struct TraceRecord
+{
+    int64_t time; // Nanoseconds since the trace was opened
+    int32_t system_id;
+    int32_t resource_id;
+    int32_t status;
+    int32_t priority;
+    int32_t amount;
+    uint32_t used; // 1 for a recorded event, 0 for a slot of a chunk that was never filled
+} TraceRecord;
+
+// Memory-mapped trace file, every pushing thread appends to a chunk of its own
+typedef struct Trace
+{
+    int fd;
+    TraceHeader *header; // Start of the mapping
+    TraceRecord *records;
+    size_t map_size;
+    long long start_ns;
+    atomic_int claimed; // Record slots handed out in chunks so far
+    atomic_int dropped; // Events lost because the file was full
+} Trace;
+
+#define CHECKPOINT_MAGIC 0x4b435543u // "CUCK" in a little-endian file
+#define CHECKPOINT_VERSION 5
+
+// Start of a checkpoint file, followed by the records in this order and nothing else:
+// resource_count amounts (int32), system_count CheckpointSystem, event_count CheckpointEvent
+// and schedule_count CheckpointEntry
+typedef struct CheckpointHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    int32_t resource_count;
+    int32_t system_count;
+    int32_t event_count;
+    int32_t schedule_count;
+    uint32_t fingerprint; // cluster_structure_fingerprint of the scenario it was taken from
+    uint32_t reserved;
+    int64_t clock; // Virtual time the checkpoint was taken at
+    int64_t tick_count;
+} CheckpointHeader;
+
+// Saved state of one system, in SystemArray order
+typedef struct CheckpointSystem
+{
+    int32_t status;
+    int32_t phase;
+    int32_t consume_reported;
+    int32_t store_reported;
+    int32_t parked;
+    int32_t backoff;
+    int32_t active_members;
+    uint32_t jitter;
+    int32_t amount_stored[SYSTEM_MAX_RESOURCES];
+    int32_t amount_reserved[SYSTEM_MAX_RESOURCES];
+    int32_t held_speed;
+    int32_t held_hold_ms;
+    int64_t speed_held_until;
+} CheckpointSystem;
+
+// A pending event, systems and resources by id
+typedef struct CheckpointEvent
+{
+    int32_t system;
+    int32_t resource;
+    int32_t status;
+    int32_t priority;
+    int32_t amount;
+} CheckpointEvent;
+
+// A scheduled tick of the discrete-event scheduler, in the order they were scheduled
+typedef struct CheckpointEntry
+{
+    int64_t time;
+    int32_t system;
+    int32_t reserved;
+} CheckpointEntry;
+
+// A pending system tick in the discrete-event scheduler
+typedef struct SimulationEntry
+{
+    long long time;     // Virtual time in milliseconds when the tick is due
+    long long sequence; // Insertion order, breaks ties so runs are reproducible
+    System *system;
+} SimulationEntry;
+
+// Discrete-event scheduler, a min-heap of system ticks ordered by virtual time
+typedef struct Simulation
+{
+    long long clock; // Current virtual time in milliseconds
+    long long next_sequence;
+    long long tick_count;
+    long long event_count; // Events handled by the manager
+    double wall_ms;        // Real time the last simulation_run took
+    long long time_limit;  // Virtual time at which simulation_run gives up, -1 for none
+    const char *checkpoint_path;   // File rewritten with a checkpoint every checkpoint_interval, NULL for none
+    long long checkpoint_interval; // Virtual milliseconds between checkpoints
+    long long next_checkpoint;
+    SimulationEntry *heap;
+    int size;
+    int capacity;
+} Simulation;
+
+// Outcome of one run of a batch, sent from the run's process to the parent
+typedef struct BatchResult
+{
+    unsigned int seed;
+    int end_resource; // Id of the resource that ended the run, -1 if it hit BATCH_TIME_LIMIT
+    int end_status;
+    long long time; // Virtual milliseconds until the end
+    long long tick_count;
+} BatchResult;
+
+#define CLUSTER_MAGIC 0x4e435543u // "CUCN" on a little-endian wire
+#define CLUSTER_VERSION 1
+#define CLUSTER_CHUNK_SIZE 16   // Seeds handed to a node at a time, the coordinator keeps every node this busy
+#define CLUSTER_MAX_NODES 64    // Most nodes one coordinator drives
+#define CLUSTER_MAX_JOB 65536   // Most seeds a node accepts in one job
+
+// Request from the coordinator of a distributed batch to a node, answered with `seed_count`
+// BatchResult records in seed order. A `seed_count` of 0 ends the session. All machines
+// run the same build, so the records go over the wire as they are laid out in memory.
+typedef struct ClusterJob
+{
+    uint32_t magic;
+    uint32_t version;
+    int32_t resource_count; // Of the coordinator's scenario, the node refuses a different one
+    int32_t system_count;
+    uint32_t fingerprint; // Hash of the names, amounts, capacities and processing times
+    uint32_t first_seed;
+    int32_t seed_count;
+} ClusterJob;
+
+// A node as seen by the coordinator
+typedef struct ClusterNode
+{
+    const char *address; // host:port it was reached at
+    int fd;              // Connection, -1 once the node failed
+    unsigned int first_seed; // Chunk the node is running
+    int seed_count;          // Seeds in the chunk, 0 while the node is idle
+} ClusterNode;
+
+// CPUs the threads are pinned to, parsed from a list such as "0-3,8-11", and their NUMA nodes
+typedef struct Affinity
+{
+    int *cpus;      // In list order, pool workers take them from the front and managers from the back
+    int *cpu_nodes; // Index into `nodes` of each CPU
+    int cpu_count;
+    int *nodes;     // NUMA node ids of the CPUs, each once
+    int node_count;
+    void **blocks;  // Memory bound to each node holding its resources' amounts, NULL until affinity_place
+    size_t *block_sizes;
+} Affinity;
+
+// A system waiting in a pool worker's timer heap until its next tick is due
+typedef struct PoolTimer
+{
+    long long due; // Monotonic time in milliseconds
+    System *system;
+} PoolTimer;
+
+// One thread of the pool, owning a ready deque that idle workers can steal from
+typedef struct PoolWorker
+{
+    pthread_t thread;
+    struct Pool *pool;
+    int index;
+    int started;
+    int numa_node; // Node of the CPU the worker is pinned to, 0 unless the pool has an affinity
+    System **ready; // Circular deque of systems whose tick is due
+    int ready_head;
+    int ready_count;
+    PoolTimer *timers; // Min-heap of systems waiting for their delay to pass
+    int timer_count;
+    int capacity; // Size of both `ready` and `timers`
+    sem_t mutex;  // Guards both queues, taken by the owner and by thieves
+    sem_t wakeup; // Posted to wake the worker early
+} PoolWorker;
+
+// Fixed-size set of worker threads running system ticks as tasks
+typedef struct Pool
+{
+    PoolWorker *workers;
+    int worker_count;
+    atomic_int live_tasks; // Systems that have not terminated yet
+    const Affinity *affinity; // Pins the workers and keeps systems on workers of their node, NULL to leave them unpinned
+} Pool;
+
+// Manager functions
+void manager_init(Manager *manager);
+void manager_clean(Manager *manager);
+void manager_run(Manager *manager);
+int manager_process_events(Manager *manager);
+void manager_build_index(Manager *manager);
+int manager_add_rule(Manager *manager, Resource *resource, int status, int action, int hold_ms);
+void manager_split(Manager *manager, int shard_count);
+int manager_start_shards(Manager *manager);
+void manager_join_shards(Manager *manager);
+
+// System functions
+void system_create(System **system, const char *name, ResourceAmount consumed, ResourceAmount produced, int processing_time, EventQueue *event_queue, Arena *arena);
+void system_create_multi(System **system, const char *name, const ResourceAmount *consumed, int consumed_count, const ResourceAmount *produced, int produced_count, int processing_time, EventQueue *event_queue, Arena *arena);
+void system_init(System *system, char *name, const ResourceAmount *consumed, int consumed_count, const ResourceAmount *produced, int produced_count, int processing_time, EventQueue *event_queue);
+void system_destroy(System *system);
+int system_produces(const System *system, const Resource *resource);
+int system_get_status(System *system);
+void system_set_status(System *system, int status);
+int system_park(System *system);
+int system_unpark(System *system);
+void system_run(System *system);
+int system_tick(System *system);
+
+// Resource functions
+void resource_create(Resource **resource, const char *name, int amount, int max_capacity, Arena *arena);
+int resource_init(Resource *resource, char *name, int amount, int max_capacity);
+void resource_destroy(Resource *resource);
+int resource_get_amount(Resource *resource);
+void resource_set_amount(Resource *resource, int amount);
+int resource_consume(Resource *resource, int amount, int *crossed);
+int resource_store(Resource *resource, int *amount_stored, int *crossed);
+int resource_commit(Resource *resource, int reserved, int *amount_stored, int *crossed);
+int resource_consume_all(const ResourceAmount *amounts, int count, int *failed_index, int *crossed);
+int resource_consume_units(const ResourceAmount *amounts, int count, int *units, int *failed_index, int *crossed);
+int resource_reserve(Resource *resource, int amount);
+void resource_release(Resource *resource, int amount);
+
+// ResourceTable functions
+void resource_table_init(ResourceTable *table);
+void resource_table_build(ResourceTable *table, ResourceArray *resources, Arena *arena);
+
+// ResourceAmount functions
+void resource_amount_init(ResourceAmount *resource_amount, Resource *resource, int amount);
+
+// Event functions
+void event_init(Event *event, System *system, Resource *resource, int status, int priority, int amount);
+
+// EventQueue functions
+void event_queue_init(EventQueue *queue);
+void event_queue_clean(EventQueue *queue);
+void event_queue_attach_lanes(EventQueue *queue, int lane_count);
+int event_queue_forward(EventQueue *queue, const Event *event);
+void event_queue_wake(EventQueue *queue);
+int event_queue_push(EventQueue *queue, const Event *event);
+int event_queue_pop(EventQueue *queue, Event *event);
+int event_queue_pop_batch(EventQueue *queue, Event *events, int max_events);
+int event_queue_wait(EventQueue *queue, int timeout_ms);
+
+// Dynamic array functions for systems and resources
+void system_array_init(SystemArray *array);
+void system_array_clean(SystemArray *array);
+void system_array_add(SystemArray *array, System *system);
+
+void resource_array_init(ResourceArray *array);
+void resource_array_clean(ResourceArray *array);
+void resource_array_add(ResourceArray *array, Resource *resource);
+
+// Scenario file functions
+int scenario_load(Manager *manager, const char *path);
+
+// Arena functions
+void arena_init(Arena *arena);
+void arena_clean(Arena *arena);
+void *arena_alloc(Arena *arena, size_t size, size_t alignment);
+char *arena_strndup(Arena *arena, const char *string, size_t length);
+
+// Discrete-event simulation functions
+void simulation_init(Simulation *simulation, int capacity);
+void simulation_clean(Simulation *simulation);
+void simulation_schedule(Simulation *simulation, System *system, long long time);
+void simulation_run(Simulation *simulation, Manager *manager);
+void simulation_report(const Simulation *simulation, Manager *manager);
+void simulation_unpark(void *context, System *system);
+
+// Thread pool functions
+void pool_init(Pool *pool, int worker_count, int task_count);
+void pool_clean(Pool *pool);
+void pool_run(Pool *pool, SystemArray *systems);
+void pool_unpark(void *context, System *system);
+
+// Batch runner functions
+int batch_run(Manager *manager, int run_count, int parallel);
+int batch_execute(Manager *manager, unsigned int first_seed, int run_count, int parallel, BatchResult *results);
+void batch_summarize(Manager *manager, const BatchResult *results, int count);
+
+// Distributed batch functions
+int cluster_serve(Manager *manager, int port, int parallel);
+int cluster_run(Manager *manager, const char *addresses, int run_count);
+uint32_t cluster_fingerprint(Manager *manager);
+uint32_t cluster_structure_fingerprint(Manager *manager);
+
+// CPU affinity and NUMA placement functions
+int affinity_init(Affinity *affinity, const char *list);
+void affinity_clean(Affinity *affinity);
+void affinity_place(Affinity *affinity, Manager *manager);
+int affinity_pin_cpu(const Affinity *affinity, pthread_t thread, int index);
+int affinity_pin_node(const Affinity *affinity, pthread_t thread, int node);
+
+// Stats functions, only called through the STATS_* macros outside of stats.c
+void stats_init(void);
+void stats_clean(void);
+long long stats_now(void);
+void stats_count(int counter, long long amount);
+void stats_record(int histogram, long long value);
+void stats_histogram_add(StatsHistogram *histogram, long long value);
+int stats_dump_pending(void);
+void stats_dump(FILE *out, Manager *manager);
+
+// Trace functions
+int trace_open(Trace *trace, const char *path, Manager *manager);
+void trace_close(Trace *trace);
+void trace_record(Trace *trace, const Event *event);
+int trace_replay(Manager *manager, const char *path);
+
+// Checkpoint functions
+int checkpoint_save(Manager *manager, const Simulation *simulation, const char *path);
+int checkpoint_load(Manager *manager, Simulation *simulation, const char *path);
+
+// Telemetry functions
+int telemetry_open(Telemetry *telemetry, const char *path, int interval_ms);
+void telemetry_close(Telemetry *telemetry);
+void telemetry_clean(Telemetry *telemetry);
+void telemetry_describe(Telemetry *telemetry, Manager *manager);
+void telemetry_event(Telemetry *telemetry, const Event *event);
+void telemetry_terminate(Telemetry *telemetry, const Resource *resource, int status);
+int telemetry_snapshot(Telemetry *telemetry, Manager *manager);
+
+// Display functions
+int display_init(Display *display, Manager *manager, int interval_ms);
+void display_clean(Display *display);
+int display_start(Display *display);
+void display_stop(Display *display);
+void display_publish(Display *display);
+
+// Part 4 Multi-Threading Overhaul
+void *system_thread(void *arg);
+void *manager_thread(void *arg);
+void *display_thread(void *arg);
+void *telemetry_thread(void *arg);
\ No newline at end of file
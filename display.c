@@ -0,0 +1,368 @@
+#define _GNU_SOURCE // SCHED_IDLE
+#include "defs.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+
+static void display_read(Display *display, int *amounts, int *statuses);
+static void display_render(Display *display, const int *amounts, const int *statuses);
+static void display_append(Display *display, const char *format, ...);
+static void display_write(Display *display);
+static const char *display_status_name(int status);
+
+/**
+ * Initializes a `Display` for the loaded simulation.
+ *
+ * Allocates the snapshot arrays and a frame buffer large enough for every line, so
+ * rendering never allocates. Must be called once all resources and systems are loaded.
+ *
+ * @param[out] display      Pointer to the `Display` to initialize.
+ * @param[in]  manager      Pointer to the loaded `Manager` to show.
+ * @param[in]  interval_ms  Milliseconds between two frames.
+ * @return                  0 on success, -1 if memory could not be allocated.
+ */
+int display_init(Display *display, Manager *manager, int interval_ms)
+{
+    int resource_count = manager->resource_array.size;
+    int system_count = manager->system_array.size;
+
+    display->manager = manager;
+    display->interval_ms = interval_ms;
+    display->resource_count = resource_count;
+    display->system_count = system_count;
+    atomic_init(&display->sequence, 0);
+
+    // Every line is its name plus a bounded amount of text and escape codes
+    display->frame_capacity = 512;
+    for (int i = 0; i < resource_count; i++)
+        display->frame_capacity += strlen(manager->resource_array.resources[i]->name) + 64;
+    for (int i = 0; i < system_count; i++)
+        display->frame_capacity += strlen(manager->system_array.systems[i]->name) + 64;
+    display->frame_size = 0;
+
+    display->amounts = malloc(sizeof(atomic_int) * ALLOC_COUNT(resource_count));
+    display->statuses = malloc(sizeof(atomic_int) * ALLOC_COUNT(system_count));
+    display->frame = malloc(display->frame_capacity);
+    if (display->amounts == NULL || display->statuses == NULL || display->frame == NULL)
+    {
+        perror("Failed to allocate memory for the display");
+        display_clean(display);
+        return -1;
+    }
+
+    for (int i = 0; i < resource_count; i++)
+        atomic_init(&display->amounts[i], 0);
+    for (int i = 0; i < system_count; i++)
+        atomic_init(&display->statuses[i], STANDARD);
+
+    if (sem_init(&display->stop, 0, 0) != 0)
+    {
+        perror("Failed to initialize display semaphore");
+        display_clean(display);
+        return -1;
+    }
+
+    display_publish(display);
+    return 0;
+}
+
+/**
+ * Frees the snapshot arrays and frame buffer of a `Display`.
+ *
+ * The display thread must have been stopped with `display_stop`.
+ *
+ * @param[in,out] display  Pointer to the `Display` to clean.
+ */
+void display_clean(Display *display)
+{
+    if (display == NULL)
+        return;
+
+    free(display->amounts);
+    free(display->statuses);
+    free(display->frame);
+    display->amounts = NULL;
+    display->statuses = NULL;
+    display->frame = NULL;
+}
+
+/**
+ * Starts the display thread.
+ *
+ * @param[in,out] display  Pointer to an initialized `Display`.
+ * @return                 0 on success, -1 if the thread could not be created.
+ */
+int display_start(Display *display)
+{
+    if (pthread_create(&display->thread, NULL, display_thread, display) != 0)
+    {
+        perror("Failed to create display thread");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Stops the display thread and waits for it to exit.
+ *
+ * Wakes the thread right away instead of waiting for the next frame.
+ *
+ * @param[in,out] display  Pointer to a started `Display`.
+ */
+void display_stop(Display *display)
+{
+    sem_post(&display->stop);
+    pthread_join(display->thread, NULL);
+    sem_destroy(&display->stop);
+}
+
+/**
+ * Copies the resource amounts and system statuses into the snapshot.
+ *
+ * Called by the manager, the only writer. The sequence is odd while the copy is in
+ * progress, so the display thread can tell a torn snapshot apart without any lock.
+ *
+ * @param[in,out] display  Pointer to the `Display`.
+ */
+void display_publish(Display *display)
+{
+    Manager *manager = display->manager;
+    unsigned int sequence = atomic_load_explicit(&display->sequence, memory_order_relaxed);
+
+    atomic_store_explicit(&display->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    for (int i = 0; i < display->resource_count; i++)
+    {
+        atomic_store_explicit(&display->amounts[i], resource_get_amount(manager->resource_array.resources[i]),
+                              memory_order_relaxed);
+    }
+    for (int i = 0; i < display->system_count; i++)
+    {
+        atomic_store_explicit(&display->statuses[i], system_get_status(manager->system_array.systems[i]),
+                              memory_order_relaxed);
+    }
+
+    atomic_store_explicit(&display->sequence, sequence + 2, memory_order_release);
+}
+
+/**
+ * Thread function drawing the simulation state.
+ *
+ * Runs with the idle scheduling policy so it only gets the CPU the simulation leaves
+ * over. Every `interval_ms` it reads the snapshot, builds the whole frame in memory and
+ * writes it with a single `write`, until `display_stop` is called.
+ *
+ * @param arg Pointer to the `Display` to run (cast from void*)
+ * @return Always returns NULL
+ */
+void *display_thread(void *arg)
+{
+    Display *display = (Display *)arg;
+    struct sched_param param = {0};
+    struct timespec deadline;
+    int *amounts = malloc(sizeof(int) * ALLOC_COUNT(display->resource_count));
+    int *statuses = malloc(sizeof(int) * ALLOC_COUNT(display->system_count));
+
+    if (amounts == NULL || statuses == NULL)
+    {
+        perror("Failed to allocate memory for the display frame");
+        free(amounts);
+        free(statuses);
+        return NULL;
+    }
+
+    // Not being allowed to lower our priority is harmless, the frames just compete more
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    while (1)
+    {
+        display_read(display, amounts, statuses);
+        display_render(display, amounts, statuses);
+        display_write(display);
+
+        // Keep a steady rate no matter how long the frame took
+        deadline.tv_sec += display->interval_ms / 1000;
+        deadline.tv_nsec += (long)(display->interval_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        int result;
+        do
+        {
+            result = sem_timedwait(&display->stop, &deadline);
+        } while (result != 0 && errno == EINTR);
+
+        if (result == 0)
+            break;
+    }
+
+    free(amounts);
+    free(statuses);
+    return NULL;
+}
+
+/**
+ * Reads a consistent copy of the snapshot.
+ *
+ * Retries while the manager is publishing, which only ever takes a few microseconds.
+ *
+ * @param[in]  display   Pointer to the `Display`.
+ * @param[out] amounts   Receives one amount per resource.
+ * @param[out] statuses  Receives one status per system.
+ */
+static void display_read(Display *display, int *amounts, int *statuses)
+{
+    unsigned int before, after;
+
+    do
+    {
+        before = atomic_load_explicit(&display->sequence, memory_order_acquire);
+        if (before & 1)
+        {
+            sched_yield();
+            continue;
+        }
+
+        for (int i = 0; i < display->resource_count; i++)
+            amounts[i] = atomic_load_explicit(&display->amounts[i], memory_order_relaxed);
+        for (int i = 0; i < display->system_count; i++)
+            statuses[i] = atomic_load_explicit(&display->statuses[i], memory_order_relaxed);
+
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit(&display->sequence, memory_order_relaxed);
+    } while ((before & 1) || before != after);
+}
+
+/**
+ * Builds a whole frame of the simulation state into the frame buffer.
+ *
+ * @param[in,out] display   Pointer to the `Display`.
+ * @param[in]     amounts   One amount per resource, from `display_read`.
+ * @param[in]     statuses  One status per system, from `display_read`.
+ */
+static void display_render(Display *display, const int *amounts, const int *statuses)
+{
+    Manager *manager = display->manager;
+
+    display->frame_size = 0;
+    display_append(display, ANSI_CLEAR ANSI_MV_TL);
+
+    // Display Resource Amounts
+    display_append(display, ANSI_LN_CLR "Current Resource Amounts:\n");
+    display_append(display, ANSI_LN_CLR "-------------------------\n");
+    for (int i = 0; i < display->resource_count; i++)
+    {
+        Resource *resource = manager->resource_array.resources[i];
+        display_append(display, ANSI_LN_CLR "%s: %d / %d%s\n", resource->name, amounts[i], resource->max_capacity,
+                       amounts[i] < resource->low_threshold ? " (LOW)" : "");
+    }
+    display_append(display, ANSI_LN_CLR "\n");
+
+    // Display System Statuses
+    display_append(display, ANSI_LN_CLR "System Statuses:\n");
+    display_append(display, ANSI_LN_CLR "---------------\n");
+    for (int i = 0; i < display->system_count; i++)
+    {
+        display_append(display, ANSI_LN_CLR "%-20s: %-10s\n", manager->system_array.systems[i]->name,
+                       display_status_name(statuses[i]));
+    }
+    display_append(display, ANSI_LN_CLR "\n");
+
+    // Report events that were rejected because their ring or lane was full
+    int overflow_count = atomic_load(&manager->event_queue.overflow_count);
+    if (overflow_count > 0)
+    {
+        display_append(display, ANSI_LN_CLR "Dropped events (queue full): %d\n\n", overflow_count);
+    }
+
+    // Repeated reports merged into one pending event instead of queueing duplicates
+    int coalesced_count = atomic_load(&manager->event_queue.coalesced_count);
+    if (coalesced_count > 0)
+    {
+        display_append(display, ANSI_LN_CLR "Merged duplicate events: %d\n\n", coalesced_count);
+    }
+}
+
+/**
+ * Appends formatted text to the frame buffer.
+ *
+ * Text that does not fit is cut off, the buffer was sized for the whole frame in `display_init`.
+ *
+ * @param[in,out] display  Pointer to the `Display`.
+ * @param[in]     format   `printf` style format string.
+ */
+static void display_append(Display *display, const char *format, ...)
+{
+    size_t space = display->frame_capacity - display->frame_size;
+    va_list args;
+
+    if (space <= 1)
+        return;
+
+    va_start(args, format);
+    int written = vsnprintf(display->frame + display->frame_size, space, format, args);
+    va_end(args);
+
+    if (written < 0)
+        return;
+    display->frame_size += ((size_t)written < space) ? (size_t)written : space - 1;
+}
+
+/**
+ * Writes the frame buffer to standard output.
+ *
+ * A single `write` normally covers the whole frame, the loop only handles short writes.
+ *
+ * @param[in] display  Pointer to the `Display`.
+ */
+static void display_write(Display *display)
+{
+    size_t written = 0;
+
+    while (written < display->frame_size)
+    {
+        ssize_t result = write(STDOUT_FILENO, display->frame + written, display->frame_size - written);
+        if (result < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        written += (size_t)result;
+    }
+}
+
+/**
+ * Maps a system status code to a human-readable string.
+ *
+ * @param[in] status  Status of a system, e.g. `FAST`.
+ * @return            Name of the status.
+ */
+static const char *display_status_name(int status)
+{
+    switch (status)
+    {
+    case TERMINATE:
+        return "TERMINATE";
+    case DISABLED:
+        return "DISABLED";
+    case SLOW:
+        return "SLOW";
+    case STANDARD:
+        return "STANDARD";
+    case FAST:
+        return "FAST";
+    default:
+        return "UNKNOWN";
+    }
+}
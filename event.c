@@ -1,6 +1,9 @@
 #include "defs.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <stdint.h>
 
 /* Event functions */
 
@@ -27,6 +30,19 @@ void event_init(Event *event, System *system, Resource *resource, int status, in
 
 /* EventQueue functions */
 
+static int event_queue_priority_index(int priority);
+static int event_queue_push_event(EventQueue *queue, const Event *event);
+static int event_ring_push(EventQueue *queue, const Event *event);
+static int event_lane_push(EventQueue *queue, EventLane *lane, const Event *event);
+static int event_lane_pop(EventQueue *queue, int index, Event *event);
+static int event_lane_coalesce(EventQueue *queue, EventLane *lane, int index, const Event *event);
+static int event_ring_take(EventQueue *queue, int index, Event *event);
+static unsigned int event_coalesce_hash(const Event *event);
+static int event_coalesce_find(EventQueue *queue, const Event *event, int *free_slot);
+static void event_coalesce_remove(EventQueue *queue, int slot);
+static int event_queue_has_events(EventQueue *queue);
+static void event_queue_notify(EventQueue *queue);
+
 /**
  * Initializes the `EventQueue`.
  *
@@ -36,20 +52,48 @@ void event_init(Event *event, System *system, Resource *resource, int status, in
  */
 void event_queue_init(EventQueue *queue)
 {
-    queue->head = NULL;
+    for (int i = 0; i < PRIORITY_COUNT; i++)
+    {
+        queue->rings[i].head = 0;
+        queue->rings[i].tail = 0;
+    }
     queue->size = 0;
+    atomic_init(&queue->overflow_count, 0);
+    atomic_init(&queue->coalesced_count, 0);
+    for (int i = 0; i < EVENT_COALESCE_SLOTS; i++)
+    {
+        queue->coalesce[i].ring = -1;
+    }
+
+    queue->lanes = NULL;
+    queue->lane_count = 0;
+    queue->trace = NULL;
+    for (int i = 0; i < PRIORITY_COUNT; i++)
+    {
+        queue->lane_cursor[i] = 0;
+        atomic_init(&queue->lane_pending[i], 0);
+    }
+
+    atomic_init(&queue->waiting, 0);
 
     // Initialize the semaphore with an initial value of 1
     if (sem_init(&queue->mutex, 0, 1) != 0)
     {
         perror("Failed to initialize queue mutex");
     }
+
+    // The wakeup semaphore starts at 0 so the first wait blocks
+    if (sem_init(&queue->wakeup, 0, 0) != 0)
+    {
+        perror("Failed to initialize queue wakeup semaphore");
+    }
 }
 
 /**
  * Cleans up the `EventQueue`.
  *
- * Frees any memory and resources associated with the `EventQueue`.
+ * Discards any pending events and frees the resources associated with the `EventQueue`.
+ * The rings are part of the structure, so there is no memory to free.
  *
  * @param[in,out] queue  Pointer to the `EventQueue` to clean.
  */
@@ -58,77 +102,200 @@ void event_queue_clean(EventQueue *queue)
     if (queue == NULL)
         return;
 
-    EventNode *current = queue->head;
-    while (current != NULL)
+    for (int i = 0; i < PRIORITY_COUNT; i++)
     {
-        EventNode *temp = current;
-        current = current->next;
-        free(temp);
+        queue->rings[i].head = 0;
+        queue->rings[i].tail = 0;
     }
-    queue->head = NULL;
     queue->size = 0;
+    for (int i = 0; i < EVENT_COALESCE_SLOTS; i++)
+    {
+        queue->coalesce[i].ring = -1;
+    }
+
+    free(queue->lanes);
+    queue->lanes = NULL;
+    queue->lane_count = 0;
 
-    // Destroy the semaphore
+    // Destroy the semaphores
     sem_destroy(&queue->mutex);
+    sem_destroy(&queue->wakeup);
+}
+
+/**
+ * Gives every system its own lock-free lane into the `EventQueue`.
+ *
+ * Once attached, events pushed by a system whose id is below `lane_count` go into that
+ * system's single-producer ring instead of taking the queue mutex, so producers never
+ * contend with each other. Must be called before any system starts pushing.
+ *
+ * @param[in,out] queue       Pointer to the `EventQueue`.
+ * @param[in]     lane_count  Number of lanes to create, normally the number of systems.
+ */
+void event_queue_attach_lanes(EventQueue *queue, int lane_count)
+{
+    if (queue == NULL || lane_count <= 0 || queue->lanes != NULL)
+        return;
+
+    // Lanes hold cache line aligned counters, so they need aligned memory
+    size_t bytes = sizeof(EventLane) * lane_count;
+    bytes = (bytes + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+    EventLane *lanes = aligned_alloc(CACHE_LINE_SIZE, bytes);
+    if (lanes == NULL)
+    {
+        perror("Failed to allocate memory for event lanes");
+        return;
+    }
+
+    for (int i = 0; i < lane_count; i++)
+    {
+        for (int p = 0; p < PRIORITY_COUNT; p++)
+        {
+            atomic_init(&lanes[i].head[p], 0);
+            atomic_init(&lanes[i].tail[p], 0);
+        }
+    }
+
+    queue->lanes = lanes;
+    queue->lane_count = lane_count;
 }
 
 /**
  * Pushes an `Event` onto the `EventQueue`.
  *
- * Adds the event to the queue in a thread-safe manner, maintaining priority order (highest first).
+ * Appends the event to the ring of its priority in a thread-safe manner. Events of equal
+ * priority keep their FIFO order, and no memory is allocated.
+ *
+ * If an event with the same system, resource and status is still pending, only its amount
+ * is updated and no new event is queued. A system repeating the same report therefore holds
+ * at most one slot per report, and the queue depth is bounded by the number of systems.
+ * A queue with a trace records every push before the merge, so the trace keeps them all.
  *
  * @param[in,out] queue  Pointer to the `EventQueue`.
  * @param[in]     event  Pointer to the `Event` to push onto the queue.
+ * @return               `STATUS_OK` if the event was queued or merged, or `STATUS_CAPACITY` if its ring was full.
  */
-void event_queue_push(EventQueue *queue, const Event *event)
+int event_queue_push(EventQueue *queue, const Event *event)
 {
     if (queue == NULL || event == NULL)
-        return;
+        return STATUS_EMPTY;
 
-    // Wait for access to the queue
-    sem_wait(&queue->mutex);
+    if (queue->trace != NULL)
+        trace_record(queue->trace, event);
+
+#ifdef INSTRUMENT
+    STATS_START(start);
+    int status = event_queue_push_event(queue, event);
+    STATS_RECORD(STATS_PUSH_LATENCY, start);
+    STATS_COUNT(STATS_EVENTS_PUSHED);
+    if (status != STATUS_OK)
+        STATS_COUNT(STATS_EVENTS_DROPPED);
+    return status;
+#else
+    return event_queue_push_event(queue, event);
+#endif
+}
 
-    // Allocate a new event node.
-    EventNode *newNode = malloc(sizeof(EventNode));
-    if (newNode == NULL)
+/**
+ * Pushes an `Event` on behalf of its system from another thread, e.g. a manager shard.
+ *
+ * The lane of the event's system only takes pushes from the system itself, so the event
+ * always goes through the rings and is merged like any other ring event.
+ *
+ * @param[in,out] queue  Pointer to the `EventQueue`.
+ * @param[in]     event  Pointer to the `Event` to push onto the queue.
+ * @return               `STATUS_OK` if the event was queued or merged, or `STATUS_CAPACITY` if its ring was full.
+ */
+int event_queue_forward(EventQueue *queue, const Event *event)
+{
+    if (queue == NULL || event == NULL)
+        return STATUS_EMPTY;
+
+    return event_ring_push(queue, event);
+}
+
+/**
+ * Wakes the consumer of the `EventQueue` if it is waiting, without pushing anything.
+ *
+ * @param[in,out] queue  Pointer to the `EventQueue`.
+ */
+void event_queue_wake(EventQueue *queue)
+{
+    if (queue != NULL)
+        event_queue_notify(queue);
+}
+
+/**
+ * Pushes an `Event` into its lane or ring, the uninstrumented part of `event_queue_push`.
+ *
+ * @param[in,out] queue  Pointer to the `EventQueue`.
+ * @param[in]     event  Pointer to the `Event` to push onto the queue.
+ * @return               `STATUS_OK` if the event was queued or merged, or `STATUS_CAPACITY` if its ring was full.
+ */
+static int event_queue_push_event(EventQueue *queue, const Event *event)
+{
+    // Systems with a lane skip the mutex entirely
+    if (queue->lanes != NULL && event->system != NULL && event->system->id >= 0 && event->system->id < queue->lane_count)
     {
-        perror("Failed to allocate memory for new event node");
-        sem_post(&queue->mutex); // release the lock before returning
-        return;
+        int lane_status = event_lane_push(queue, &queue->lanes[event->system->id], event);
+        if (lane_status == STATUS_OK)
+            event_queue_notify(queue);
+        return lane_status;
     }
-    newNode->event = *event; // Copy the event data (shallow copy)
-    newNode->next = NULL;
 
-    // If the queue is empty or the new event has higher priority than the head, insert at the beginning.
-    if (queue->head == NULL || event->priority > queue->head->event.priority)
+    return event_ring_push(queue, event);
+}
+
+/**
+ * Pushes an `Event` into the ring of its priority, merging it into a pending one with the same key.
+ *
+ * @param[in,out] queue  Pointer to the `EventQueue`.
+ * @param[in]     event  Pointer to the `Event` to push onto the queue.
+ * @return               `STATUS_OK` if the event was queued or merged, or `STATUS_CAPACITY` if the ring was full.
+ */
+static int event_ring_push(EventQueue *queue, const Event *event)
+{
+    int index = event_queue_priority_index(event->priority);
+    EventRing *ring = &queue->rings[index];
+    int free_slot;
+
+    // Wait for access to the queue
+    sem_wait(&queue->mutex);
+
+    // Merge into the pending event with the same key, the manager only needs the latest amount
+    int slot = event_coalesce_find(queue, event, &free_slot);
+    if (slot >= 0)
     {
-        newNode->next = queue->head;
-        queue->head = newNode;
-        queue->size++;
-        sem_post(&queue->mutex); 
-        return;
+        EventCoalesceEntry *entry = &queue->coalesce[slot];
+        queue->rings[entry->ring].events[entry->position & (EVENT_QUEUE_CAPACITY - 1)].amount = event->amount;
+        atomic_fetch_add(&queue->coalesced_count, 1);
+        STATS_COUNT(STATS_EVENTS_MERGED);
+        sem_post(&queue->mutex);
+        return STATUS_OK;
     }
 
-    // Otherwise, traverse to find the correct insertion point.
-    // We continue while the next node exists and has an equal or higher priority.
-    // This ensures that for equal priority events, the older ones remain at the front.
-    EventNode *current = queue->head;
-    while (current->next != NULL && current->next->event.priority >= event->priority)
+    // The ring is full, count the dropped event so the overflow can be reported
+    if (ring->tail - ring->head >= EVENT_QUEUE_CAPACITY)
     {
-        current = current->next;
+        atomic_fetch_add(&queue->overflow_count, 1);
+        sem_post(&queue->mutex);
+        return STATUS_CAPACITY;
     }
-    newNode->next = current->next;
-    current->next = newNode;
+
+    ring->events[ring->tail & (EVENT_QUEUE_CAPACITY - 1)] = *event; // Copy the event data (shallow copy)
+    queue->coalesce[free_slot] = (EventCoalesceEntry){event->system, event->resource, event->status, index, ring->tail};
+    ring->tail++;
     queue->size++;
 
     sem_post(&queue->mutex);
-    return;
+    event_queue_notify(queue);
+    return STATUS_OK;
 }
 
 /**
  * Pops an `Event` from the `EventQueue`.
  *
- * Removes the highest priority event from the queue in a thread-safe manner.
+ * Removes the oldest event of the highest non-empty priority in a thread-safe manner.
  *
  * @param[in,out] queue  Pointer to the `EventQueue`.
  * @param[out]    event  Pointer to the `Event` structure to store the popped event.
@@ -139,25 +306,389 @@ int event_queue_pop(EventQueue *queue, Event *event)
     if (queue == NULL || event == NULL)
         return STATUS_EMPTY;
 
+    // Scan from the highest priority down to the lowest, lanes first since they need no lock
+    for (int i = PRIORITY_COUNT - 1; i >= 0; i--)
+    {
+        if (queue->lanes != NULL && event_lane_pop(queue, i, event) == STATUS_OK)
+        {
+            return STATUS_OK;
+        }
+
+        sem_wait(&queue->mutex); // Wait for access to the queue
+
+        if (event_ring_take(queue, i, event) == STATUS_OK)
+        {
+            sem_post(&queue->mutex);
+            return STATUS_OK;
+        }
+
+        sem_post(&queue->mutex);
+    }
+
+    return STATUS_EMPTY; // No event to pop
+}
+
+/**
+ * Pops up to `max_events` events from the `EventQueue` in one go.
+ *
+ * Events come out highest priority first and in FIFO order within a priority, exactly as
+ * repeated calls to `event_queue_pop` would return them, but the queue mutex is only taken once.
+ *
+ * @param[in,out] queue       Pointer to the `EventQueue`.
+ * @param[out]    events      Array receiving the popped events.
+ * @param[in]     max_events  Capacity of `events`.
+ * @return                    Number of events popped.
+ */
+int event_queue_pop_batch(EventQueue *queue, Event *events, int max_events)
+{
+    int count = 0;
+
+    if (queue == NULL || events == NULL)
+        return 0;
+
+    STATS_START(start);
     sem_wait(&queue->mutex); // Wait for access to the queue
 
-    if (queue->head == NULL)
+#ifdef INSTRUMENT
+    int depth = queue->size;
+    for (int i = 0; i < PRIORITY_COUNT; i++)
+        depth += atomic_load(&queue->lane_pending[i]);
+    STATS_VALUE(STATS_QUEUE_DEPTH, depth);
+#endif
+
+    for (int i = PRIORITY_COUNT - 1; i >= 0 && count < max_events; i--)
     {
-        sem_post(&queue->mutex);
-        return STATUS_EMPTY;     // No event to pop
+        while (count < max_events && queue->lanes != NULL && event_lane_pop(queue, i, &events[count]) == STATUS_OK)
+        {
+            count++;
+        }
+
+        while (count < max_events && event_ring_take(queue, i, &events[count]) == STATUS_OK)
+        {
+            count++;
+        }
     }
 
-    // Sets the event data as the one from the queue head
-    *event = queue->head->event;
+    sem_post(&queue->mutex);
+    STATS_RECORD(STATS_POP_LATENCY, start);
+    STATS_ADD(STATS_EVENTS_POPPED, count);
+    return count;
+}
 
-    // Frees the old head
-    EventNode *old_head = queue->head;
-    queue->head = queue->head->next;
-    free(old_head);
+/**
+ * Blocks until an event is pushed or `timeout_ms` milliseconds have passed.
+ *
+ * Returns immediately if events are already waiting. Only the single consumer of the queue
+ * (the manager) may wait on it.
+ *
+ * @param[in,out] queue       Pointer to the `EventQueue`.
+ * @param[in]     timeout_ms  Longest time to sleep in milliseconds.
+ * @return                    `STATUS_OK` if events may be waiting, `STATUS_EMPTY` on timeout.
+ */
+int event_queue_wait(EventQueue *queue, int timeout_ms)
+{
+    struct timespec deadline;
+    int result;
+
+    if (queue == NULL)
+        return STATUS_EMPTY;
 
-    // Decrement queue size
+    // Announce the wait before checking, so a push racing with us always posts the semaphore
+    atomic_exchange(&queue->waiting, 1);
+    if (event_queue_has_events(queue))
+    {
+        atomic_store(&queue->waiting, 0);
+        return STATUS_OK;
+    }
+
+    // sem_timedwait takes an absolute CLOCK_REALTIME deadline
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    do
+    {
+        result = sem_timedwait(&queue->wakeup, &deadline);
+    } while (result != 0 && errno == EINTR);
+
+    atomic_store(&queue->waiting, 0);
+    return (result == 0) ? STATUS_OK : STATUS_EMPTY;
+}
+
+/**
+ * Maps an event priority onto an index into the per-priority rings.
+ *
+ * Priorities outside of the `PRIORITY_*` range are clamped to the nearest level.
+ *
+ * @param[in] priority  Priority of the event.
+ * @return              Ring index between 0 and `PRIORITY_COUNT - 1`.
+ */
+static int event_queue_priority_index(int priority)
+{
+    if (priority < PRIORITY_LOW)
+        priority = PRIORITY_LOW;
+    else if (priority > PRIORITY_HIGH)
+        priority = PRIORITY_HIGH;
+
+    return priority - PRIORITY_LOW;
+}
+
+/**
+ * Pushes an `Event` into a system's lock-free lane.
+ *
+ * Only the system owning the lane may call this, which is what makes the ring single-producer.
+ * Like the rings, an event whose key is already pending in the lane is merged into it.
+ *
+ * @param[in,out] queue  Pointer to the `EventQueue` owning the lane.
+ * @param[in,out] lane   Pointer to the `EventLane` of the pushing system.
+ * @param[in]     event  Pointer to the `Event` to push.
+ * @return               `STATUS_OK` if the event was queued, or `STATUS_CAPACITY` if the lane was full.
+ */
+static int event_lane_push(EventQueue *queue, EventLane *lane, const Event *event)
+{
+    int index = event_queue_priority_index(event->priority);
+    unsigned int tail = atomic_load_explicit(&lane->tail[index], memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&lane->head[index], memory_order_acquire);
+
+    if (event_lane_coalesce(queue, lane, index, event) == STATUS_OK)
+        return STATUS_OK;
+
+    if (tail - head >= EVENT_LANE_CAPACITY)
+    {
+        atomic_fetch_add(&queue->overflow_count, 1);
+        return STATUS_CAPACITY;
+    }
+
+    // Fill the slot before publishing it to the manager with the release store
+    lane->events[index][tail & (EVENT_LANE_CAPACITY - 1)] = *event;
+    atomic_store_explicit(&lane->amounts[index][tail & (EVENT_LANE_CAPACITY - 1)], event->amount, memory_order_relaxed);
+    atomic_store_explicit(&lane->tail[index], tail + 1, memory_order_release);
+    atomic_fetch_add_explicit(&queue->lane_pending[index], 1, memory_order_release);
+    return STATUS_OK;
+}
+
+/**
+ * Pops the next `Event` of one priority from the lanes, visiting them round-robin.
+ *
+ * Only the manager may call this, which is what makes every lane single-consumer.
+ *
+ * @param[in,out] queue  Pointer to the `EventQueue` owning the lanes.
+ * @param[in]     index  Priority index to pop from.
+ * @param[out]    event  Pointer to the `Event` structure to store the popped event.
+ * @return               `STATUS_OK` if an event was popped, `STATUS_EMPTY` otherwise.
+ */
+static int event_lane_pop(EventQueue *queue, int index, Event *event)
+{
+    // Skip the scan when no lane has anything at this priority
+    if (atomic_load_explicit(&queue->lane_pending[index], memory_order_acquire) == 0)
+        return STATUS_EMPTY;
+
+    int cursor = queue->lane_cursor[index];
+    for (int n = 0; n < queue->lane_count; n++)
+    {
+        int lane_index = (cursor + n) % queue->lane_count;
+        EventLane *lane = &queue->lanes[lane_index];
+        unsigned int head = atomic_load_explicit(&lane->head[index], memory_order_relaxed);
+        unsigned int tail = atomic_load_explicit(&lane->tail[index], memory_order_acquire);
+
+        if (head != tail)
+        {
+            // Taking the amount closes the slot, later pushes with the same key queue a new event
+            *event = lane->events[index][head & (EVENT_LANE_CAPACITY - 1)];
+            event->amount = atomic_exchange(&lane->amounts[index][head & (EVENT_LANE_CAPACITY - 1)], EVENT_AMOUNT_TAKEN);
+            atomic_store_explicit(&lane->head[index], head + 1, memory_order_release);
+            atomic_fetch_sub_explicit(&queue->lane_pending[index], 1, memory_order_relaxed);
+
+            // Start after this lane next time so every system gets its turn
+            queue->lane_cursor[index] = (lane_index + 1) % queue->lane_count;
+            return STATUS_OK;
+        }
+    }
+
+    return STATUS_EMPTY;
+}
+
+/**
+ * Merges an `Event` into a pending event of the same key in a system's lane.
+ *
+ * Only the owning system calls this, so the pending slots it looks at were written by the
+ * same thread. The amount is swapped in with a compare-exchange, which fails once the manager
+ * has taken the slot, so an update is never lost to a concurrent pop.
+ *
+ * @param[in,out] queue  Pointer to the `EventQueue` owning the lane.
+ * @param[in,out] lane   Pointer to the `EventLane` of the pushing system.
+ * @param[in]     index  Priority index of the event.
+ * @param[in]     event  Pointer to the `Event` to merge.
+ * @return               `STATUS_OK` if the event was merged, `STATUS_EMPTY` if it must be queued.
+ */
+static int event_lane_coalesce(EventQueue *queue, EventLane *lane, int index, const Event *event)
+{
+    unsigned int tail = atomic_load_explicit(&lane->tail[index], memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&lane->head[index], memory_order_acquire);
+
+    for (unsigned int position = head; position != tail; position++)
+    {
+        const Event *pending = &lane->events[index][position & (EVENT_LANE_CAPACITY - 1)];
+        if (pending->resource != event->resource || pending->status != event->status)
+            continue;
+
+        atomic_int *amount = &lane->amounts[index][position & (EVENT_LANE_CAPACITY - 1)];
+        int expected = atomic_load(amount);
+        while (expected != EVENT_AMOUNT_TAKEN)
+        {
+            if (atomic_compare_exchange_weak(amount, &expected, event->amount))
+            {
+                atomic_fetch_add(&queue->coalesced_count, 1);
+                STATS_COUNT(STATS_EVENTS_MERGED);
+                return STATUS_OK;
+            }
+        }
+    }
+
+    return STATUS_EMPTY;
+}
+
+/**
+ * Removes the oldest event of one ring and forgets its coalescing entry.
+ *
+ * The caller must hold the queue mutex.
+ *
+ * @param[in,out] queue  Pointer to the `EventQueue`.
+ * @param[in]     index  Priority index of the ring.
+ * @param[out]    event  Pointer to the `Event` structure to store the popped event.
+ * @return               `STATUS_OK` if an event was popped, `STATUS_EMPTY` if the ring was empty.
+ */
+static int event_ring_take(EventQueue *queue, int index, Event *event)
+{
+    EventRing *ring = &queue->rings[index];
+    int free_slot;
+
+    if (ring->head == ring->tail)
+        return STATUS_EMPTY;
+
+    *event = ring->events[ring->head & (EVENT_QUEUE_CAPACITY - 1)];
+    ring->head++;
     queue->size--;
 
-    sem_post(&queue->mutex);
+    int slot = event_coalesce_find(queue, event, &free_slot);
+    if (slot >= 0)
+        event_coalesce_remove(queue, slot);
     return STATUS_OK;
-}
\ No newline at end of file
+}
+
+/**
+ * Hashes the (system, resource, status) key of an event to its home slot.
+ *
+ * @param[in] event  Pointer to the `Event`.
+ * @return           Slot index between 0 and `EVENT_COALESCE_SLOTS - 1`.
+ */
+static unsigned int event_coalesce_hash(const Event *event)
+{
+    uintptr_t hash = (uintptr_t)event->system * 0x9E3779B1u;
+    hash ^= (uintptr_t)event->resource * 0x85EBCA77u;
+    hash ^= (unsigned int)event->status * 0xC2B2AE3Du;
+    hash ^= hash >> 16;
+    return (unsigned int)hash & (EVENT_COALESCE_SLOTS - 1);
+}
+
+/**
+ * Looks up the pending ring event with the same key as `event`.
+ *
+ * The caller must hold the queue mutex.
+ *
+ * @param[in]  queue      Pointer to the `EventQueue`.
+ * @param[in]  event      Pointer to the `Event` whose key is looked up.
+ * @param[out] free_slot  Receives the free slot ending the probe, where the key would be inserted.
+ * @return                Slot of the matching entry, or -1 if no event with the key is pending.
+ */
+static int event_coalesce_find(EventQueue *queue, const Event *event, int *free_slot)
+{
+    unsigned int slot = event_coalesce_hash(event);
+
+    // The table is larger than the rings together, so the probe always reaches a free slot
+    while (queue->coalesce[slot].ring >= 0)
+    {
+        EventCoalesceEntry *entry = &queue->coalesce[slot];
+        if (entry->system == event->system && entry->resource == event->resource && entry->status == event->status)
+            return (int)slot;
+        slot = (slot + 1) & (EVENT_COALESCE_SLOTS - 1);
+    }
+
+    *free_slot = (int)slot;
+    return -1;
+}
+
+/**
+ * Frees a coalescing entry, shifting later entries of the probe sequence back into the gap.
+ *
+ * Backward shifting keeps every remaining key reachable from its home slot without tombstones.
+ * The caller must hold the queue mutex.
+ *
+ * @param[in,out] queue  Pointer to the `EventQueue`.
+ * @param[in]     slot   Slot of the entry to free.
+ */
+static void event_coalesce_remove(EventQueue *queue, int slot)
+{
+    unsigned int gap = (unsigned int)slot;
+    unsigned int next = (gap + 1) & (EVENT_COALESCE_SLOTS - 1);
+
+    while (queue->coalesce[next].ring >= 0)
+    {
+        EventCoalesceEntry *entry = &queue->coalesce[next];
+        Event key = {entry->system, entry->resource, entry->status, 0, 0};
+        unsigned int home = event_coalesce_hash(&key);
+
+        // Move the entry if its home is not between the gap and its current slot
+        if (((next - home) & (EVENT_COALESCE_SLOTS - 1)) >= ((next - gap) & (EVENT_COALESCE_SLOTS - 1)))
+        {
+            queue->coalesce[gap] = *entry;
+            gap = next;
+        }
+        next = (next + 1) & (EVENT_COALESCE_SLOTS - 1);
+    }
+
+    queue->coalesce[gap].ring = -1;
+}
+
+/**
+ * Checks whether any event is waiting in the rings or the lanes.
+ *
+ * @param[in] queue  Pointer to the `EventQueue`.
+ * @return           Non-zero if at least one event is waiting, zero otherwise.
+ */
+static int event_queue_has_events(EventQueue *queue)
+{
+    int size;
+
+    for (int i = 0; i < PRIORITY_COUNT; i++)
+    {
+        if (atomic_load(&queue->lane_pending[i]) > 0)
+            return 1;
+    }
+
+    sem_wait(&queue->mutex);
+    size = queue->size;
+    sem_post(&queue->mutex);
+
+    return size > 0;
+}
+
+/**
+ * Wakes the manager if it is blocked in `event_queue_wait`.
+ *
+ * Only posts the semaphore when someone is waiting, so pushes stay cheap while the manager is busy.
+ *
+ * @param[in,out] queue  Pointer to the `EventQueue`.
+ */
+static void event_queue_notify(EventQueue *queue)
+{
+    if (atomic_exchange(&queue->waiting, 0))
+    {
+        sem_post(&queue->wakeup);
+    }
+}
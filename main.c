@@ -3,57 +3,298 @@
 #include <stdio.h>
 #include <string.h>
 #include <pthread.h>
+#include <unistd.h>
 
 void load_data(Manager *manager);
+static int run_threads(Manager *manager, const Affinity *affinity);
+static int run_pool(Manager *manager, int worker_count, const Affinity *affinity);
+static void pin_managers(Manager *manager, pthread_t manager_tid, const Affinity *affinity);
+static void print_usage(const char *program);
 
-int main(void)
+int main(int argc, char *argv[])
 {
+    int use_lanes = 0, use_table = 0, discrete = 0, pool_workers = -1, batch_runs = 0, reserve_outputs = 0, shard_count = 1, serve_port = 0;
+    int refresh_ms = MANAGER_DISPLAY_INTERVAL;
+    const char *scenario_path = NULL, *telemetry_path = NULL, *restore_path = NULL, *checkpoint_path = NULL;
+    const char *node_addresses = NULL, *cpu_list = NULL, *trace_path = NULL, *replay_path = NULL;
+    int checkpoint_ms = MANAGER_DISPLAY_INTERVAL;
+    int option;
+
+    while ((option = getopt(argc, argv, "lsdRp:m:f:r:t:b:n:S:c:w:k:a:T:E:h")) != -1)
+    {
+        switch (option)
+        {
+        case 'l':
+            use_lanes = 1;
+            break;
+        case 's':
+            use_table = 1;
+            break;
+        case 'd':
+            discrete = 1;
+            break;
+        case 'R':
+            reserve_outputs = 1;
+            break;
+        case 'p':
+            pool_workers = atoi(optarg);
+            break;
+        case 'm':
+            shard_count = atoi(optarg);
+            break;
+        case 'f':
+            scenario_path = optarg;
+            break;
+        case 'r':
+            refresh_ms = atoi(optarg);
+            break;
+        case 't':
+            telemetry_path = optarg;
+            break;
+        case 'b':
+            batch_runs = atoi(optarg);
+            break;
+        case 'n':
+            node_addresses = optarg;
+            break;
+        case 'S':
+            serve_port = atoi(optarg);
+            break;
+        case 'c':
+            restore_path = optarg;
+            discrete = 1;
+            break;
+        case 'w':
+            checkpoint_path = optarg;
+            discrete = 1;
+            break;
+        case 'k':
+            checkpoint_ms = atoi(optarg);
+            break;
+        case 'a':
+            cpu_list = optarg;
+            break;
+        case 'T':
+            trace_path = optarg;
+            break;
+        case 'E':
+            replay_path = optarg;
+            break;
+        case 'h':
+            print_usage(argv[0]);
+            return 0;
+        default:
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
     Manager manager;
     manager_init(&manager);
-    load_data(&manager);
 
-    // Create thread IDs
-    pthread_t manager_tid;
-    pthread_t *system_tids = malloc(sizeof(pthread_t) * manager.system_array.size);
+    // Use the scenario file when one is given, otherwise the built-in flight
+    if (scenario_path != NULL)
+    {
+        if (scenario_load(&manager, scenario_path) != 0)
+        {
+            manager_clean(&manager);
+            return 1;
+        }
+    }
+    else
+    {
+        load_data(&manager);
+    }
 
-    if (!system_tids)
+    // Every system checks for room for its outputs before taking its inputs
+    if (reserve_outputs)
     {
-        perror("Failed to allocate memory for thread IDs");
-        return 1;
+        for (int i = 0; i < manager.system_array.size; i++)
+            manager.system_array.systems[i]->reserve_outputs = 1;
     }
 
-    // Start manager thread
-    if (pthread_create(&manager_tid, NULL, manager_thread, &manager) != 0)
+    // Let the manager find the systems affected by each event without scanning them all
+    manager_build_index(&manager);
+
+    // Give each system a lock-free lane into the manager's queue
+    if (use_lanes)
     {
-        perror("Failed to create manager thread");
-        free(system_tids);
-        return 1;
+        event_queue_attach_lanes(&manager.event_queue, manager.system_array.size);
     }
 
-    // Start system threads
-    for (int i = 0; i < manager.system_array.size; ++i)
+    // Move the resource amounts into contiguous cache line padded arrays
+    if (use_table)
     {
-        if (pthread_create(&system_tids[i], NULL, system_thread, manager.system_array.systems[i]) != 0)
+        resource_table_build(&manager.resource_table, &manager.resource_array, &manager.arena);
+    }
+
+    // Spread the events over several manager threads, the discrete-event modes and replays run on one thread anyway
+    if (shard_count > 1 && !discrete && batch_runs <= 0 && replay_path == NULL)
+    {
+        if (telemetry_path != NULL)
         {
-            perror("Failed to create system thread");
-            // In a real application, we would need to handle this failure better
+            fprintf(stderr, "The telemetry stream is written by a single manager, -t cannot be combined with -m\n");
+            manager_clean(&manager);
+            return 1;
         }
+        manager_split(&manager, shard_count);
     }
 
-    // Wait for manager thread to complete
-    pthread_join(manager_tid, NULL);
+    // Run the batches of coordinators on other machines until killed
+    if (serve_port > 0)
+    {
+        int result = cluster_serve(&manager, serve_port, pool_workers);
+        manager_clean(&manager);
+        return result;
+    }
 
-    // Wait for all system threads to complete
-    for (int i = 0; i < manager.system_array.size; ++i)
+    // Sweep variations of the scenario in forked copies, -p sets how many run at once, -n spreads them over nodes
+    if (batch_runs > 0)
     {
-        pthread_join(system_tids[i], NULL);
+        int result = (node_addresses != NULL) ? cluster_run(&manager, node_addresses, batch_runs)
+                                              : batch_run(&manager, batch_runs, pool_workers);
+        manager_clean(&manager);
+        return result;
     }
 
-    // Free the thread ID array
-    free(system_tids);
+    // Headless runs send events and snapshots to a binary stream instead of the console
+    Telemetry telemetry;
+    if (telemetry_path != NULL)
+    {
+        if (telemetry_open(&telemetry, telemetry_path, refresh_ms) != 0)
+        {
+            manager_clean(&manager);
+            return 1;
+        }
+        telemetry_describe(&telemetry, &manager);
+        manager.telemetry = &telemetry;
+    }
+
+    // Record every event pushed to the manager and its shards into a memory-mapped trace
+    Trace trace;
+    int tracing = 0;
+    if (trace_path != NULL)
+    {
+        if (trace_open(&trace, trace_path, &manager) != 0)
+        {
+            if (manager.telemetry != NULL)
+                telemetry_close(&telemetry);
+            manager_clean(&manager);
+            return 1;
+        }
+        manager.event_queue.trace = &trace;
+        for (int i = 1; i < manager.shard_count; i++)
+            manager.shards[i - 1].event_queue.trace = &trace;
+        tracing = 1;
+    }
+
+    // Feed a recorded trace to the manager alone, none of the systems run
+    if (replay_path != NULL)
+    {
+        int result = trace_replay(&manager, replay_path);
+        if (tracing)
+            trace_close(&trace);
+        if (manager.telemetry != NULL)
+            telemetry_close(&telemetry);
+        manager_clean(&manager);
+        return result;
+    }
+
+    // Run everything on a virtual clock in this thread, no system threads needed
+    if (discrete)
+    {
+        Simulation simulation;
+        simulation_init(&simulation, manager.system_array.size);
+        int result = 0;
+
+        // Carry on from a checkpoint instead of replaying the flight from the start
+        if (restore_path != NULL && checkpoint_load(&manager, &simulation, restore_path) != 0)
+            result = 1;
+
+        if (checkpoint_path != NULL)
+        {
+            simulation.checkpoint_path = checkpoint_path;
+            simulation.checkpoint_interval = (checkpoint_ms > 0) ? checkpoint_ms : MANAGER_DISPLAY_INTERVAL;
+            simulation.next_checkpoint = simulation.clock + simulation.checkpoint_interval;
+        }
+
+        if (result == 0)
+        {
+            simulation_run(&simulation, &manager);
+            simulation_report(&simulation, &manager);
+        }
+        simulation_clean(&simulation);
+        if (tracing)
+            trace_close(&trace);
+        if (manager.telemetry != NULL)
+            telemetry_close(&telemetry);
+        manager_clean(&manager);
+        return result;
+    }
+
+    // Pin the threads to the listed CPUs, systems sharing resources together on one NUMA node
+    Affinity affinity;
+    const Affinity *pinning = NULL;
+    if (cpu_list != NULL)
+    {
+        if (affinity_init(&affinity, cpu_list) != 0)
+        {
+            if (tracing)
+                trace_close(&trace);
+            if (manager.telemetry != NULL)
+                telemetry_close(&telemetry);
+            manager_clean(&manager);
+            return 1;
+        }
+        affinity_place(&affinity, &manager);
+        pinning = &affinity;
+
+        // One worker per listed CPU rather than per online core
+        if (pool_workers == 0)
+            pool_workers = affinity.cpu_count;
+    }
+
+    // Draw the state on a low priority thread so terminal output never delays the manager
+    Display display;
+    if (manager.telemetry == NULL && refresh_ms > 0 && display_init(&display, &manager, refresh_ms) == 0)
+    {
+        if (display_start(&display) == 0)
+            manager.display = &display;
+        else
+            display_clean(&display);
+    }
+
+    int result;
+    if (pool_workers >= 0)
+    {
+        // Run the systems as tasks on a fixed number of workers instead of one thread each
+        result = run_pool(&manager, pool_workers, pinning);
+    }
+    else
+    {
+        result = run_threads(&manager, pinning);
+    }
+
+    if (manager.display != NULL)
+    {
+        display_stop(&display);
+        display_clean(&display);
+    }
+
+    if (tracing)
+    {
+        trace_close(&trace);
+    }
+
+    if (manager.telemetry != NULL)
+    {
+        telemetry_close(&telemetry);
+    }
 
     manager_clean(&manager);
-    return 0;
+    if (pinning != NULL)
+        affinity_clean(&affinity);
+    return result;
 }
 
 /**
@@ -67,10 +308,14 @@ void load_data(Manager *manager)
 {
     // Create resources
     Resource *fuel, *oxygen, *energy, *distance;
-    resource_create(&fuel, "Fuel", 1000, 1000);
-    resource_create(&oxygen, "Oxygen", 20, 50);
-    resource_create(&energy, "Energy", 30, 50);
-    resource_create(&distance, "Distance", 0, 1000);
+    resource_create(&fuel, "Fuel", 1000, 1000, &manager->arena);
+    resource_create(&oxygen, "Oxygen", 20, 50, &manager->arena);
+    resource_create(&energy, "Energy", 30, 50, &manager->arena);
+    resource_create(&distance, "Distance", 0, 1000, &manager->arena);
+
+    // The manager terminates the flight when oxygen runs out or the distance is covered
+    oxygen->flags = RESOURCE_FLAG_LIFE_SUPPORT;
+    distance->flags = RESOURCE_FLAG_DESTINATION;
 
     resource_array_add(&manager->resource_array, fuel);
     resource_array_add(&manager->resource_array, oxygen);
@@ -82,25 +327,188 @@ void load_data(Manager *manager)
     ResourceAmount consume_fuel, produce_distance;
     resource_amount_init(&consume_fuel, fuel, 5);
     resource_amount_init(&produce_distance, distance, 25);
-    system_create(&propulsion_system, "Propulsion", consume_fuel, produce_distance, 50, &manager->event_queue);
+    system_create(&propulsion_system, "Propulsion", consume_fuel, produce_distance, 50, &manager->event_queue, &manager->arena);
 
     ResourceAmount consume_energy, produce_oxygen;
     resource_amount_init(&consume_energy, energy, 7);
     resource_amount_init(&produce_oxygen, oxygen, 4);
-    system_create(&life_support_system, "Life Support", consume_energy, produce_oxygen, 10, &manager->event_queue);
+    system_create(&life_support_system, "Life Support", consume_energy, produce_oxygen, 10, &manager->event_queue, &manager->arena);
 
     ResourceAmount consume_oxygen, produce_nothing;
     resource_amount_init(&consume_oxygen, oxygen, 1);
     resource_amount_init(&produce_nothing, NULL, 0);
-    system_create(&crew_capsule_system, "Crew", consume_oxygen, produce_nothing, 2, &manager->event_queue);
+    system_create(&crew_capsule_system, "Crew", consume_oxygen, produce_nothing, 2, &manager->event_queue, &manager->arena);
 
     ResourceAmount consume_fuel_for_energy, produce_energy;
     resource_amount_init(&consume_fuel_for_energy, fuel, 5);
     resource_amount_init(&produce_energy, energy, 10);
-    system_create(&generator_system, "Generator", consume_fuel_for_energy, produce_energy, 20, &manager->event_queue);
+    system_create(&generator_system, "Generator", consume_fuel_for_energy, produce_energy, 20, &manager->event_queue, &manager->arena);
 
     system_array_add(&manager->system_array, propulsion_system);
     system_array_add(&manager->system_array, life_support_system);
     system_array_add(&manager->system_array, crew_capsule_system);
     system_array_add(&manager->system_array, generator_system);
-}
\ No newline at end of file
+}
+/**
+ * Runs the simulation with one thread per system.
+ *
+ * With an affinity, every system thread may run on the listed CPUs of its node.
+ *
+ * @param[in,out] manager   Pointer to the loaded `Manager`.
+ * @param[in]     affinity  Pointer to the `Affinity` the systems were placed with, NULL to leave threads unpinned.
+ * @return                  Exit code for `main`.
+ */
+static int run_threads(Manager *manager, const Affinity *affinity)
+{
+    // Create thread IDs
+    pthread_t manager_tid;
+    pthread_t *system_tids = malloc(sizeof(pthread_t) * manager->system_array.size);
+
+    if (!system_tids)
+    {
+        perror("Failed to allocate memory for thread IDs");
+        return 1;
+    }
+
+    // Start manager threads, the root one last
+    if (manager_start_shards(manager) != 0)
+    {
+        free(system_tids);
+        return 1;
+    }
+    if (pthread_create(&manager_tid, NULL, manager_thread, manager) != 0)
+    {
+        perror("Failed to create manager thread");
+        manager->simulation_running = 0;
+        manager_join_shards(manager);
+        free(system_tids);
+        return 1;
+    }
+    pin_managers(manager, manager_tid, affinity);
+
+    // Start system threads
+    for (int i = 0; i < manager->system_array.size; ++i)
+    {
+        if (pthread_create(&system_tids[i], NULL, system_thread, manager->system_array.systems[i]) != 0)
+        {
+            perror("Failed to create system thread");
+            // In a real application, we would need to handle this failure better
+        }
+        else if (affinity != NULL)
+        {
+            affinity_pin_node(affinity, system_tids[i], manager->system_array.systems[i]->numa_node);
+        }
+    }
+
+    // Wait for manager threads to complete
+    pthread_join(manager_tid, NULL);
+    manager_join_shards(manager);
+
+    // Wait for all system threads to complete
+    for (int i = 0; i < manager->system_array.size; ++i)
+    {
+        pthread_join(system_tids[i], NULL);
+    }
+
+    // Free the thread ID array
+    free(system_tids);
+    return 0;
+}
+
+/**
+ * Runs the simulation with the systems scheduled on a thread pool.
+ *
+ * The manager keeps its own thread, the systems are ticked by `worker_count` pool workers.
+ * With an affinity, worker i is pinned to CPU i of the list and systems stay on workers of
+ * their node.
+ *
+ * @param[in,out] manager       Pointer to the loaded `Manager`.
+ * @param[in]     worker_count  Number of workers, 0 for one per CPU core.
+ * @param[in]     affinity      Pointer to the `Affinity` the systems were placed with, NULL to leave threads unpinned.
+ * @return                      Exit code for `main`.
+ */
+static int run_pool(Manager *manager, int worker_count, const Affinity *affinity)
+{
+    pthread_t manager_tid;
+    Pool pool;
+
+    pool_init(&pool, worker_count, manager->system_array.size);
+    pool.affinity = affinity;
+    if (pool.worker_count > 0)
+    {
+        // Disabled systems leave the workers' queues until the manager hands them back
+        manager->unpark = pool_unpark;
+        manager->unpark_context = &pool;
+    }
+
+    if (manager_start_shards(manager) != 0)
+    {
+        pool_clean(&pool);
+        return 1;
+    }
+    if (pthread_create(&manager_tid, NULL, manager_thread, manager) != 0)
+    {
+        perror("Failed to create manager thread");
+        manager->simulation_running = 0;
+        manager_join_shards(manager);
+        pool_clean(&pool);
+        return 1;
+    }
+    pin_managers(manager, manager_tid, affinity);
+
+    // Returns once every system has been terminated by the manager
+    pool_run(&pool, &manager->system_array);
+
+    pthread_join(manager_tid, NULL);
+    manager_join_shards(manager);
+    pool_clean(&pool);
+    return 0;
+}
+
+/**
+ * Pins the manager threads to the CPUs at the back of the list, away from the first pool workers.
+ *
+ * The root manager takes the last CPU, shard i the one i places before it.
+ *
+ * @param[in] manager      Pointer to the root `Manager` with its shards started.
+ * @param[in] manager_tid  Thread of the root manager.
+ * @param[in] affinity     Pointer to the `Affinity`, NULL to leave the managers unpinned.
+ */
+static void pin_managers(Manager *manager, pthread_t manager_tid, const Affinity *affinity)
+{
+    if (affinity == NULL)
+        return;
+
+    affinity_pin_cpu(affinity, manager_tid, affinity->cpu_count - 1);
+    for (int i = 1; i < manager->shard_count; i++)
+        affinity_pin_cpu(affinity, manager->shards[i - 1].thread, affinity->cpu_count - 1 - i % affinity->cpu_count);
+}
+
+/**
+ * Prints the command line options of the simulation.
+ *
+ * @param[in] program  Name the program was started with.
+ */
+static void print_usage(const char *program)
+{
+    printf("Usage: %s [options]\n", program);
+    printf("  -l    Use lock-free per-system event lanes instead of the shared queue mutex\n");
+    printf("  -s    Keep resource amounts in one contiguous table, a cache line each\n");
+    printf("  -d    Discrete-event mode, run on a virtual clock as fast as possible\n");
+    printf("  -R    Reserve room for the outputs before converting, skipping conversions that could not be stored\n");
+    printf("  -p N  Run systems on a pool of N worker threads, 0 for one per CPU core\n");
+    printf("  -m N  Split event handling over N manager threads, each reacting to its share of the resources\n");
+    printf("  -f F  Load resources and systems from scenario file F instead of the built-in flight\n");
+    printf("  -r MS Refresh the display every MS milliseconds, 0 to turn it off\n");
+    printf("  -t F  Headless, write a binary telemetry stream to F (- for stdout), read it with p2_decode\n");
+    printf("  -w F  Discrete-event mode, rewrite checkpoint file F every -k milliseconds of virtual time\n");
+    printf("  -k MS Virtual milliseconds between checkpoints (default 1000)\n");
+    printf("  -c F  Discrete-event mode, resume from checkpoint file F of the same scenario\n");
+    printf("  -b N  Batch of N discrete-event runs with varied capacities and processing times, -p sets the parallel runs\n");
+    printf("  -n L  Run the -b batch on the nodes in the comma separated host:port list L\n");
+    printf("  -S P  Node for distributed batches, serve runs on TCP port P, -p sets the parallel runs\n");
+    printf("  -T F  Record every event pushed to the manager into trace file F\n");
+    printf("  -E F  Replay trace file F of the same scenario through the manager alone, no system runs\n");
+    printf("  -a L  Pin threads to the CPUs in list L (e.g. 0-3,8-11), systems sharing resources on one NUMA node\n");
+    printf("  -h    Show this help\n");
+}
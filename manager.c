@@ -7,7 +7,34 @@
 
 // This function is only used by this file, so declared here and set to static to avoid having it linked by any other file
 
-static void display_simulation_state(Manager *manager);
+static void manager_handle_event(Manager *manager, const Event *event);
+static int manager_first_use(const ResourceAmount *amounts, int position);
+static void manager_set_status(Manager *manager, System *system, int status);
+static void manager_set_consumers(Manager *manager, const Resource *resource, int enable);
+static void manager_set_producers(Manager *manager, const Event *event, int status, int hold_ms);
+static void manager_set_speed(Manager *manager, System *system, int status, int hold_ms);
+static Manager *manager_get_shard(Manager *manager, int shard);
+static void manager_apply_held(Manager *manager);
+static void manager_build_rules(Manager *manager);
+static void manager_default_rule(Rule *rule, const Resource *resource, int status);
+static void manager_rule_add_action(Rule *rule, int action, int hold_ms);
+static int manager_rule_slot(int status);
+static int manager_rule_terminate(Manager *manager, const Event *event, int hold_ms);
+static int manager_rule_fast(Manager *manager, const Event *event, int hold_ms);
+static int manager_rule_slow(Manager *manager, const Event *event, int hold_ms);
+static int manager_rule_standard(Manager *manager, const Event *event, int hold_ms);
+static int manager_rule_disable(Manager *manager, const Event *event, int hold_ms);
+static int manager_rule_enable(Manager *manager, const Event *event, int hold_ms);
+
+// Handler of each RULE_ACTION_* code, new actions only need a code and an entry here
+static const RuleHandler manager_rule_handlers[RULE_ACTION_COUNT] = {
+    manager_rule_terminate,
+    manager_rule_fast,
+    manager_rule_slow,
+    manager_rule_standard,
+    manager_rule_disable,
+    manager_rule_enable,
+};
 
 /**
  * Initializes the `Manager`.
@@ -23,204 +50,852 @@ void manager_init(Manager *manager)
     system_array_init(&manager->system_array);
     resource_array_init(&manager->resource_array);
     event_queue_init(&manager->event_queue);
+    manager->resource_index = (ResourceIndex){NULL, NULL, NULL, NULL, 0};
+    manager->rules = NULL;
+    manager->rule_specs = NULL;
+    manager->held = NULL;
+    manager->held_count = 0;
+    manager->now = 0;
+    manager->root = manager;
+    manager->shards = NULL;
+    manager->shard_count = 1;
+    manager->shard = 0;
+    resource_table_init(&manager->resource_table);
+    arena_init(&manager->arena);
+    manager->display = NULL;
+    manager->telemetry = NULL;
+    manager->unpark = NULL;
+    manager->unpark_context = NULL;
+    manager->end_resource = NULL;
+    manager->end_status = STATUS_OK;
+#ifdef INSTRUMENT
+    stats_init();
+#endif
 }
 
 /**
  * Cleans up the `Manager`.
  *
- * Frees all resources associated with the manager.
+ * Frees all resources associated with the manager. INSTRUMENT builds print their report first.
  *
  * @param[in,out] manager  Pointer to the `Manager` to clean.
  */
 void manager_clean(Manager *manager)
 {
+#ifdef INSTRUMENT
+    // Report before the systems the per-system numbers live in are gone
+    stats_dump(stderr, manager);
+    stats_clean();
+#endif
+
+    for (int i = 0; i < manager->shard_count - 1; i++)
+        event_queue_clean(&manager->shards[i].event_queue);
+    free(manager->shards);
+
     resource_array_clean(&(manager->resource_array));
     system_array_clean(&(manager->system_array));
     event_queue_clean(&(manager->event_queue));
+
+    // Every system, resource and name goes away in one pass over the arena blocks
+    arena_clean(&(manager->arena));
 }
 
 /**
  * Runs the manager loop.
  *
- * Handles event processing, updates system statuses, and displays the simulation state.
+ * Handles event processing, updates system statuses, and publishes the simulation state
+ * for the display thread. Sleeps until events arrive or the next frame needs a fresh
+ * snapshot, then drains a whole batch of events.
  * Continues until the simulation is no longer running. (In a multi-threaded implementation)
  *
  * @param[in,out] manager  Pointer to the `Manager`.
  */
 void manager_run(Manager *manager)
 {
-    Event event;
-    int i, status;
-    int event_found_flag = 0, no_oxygen_flag = 0, distance_reached_flag = 0, need_more_flag = 0, need_less_flag = 0;
+    int timeout_ms = MANAGER_DISPLAY_INTERVAL;
+
+    // Hand the current state of things to the display thread, drawing it is not our job
+    if (manager->display != NULL)
+    {
+        display_publish(manager->display);
+        timeout_ms = manager->display->interval_ms;
+    }
+
+    // Headless runs record a snapshot in the telemetry stream instead
+    if (manager->telemetry != NULL)
+    {
+        timeout_ms = telemetry_snapshot(manager->telemetry, manager);
+    }
 
-    System *sys = NULL;
+    // Held speeds are due at the end of their hold even when no event arrives
+    if (manager->held_count > 0 && timeout_ms > RULE_DEFAULT_HOLD)
+        timeout_ms = RULE_DEFAULT_HOLD;
 
-    // Update the display of the current state of things
-    display_simulation_state(manager);
+    // Sleep until a system pushes an event or the display needs a new snapshot
+    if (event_queue_wait(&manager->event_queue, timeout_ms) != STATUS_OK && manager->held_count == 0)
+        return;
+
+    // Give closely spaced events a moment to accumulate so they are handled as one batch
+    usleep(MANAGER_WAIT_TIME * 1000);
 
-    // Process events if one is popped
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    manager->now = now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+    manager_process_events(manager);
+}
 
-    event_found_flag = event_queue_pop(&manager->event_queue, &event);
+/**
+ * Handles every event currently waiting in the manager's queue without blocking.
+ *
+ * Events are drained in batches of up to `MANAGER_BATCH_SIZE` per lock acquisition.
+ * Stops early once an event terminates the simulation. Speeds held back by a rule whose
+ * hold is over are applied first, `manager->now` must be current.
+ *
+ * @param[in,out] manager  Pointer to the `Manager`.
+ * @return                 Number of events handled.
+ */
+int manager_process_events(Manager *manager)
+{
+    Event events[MANAGER_BATCH_SIZE];
+    int count, handled = 0;
 
-    while (manager->simulation_running && event_found_flag)
+#ifdef INSTRUMENT
+    // A SIGUSR1 asks for a report while the simulation keeps running
+    if (stats_dump_pending())
+        stats_dump(stderr, manager);
+#endif
+
+    if (manager->held_count > 0)
+        manager_apply_held(manager);
+
+    do
     {
-        // Handle the event
-        printf("Event: [%s] Reported Resource [%s : %d] Status [%d]\n",
-               event.system->name,
-               event.resource->name,
-               event.amount,
-               event.status);
-
-        // Set some flags based on the event that we can react to below
-        no_oxygen_flag = (event.status == STATUS_EMPTY && strcmp(event.resource->name, "Oxygen") == 0);
-        distance_reached_flag = (event.status == STATUS_CAPACITY && strcmp(event.resource->name, "Distance") == 0);
-        need_more_flag = (event.status == STATUS_LOW || event.status == STATUS_EMPTY || event.status == STATUS_INSUFFICIENT);
-        need_less_flag = (event.status == STATUS_CAPACITY);
-
-        if (no_oxygen_flag)
+        count = event_queue_pop_batch(&manager->event_queue, events, MANAGER_BATCH_SIZE);
+        for (int i = 0; i < count && manager->root->simulation_running; i++)
         {
-            printf("Oxygen depleted. Terminating all systems.\n");
+            manager_handle_event(manager, &events[i]);
+            handled++;
         }
+    } while (count == MANAGER_BATCH_SIZE && manager->root->simulation_running);
+
+    return handled;
+}
+
+/**
+ * Reacts to a single event reported by a system.
+ *
+ * Looks up the rule of the reported resource and status and runs its actions in order,
+ * so the cost only depends on the number of actions and the systems they affect. The
+ * rules are built by `manager_build_index` from the resource role flags and the scenario.
+ * `STATUS_SPEED` messages from other shards are applied without being reported.
+ *
+ * @param[in,out] manager  Pointer to the `Manager`.
+ * @param[in]     event    Pointer to the `Event` to handle.
+ */
+static void manager_handle_event(Manager *manager, const Event *event)
+{
+    Resource *resource = event->resource;
+
+    // Another shard reacting to a resource of this system left its speed to us
+    if (event->status == STATUS_SPEED)
+    {
+        manager_set_speed(manager, event->system, event->amount & ((1 << SHARD_SPEED_SHIFT) - 1),
+                          event->amount >> SHARD_SPEED_SHIFT);
+        return;
+    }
+
+    // Handle the event, headless runs record it instead of printing
+    if (manager->telemetry != NULL)
+    {
+        telemetry_event(manager->telemetry, event);
+    }
+    else
+    {
+        printf("Event: [%s] Reported Resource [%s : %d] Status [%d]\n",
+               event->system->name,
+               resource->name,
+               event->amount,
+               event->status);
+    }
+
+    int slot = manager_rule_slot(event->status);
+    if (slot < 0)
+        return;
+
+    const Rule *rule = &manager->rules[resource->id * RULE_STATUS_COUNT + slot];
+    for (int i = 0; i < rule->action_count; i++)
+    {
+        if (rule->actions[i].handler(manager, event, rule->actions[i].hold_ms))
+            break;
+    }
+}
+
+/**
+ * Ends the simulation, unless the resource is no longer actually full or empty by the time the event is handled.
+ *
+ * The first shard to get here ends it for all of them, and wakes the others so they see it.
+ *
+ * @param[in,out] manager  Pointer to the `Manager`.
+ * @param[in]     event    Pointer to the `Event` being handled.
+ * @param[in]     hold_ms  Unused.
+ * @return                 Non-zero if the simulation was terminated.
+ */
+static int manager_rule_terminate(Manager *manager, const Event *event, int hold_ms)
+{
+    Manager *root = manager->root;
+    Resource *resource = event->resource;
+    (void)hold_ms;
+
+    // A producer finding its reserved room gone reports capacity before the resource is full
+    if (event->status == STATUS_CAPACITY && resource_get_amount(resource) < resource->max_capacity)
+        return 0;
+    // An empty report that a producer refilled since is no reason to end the flight either
+    if (event->status == STATUS_EMPTY && resource_get_amount(resource) > 0)
+        return 0;
+
+    // Terminate everything, this only ever happens once
+    if (atomic_exchange(&root->simulation_running, 0) == 0)
+        return 1;
+
+    if (manager->telemetry != NULL)
+        telemetry_terminate(manager->telemetry, resource, event->status);
+    else if (event->status == STATUS_CAPACITY)
+        printf("Destination reached. Terminating all systems.\n");
+    else
+        printf("%s depleted. Terminating all systems.\n", resource->name);
+
+    root->end_resource = resource;
+    root->end_status = event->status;
+    for (int i = 0; i < manager->system_array.size; i++)
+    {
+        manager_set_status(manager, manager->system_array.systems[i], TERMINATE);
+    }
+    for (int i = 0; i < root->shard_count; i++)
+    {
+        event_queue_wake(&manager_get_shard(root, i)->event_queue);
+    }
+    return 1;
+}
+
+/**
+ * Speeds up the producers of the reported resource.
+ *
+ * @param[in,out] manager  Pointer to the `Manager`.
+ * @param[in]     event    Pointer to the `Event` being handled.
+ * @param[in]     hold_ms  Milliseconds the new speed holds off other rules.
+ * @return                 Always 0.
+ */
+static int manager_rule_fast(Manager *manager, const Event *event, int hold_ms)
+{
+    manager_set_producers(manager, event, FAST, hold_ms);
+    return 0;
+}
+
+/**
+ * Slows down the producers of the reported resource.
+ *
+ * @param[in,out] manager  Pointer to the `Manager`.
+ * @param[in]     event    Pointer to the `Event` being handled.
+ * @param[in]     hold_ms  Milliseconds the new speed holds off other rules.
+ * @return                 Always 0.
+ */
+static int manager_rule_slow(Manager *manager, const Event *event, int hold_ms)
+{
+    manager_set_producers(manager, event, SLOW, hold_ms);
+    return 0;
+}
+
+/**
+ * Puts the producers of the reported resource back to the standard speed.
+ *
+ * @param[in,out] manager  Pointer to the `Manager`.
+ * @param[in]     event    Pointer to the `Event` being handled.
+ * @param[in]     hold_ms  Milliseconds the new speed holds off other rules.
+ * @return                 Always 0.
+ */
+static int manager_rule_standard(Manager *manager, const Event *event, int hold_ms)
+{
+    manager_set_producers(manager, event, STANDARD, hold_ms);
+    return 0;
+}
+
+/**
+ * Parks the consumers of the reported resource if it ran dry.
+ *
+ * @param[in,out] manager  Pointer to the `Manager`.
+ * @param[in]     event    Pointer to the `Event` being handled.
+ * @param[in]     hold_ms  Unused.
+ * @return                 Always 0.
+ */
+static int manager_rule_disable(Manager *manager, const Event *event, int hold_ms)
+{
+    (void)hold_ms;
+    // A stale event of a resource refilled since is no reason to park anyone
+    if (resource_get_amount(event->resource) == 0)
+        manager_set_consumers(manager, event->resource, 0);
+    return 0;
+}
+
+/**
+ * Brings back the parked consumers of the reported resource.
+ *
+ * @param[in,out] manager  Pointer to the `Manager`.
+ * @param[in]     event    Pointer to the `Event` being handled.
+ * @param[in]     hold_ms  Unused.
+ * @return                 Always 0.
+ */
+static int manager_rule_enable(Manager *manager, const Event *event, int hold_ms)
+{
+    (void)hold_ms;
+    manager_set_consumers(manager, event->resource, 1);
+    return 0;
+}
+
+/**
+ * Changes the status of a system, handing it back to its runner if it was parked.
+ *
+ * @param[in,out] manager  Pointer to the `Manager`.
+ * @param[in,out] system   Pointer to the `System` to update.
+ * @param[in]     status   New status, e.g. `FAST` or `TERMINATE`.
+ */
+static void manager_set_status(Manager *manager, System *system, int status)
+{
+    Manager *root = manager->root;
+
+    system_set_status(system, status);
+    if (status != DISABLED && system_unpark(system) && root->unpark != NULL)
+        root->unpark(root->unpark_context, system);
+}
+
+/**
+ * Disables or re-enables every system consuming a resource.
+ *
+ * A consumer of an empty resource cannot convert anything, so it is parked instead of
+ * retrying. Re-enabled systems start again at the standard speed.
+ *
+ * @param[in,out] manager   Pointer to the `Manager`.
+ * @param[in]     resource  Pointer to the `Resource` whose consumers change.
+ * @param[in]     enable    Non-zero to re-enable the disabled consumers, zero to disable them.
+ */
+static void manager_set_consumers(Manager *manager, const Resource *resource, int enable)
+{
+    ResourceIndex *index = &manager->resource_index;
+
+    for (int i = index->consumer_start[resource->id]; i < index->consumer_start[resource->id + 1]; i++)
+    {
+        System *system = index->consumers[i];
+        int current = system_get_status(system);
+
+        if (current == TERMINATE)
+            continue;
+        if (enable && current == DISABLED)
+            manager_set_status(manager, system, STANDARD);
+        else if (!enable && current != DISABLED)
+            manager_set_status(manager, system, DISABLED);
+    }
+}
+
+/**
+ * Changes the speed of every system producing the reported resource.
+ *
+ * The speed of a system is kept by one shard, producers kept by another one are sent a
+ * `STATUS_SPEED` message instead. Messages for the same system and resource are merged
+ * while they wait, so the latest speed wins like it does on a single manager.
+ *
+ * @param[in,out] manager  Pointer to the `Manager` handling the event.
+ * @param[in]     event    Pointer to the `Event` being handled.
+ * @param[in]     status   New speed, `FAST`, `STANDARD` or `SLOW`.
+ * @param[in]     hold_ms  Milliseconds the new speed holds off other changes.
+ */
+static void manager_set_producers(Manager *manager, const Event *event, int status, int hold_ms)
+{
+    ResourceIndex *index = &manager->resource_index;
+    int id = event->resource->id;
 
-        if (distance_reached_flag)
+    for (int i = index->producer_start[id]; i < index->producer_start[id + 1]; i++)
+    {
+        System *system = index->producers[i];
+        if (system->shard == manager->shard)
         {
-            printf("Destination reached. Terminating all systems.\n");
+            manager_set_speed(manager, system, status, hold_ms);
+            continue;
         }
 
-        if (no_oxygen_flag || distance_reached_flag)
+        Event message;
+        event_init(&message, system, event->resource, STATUS_SPEED, PRIORITY_MED, status | hold_ms << SHARD_SPEED_SHIFT);
+        event_queue_forward(&manager_get_shard(manager->root, system->shard)->event_queue, &message);
+    }
+}
+
+/**
+ * Changes the speed of a system, respecting the hold of its last change.
+ *
+ * A system that changed speed less than its hold ago keeps it, the speed asked for is
+ * remembered instead and applied by `manager_apply_held` once the hold is over, the latest
+ * request winning. This stops a resource going back and forth around its thresholds from
+ * flipping its producers between `FAST` and `SLOW` on every event. Only the shard keeping
+ * the speed of the system may call this.
+ *
+ * @param[in,out] manager  Pointer to the `Manager` keeping the speed of the system.
+ * @param[in,out] system   Pointer to the `System` to update.
+ * @param[in]     status   New speed, `FAST`, `STANDARD` or `SLOW`.
+ * @param[in]     hold_ms  Milliseconds the new speed holds off other changes.
+ */
+static void manager_set_speed(Manager *manager, System *system, int status, int hold_ms)
+{
+    int current = system_get_status(system);
+
+    // Parked producers wait for their own inputs, they come back at the standard speed
+    if (current == DISABLED || current == TERMINATE)
+        return;
+
+    if (manager->now < system->speed_held_until)
+    {
+        if (system->held_speed < 0)
+            manager->held[manager->held_count++] = system;
+        system->held_speed = status;
+        system->held_hold_ms = hold_ms;
+        return;
+    }
+
+    // Rewriting the same speed would only bounce the status cache line around
+    if (current == status)
+        return;
+    manager_set_status(manager, system, status);
+    system->speed_held_until = manager->now + hold_ms;
+}
+
+/**
+ * Applies the speeds held back by `manager_set_speed` whose hold is over.
+ *
+ * @param[in,out] manager  Pointer to the `Manager`.
+ */
+static void manager_apply_held(Manager *manager)
+{
+    int i = 0;
+
+    while (i < manager->held_count)
+    {
+        System *system = manager->held[i];
+        if (manager->now < system->speed_held_until)
         {
-            status = TERMINATE;
-            manager->simulation_running = 0;
+            i++;
+            continue;
         }
-        else if (need_more_flag)
+
+        int current = system_get_status(system);
+        if (current != DISABLED && current != TERMINATE && current != system->held_speed)
         {
-            status = FAST;
+            manager_set_status(manager, system, system->held_speed);
+            system->speed_held_until = manager->now + system->held_hold_ms;
         }
-        else if (need_less_flag)
+        system->held_speed = -1;
+
+        // The order of the held systems does not matter, fill the gap with the last one
+        manager->held[i] = manager->held[--manager->held_count];
+    }
+}
+
+/**
+ * Adds an action to the rule of a resource and status, replacing its built-in actions.
+ *
+ * Rules are kept in the order they are added and turned into the dispatch table by
+ * `manager_build_index`. Every action added for the same resource and status runs, in
+ * that order.
+ *
+ * @param[in,out] manager   Pointer to the `Manager` being loaded.
+ * @param[in]     resource  Pointer to the `Resource` the rule reacts to.
+ * @param[in]     status    Event status the rule reacts to, e.g. `STATUS_LOW`.
+ * @param[in]     action    One of the `RULE_ACTION_*` codes.
+ * @param[in]     hold_ms   Milliseconds a speed set by the action holds off other changes.
+ * @return                  0 on success, -1 for an unknown status or action, or too many actions.
+ */
+int manager_add_rule(Manager *manager, Resource *resource, int status, int action, int hold_ms)
+{
+    RuleSpec **link = &manager->rule_specs;
+    int action_count = 0;
+
+    if (manager_rule_slot(status) < 0 || action < 0 || action >= RULE_ACTION_COUNT || hold_ms < 0)
+        return -1;
+
+    for (; *link != NULL; link = &(*link)->next)
+    {
+        if ((*link)->resource == resource && (*link)->status == status)
+            action_count++;
+    }
+    if (action_count >= RULE_MAX_ACTIONS)
+        return -1;
+
+    RuleSpec *spec = arena_alloc(&manager->arena, sizeof(RuleSpec), _Alignof(RuleSpec));
+    if (spec == NULL)
+    {
+        perror("Failed to allocate memory for a rule");
+        return -1;
+    }
+    *spec = (RuleSpec){resource, status, action, hold_ms, NULL};
+    *link = spec;
+    return 0;
+}
+
+/**
+ * Builds the rule table, the built-in rules overridden by those of the scenario.
+ *
+ * @param[in,out] manager  Pointer to the loaded `Manager`.
+ */
+static void manager_build_rules(Manager *manager)
+{
+    int slot_count = manager->resource_array.size * RULE_STATUS_COUNT;
+
+    manager->rules = arena_alloc(&manager->arena, sizeof(Rule) * ALLOC_COUNT(slot_count), _Alignof(Rule));
+    manager->held =
+        arena_alloc(&manager->arena, sizeof(System *) * ALLOC_COUNT(manager->system_array.size), _Alignof(System *));
+    char *custom = malloc(ALLOC_COUNT(slot_count));
+    if (manager->rules == NULL || manager->held == NULL || custom == NULL)
+    {
+        perror("Failed to allocate memory for the rules");
+        exit(1);
+    }
+
+    static const int statuses[RULE_STATUS_COUNT] = {STATUS_EMPTY, STATUS_LOW, STATUS_INSUFFICIENT, STATUS_CAPACITY, STATUS_PRODUCED};
+    for (int r = 0; r < manager->resource_array.size; r++)
+    {
+        for (int s = 0; s < RULE_STATUS_COUNT; s++)
         {
-            status = SLOW;
+            manager_default_rule(&manager->rules[r * RULE_STATUS_COUNT + s], manager->resource_array.resources[r], statuses[s]);
+            custom[r * RULE_STATUS_COUNT + s] = 0;
         }
+    }
 
-        if (no_oxygen_flag || distance_reached_flag || need_more_flag || need_less_flag)
+    // The first scenario rule of a slot throws out its built-in actions
+    for (RuleSpec *spec = manager->rule_specs; spec != NULL; spec = spec->next)
+    {
+        int slot = spec->resource->id * RULE_STATUS_COUNT + manager_rule_slot(spec->status);
+        if (!custom[slot])
         {
-            // Update all of the systems to speed up or slow down production, or terminate
-            for (i = 0; i < manager->system_array.size; i++)
-            {
-                sys = manager->system_array.systems[i];
-                if (status == TERMINATE || sys->produced.resource == event.resource)
-                {
-                    // In manager_run when changing a system's status
-                    sem_wait(&sys->status_mutex);
-                    sys->status = status;
-                    sem_post(&sys->status_mutex);
-                }
-            }
+            manager->rules[slot].action_count = 0;
+            custom[slot] = 1;
         }
+        manager_rule_add_action(&manager->rules[slot], spec->action, spec->hold_ms);
+    }
+
+    free(custom);
+    manager->held_count = 0;
+}
+
+/**
+ * Sets up the built-in rule of a resource and status.
+ *
+ * Life support running out and the destination filling up end the simulation. Running
+ * low or out speeds up the producers and an empty resource parks its consumers. A full
+ * resource slows down its producers, and any production brings back the parked consumers.
+ *
+ * @param[out] rule      Pointer to the `Rule` to set up.
+ * @param[in]  resource  Pointer to the `Resource` the rule reacts to.
+ * @param[in]  status    Event status the rule reacts to.
+ */
+static void manager_default_rule(Rule *rule, const Resource *resource, int status)
+{
+    rule->action_count = 0;
 
-        event_found_flag = event_queue_pop(&manager->event_queue, &event);
+    switch (status)
+    {
+    case STATUS_EMPTY:
+        if (resource->flags & RESOURCE_FLAG_LIFE_SUPPORT)
+            manager_rule_add_action(rule, RULE_ACTION_TERMINATE, 0);
+        manager_rule_add_action(rule, RULE_ACTION_DISABLE, 0);
+        manager_rule_add_action(rule, RULE_ACTION_FAST, RULE_DEFAULT_HOLD);
+        break;
+    case STATUS_LOW:
+    case STATUS_INSUFFICIENT:
+        manager_rule_add_action(rule, RULE_ACTION_FAST, RULE_DEFAULT_HOLD);
+        break;
+    case STATUS_CAPACITY:
+        if (resource->flags & RESOURCE_FLAG_DESTINATION)
+            manager_rule_add_action(rule, RULE_ACTION_TERMINATE, 0);
+        manager_rule_add_action(rule, RULE_ACTION_ENABLE, 0);
+        manager_rule_add_action(rule, RULE_ACTION_SLOW, RULE_DEFAULT_HOLD);
+        break;
+    case STATUS_PRODUCED:
+        manager_rule_add_action(rule, RULE_ACTION_ENABLE, 0);
+        break;
     }
 }
 
-// Don't worry much about these! These are special codes that allow us to do some formatting in the terminal
-// Such as clearing the line before printing or moving the location of the "cursor" that will print.
-#define ANSI_CLEAR "\033[2J"
-#define ANSI_MV_TL "\033[H"
-#define ANSI_LN_CLR "\033[K"
-#define ANSI_MV_D1 "\033[1B"
-#define ANSI_SAVE "\033[s"
-#define ANSI_RESTORE "\033[u"
+/**
+ * Appends an action to a rule.
+ *
+ * @param[in,out] rule     Pointer to the `Rule`, with room for one more action.
+ * @param[in]     action   One of the `RULE_ACTION_*` codes.
+ * @param[in]     hold_ms  Milliseconds a speed set by the action holds off other changes.
+ */
+static void manager_rule_add_action(Rule *rule, int action, int hold_ms)
+{
+    rule->actions[rule->action_count].handler = manager_rule_handlers[action];
+    rule->actions[rule->action_count].hold_ms = hold_ms;
+    rule->action_count++;
+}
 
 /**
- * Displays the current simulation state.
+ * Maps an event status to its slot in the rule table.
  *
- * Outputs the statuses of resources and systems to the console.
- * This function is typically called periodically to update the display.
+ * @param[in] status  Status of an event, e.g. `STATUS_LOW`.
+ * @return            Slot between 0 and `RULE_STATUS_COUNT - 1`, or -1 if no rule reacts to it.
+ */
+static int manager_rule_slot(int status)
+{
+    if (status >= STATUS_EMPTY && status <= STATUS_CAPACITY)
+        return status - STATUS_EMPTY;
+    if (status == STATUS_PRODUCED)
+        return RULE_STATUS_COUNT - 1;
+    return -1;
+}
+
+/**
+ * Builds the index from each resource to the systems producing and consuming it.
  *
- * @param[in] manager  Pointer to the `Manager` containing the simulation state.
+ * The index is stored in compressed form: for resource id `r`, its producers are
+ * `producers[producer_start[r]]` up to `producers[producer_start[r + 1]]`, and the same for
+ * consumers. Also builds the rule table of the manager. Must be called once all systems,
+ * resources and rules are loaded and before the manager handles any event.
+ *
+ * @param[in,out] manager  Pointer to the loaded `Manager`.
  */
-void display_simulation_state(Manager *manager)
+void manager_build_index(Manager *manager)
 {
-    // Static integers are allocated to the data segment, so they persist between function calls
-    static const int display_interval = 1;
-    static time_t last_display_time = 0;
+    ResourceIndex *index = &manager->resource_index;
+    int resource_count = manager->resource_array.size;
+    int produced_total = 0, consumed_total = 0;
 
-    // If it has not been long enough since our previous display refresh, keep waiting.
-    time_t current_time = time(NULL);
-    if (difftime(current_time, last_display_time) < display_interval)
+    // Count the links to size the arrays
+    for (int i = 0; i < manager->system_array.size; i++)
     {
-        return;
+        System *system = manager->system_array.systems[i];
+        produced_total += system->produced_count;
+        consumed_total += system->consumed_count;
+    }
+
+    index->producer_start = arena_alloc(&manager->arena, sizeof(int) * (resource_count + 1), _Alignof(int));
+    index->consumer_start = arena_alloc(&manager->arena, sizeof(int) * (resource_count + 1), _Alignof(int));
+    index->producers = arena_alloc(&manager->arena, sizeof(System *) * ALLOC_COUNT(produced_total), _Alignof(System *));
+    index->consumers = arena_alloc(&manager->arena, sizeof(System *) * ALLOC_COUNT(consumed_total), _Alignof(System *));
+    int *cursor = malloc(sizeof(int) * (resource_count + 1));
+    if (index->producer_start == NULL || index->consumer_start == NULL || index->producers == NULL ||
+        index->consumers == NULL || cursor == NULL)
+    {
+        perror("Failed to allocate memory for the resource index");
+        exit(1);
+    }
+
+    for (int r = 0; r <= resource_count; r++)
+    {
+        index->producer_start[r] = 0;
+        index->consumer_start[r] = 0;
+    }
+
+    // Count per resource, shifted by one so the prefix sum gives the start offsets.
+    // A system listing the same resource twice is only indexed once.
+    for (int i = 0; i < manager->system_array.size; i++)
+    {
+        System *system = manager->system_array.systems[i];
+        for (int j = 0; j < system->produced_count; j++)
+        {
+            if (manager_first_use(system->produced, j))
+                index->producer_start[system->produced[j].resource->id + 1]++;
+        }
+        for (int j = 0; j < system->consumed_count; j++)
+        {
+            if (manager_first_use(system->consumed, j))
+                index->consumer_start[system->consumed[j].resource->id + 1]++;
+        }
+    }
+    for (int r = 0; r < resource_count; r++)
+    {
+        index->producer_start[r + 1] += index->producer_start[r];
+        index->consumer_start[r + 1] += index->consumer_start[r];
     }
 
-    // Otherwise display to the screen by resetting the timer
-    printf(ANSI_CLEAR);
+    // Fill in the producers, then the consumers, in system order
+    for (int r = 0; r < resource_count; r++)
+        cursor[r] = index->producer_start[r];
+    for (int i = 0; i < manager->system_array.size; i++)
+    {
+        System *system = manager->system_array.systems[i];
+        for (int j = 0; j < system->produced_count; j++)
+        {
+            if (manager_first_use(system->produced, j))
+                index->producers[cursor[system->produced[j].resource->id]++] = system;
+        }
+    }
 
-    // Move the cursor to the top-left corner
-    // But only after saving it's previous location
-    printf(ANSI_MV_TL);
+    for (int r = 0; r < resource_count; r++)
+        cursor[r] = index->consumer_start[r];
+    for (int i = 0; i < manager->system_array.size; i++)
+    {
+        System *system = manager->system_array.systems[i];
+        for (int j = 0; j < system->consumed_count; j++)
+        {
+            if (manager_first_use(system->consumed, j))
+                index->consumers[cursor[system->consumed[j].resource->id]++] = system;
+        }
+    }
 
-    // Display Resource Amounts
-    printf(ANSI_LN_CLR "Current Resource Amounts:\n");
-    printf(ANSI_LN_CLR "-------------------------\n");
+    free(cursor);
+    index->resource_count = resource_count;
 
-    Resource *resource = NULL;
-    int amount = 0;
-    int max_capacity = 0;
-    for (int i = 0; i < manager->resource_array.size; i++)
+    manager_build_rules(manager);
+}
+
+/**
+ * Checks whether entry `position` is the first mention of its resource in a list.
+ *
+ * @param[in] amounts   Array of `ResourceAmount`s of a system.
+ * @param[in] position  Index of the entry to check.
+ * @return              Non-zero if no earlier entry names the same resource.
+ */
+static int manager_first_use(const ResourceAmount *amounts, int position)
+{
+    for (int i = 0; i < position; i++)
     {
-        resource = manager->resource_array.resources[i];
+        if (amounts[i].resource == amounts[position].resource)
+            return 0;
+    }
+    return 1;
+}
 
-        // Lock before reading resource data
-        sem_wait(&resource->mutex);
-        amount = resource->amount;
-        max_capacity = resource->max_capacity;
-        sem_post(&resource->mutex);
+/**
+ * Splits the handling of events over `shard_count` managers, each with its own queue and thread.
+ *
+ * Every resource belongs to one shard, which handles all of its events, so the reactions
+ * to a resource stay in order. Resources are handed out in id order to the shard with the
+ * least systems linked to its resources so far. A system belongs to the shard of its first
+ * output, which keeps its speed. The shards share everything else with this manager, the
+ * root, whose `simulation_running` stops all of them. Must be called after
+ * `manager_build_index` and any `event_queue_attach_lanes`, before the threads start.
+ *
+ * @param[in,out] manager      Pointer to the loaded `Manager`, which becomes shard 0.
+ * @param[in]     shard_count  Number of shards, 1 or less keeps a single manager.
+ */
+void manager_split(Manager *manager, int shard_count)
+{
+    ResourceIndex *index = &manager->resource_index;
+    int resource_count = manager->resource_array.size;
+
+    if (shard_count <= 1 || manager->shard_count > 1)
+        return;
 
-        printf(ANSI_LN_CLR "%s: %d / %d\n", resource->name, amount, max_capacity);
+    manager->shards = malloc(sizeof(Manager) * (shard_count - 1));
+    int *load = malloc(sizeof(int) * shard_count);
+    int *resource_shard = malloc(sizeof(int) * ALLOC_COUNT(resource_count));
+    if (manager->shards == NULL || load == NULL || resource_shard == NULL)
+    {
+        perror("Failed to allocate memory for the manager shards");
+        exit(1);
     }
 
-    printf(ANSI_LN_CLR "\n");
+    // A shard shares the loaded state and the rules, but queues, holds and clock are its own
+    for (int i = 1; i < shard_count; i++)
+    {
+        Manager *shard = &manager->shards[i - 1];
+        // Shallow copy: the resource_array, system_array, index and arena storage stay the root's,
+        // so a shard must never be passed to manager_clean, and allocates from the root's arena
+        *shard = *manager;
+        event_queue_init(&shard->event_queue);
+        if (manager->event_queue.lanes != NULL)
+            event_queue_attach_lanes(&shard->event_queue, manager->event_queue.lane_count);
+        shard->held =
+            arena_alloc(&manager->arena, sizeof(System *) * ALLOC_COUNT(manager->system_array.size), _Alignof(System *));
+        if (shard->held == NULL)
+        {
+            perror("Failed to allocate memory for the manager shards");
+            exit(1);
+        }
+        shard->held_count = 0;
+        shard->display = NULL;
+        shard->telemetry = NULL;
+        shard->root = manager;
+        shard->shards = NULL;
+        shard->shard = i;
+    }
+    manager->shard_count = shard_count;
+    for (int i = 1; i < shard_count; i++)
+        manager->shards[i - 1].shard_count = shard_count;
 
-    // Display System Statuses
-    printf(ANSI_LN_CLR "System Statuses:\n");
-    printf(ANSI_LN_CLR "---------------\n");
+    for (int s = 0; s < shard_count; s++)
+        load[s] = 0;
+    for (int r = 0; r < resource_count; r++)
+    {
+        int weight = 1 + (index->producer_start[r + 1] - index->producer_start[r]) +
+                     (index->consumer_start[r + 1] - index->consumer_start[r]);
+        int least = 0;
+        for (int s = 1; s < shard_count; s++)
+        {
+            if (load[s] < load[least])
+                least = s;
+        }
+        load[least] += weight;
+        resource_shard[r] = least;
+        manager->resource_array.resources[r]->event_queue = &manager_get_shard(manager, least)->event_queue;
+    }
 
-    System *system = NULL;
     for (int i = 0; i < manager->system_array.size; i++)
     {
-        system = manager->system_array.systems[i];
+        System *system = manager->system_array.systems[i];
+        system->shard = (system->produced_count > 0) ? resource_shard[system->produced[0].resource->id] : 0;
+    }
+
+    free(load);
+    free(resource_shard);
+}
 
-        // Map system status code to a human-readable string
-        const char *status_str;
-        switch (system->status)
+/**
+ * Starts a thread running `manager_thread` for every shard but the root.
+ *
+ * Without all of its shards the simulation cannot run, so if a thread cannot be created
+ * the simulation is stopped and the shards already started are waited for.
+ *
+ * @param[in,out] manager  Pointer to the root `Manager`.
+ * @return                 0 on success, 1 if a thread could not be created.
+ */
+int manager_start_shards(Manager *manager)
+{
+    for (int i = 0; i < manager->shard_count - 1; i++)
+    {
+        if (pthread_create(&manager->shards[i].thread, NULL, manager_thread, &manager->shards[i]) != 0)
         {
-        case TERMINATE:
-            status_str = "TERMINATE";
-            break;
-        case DISABLED:
-            status_str = "DISABLED";
-            break;
-        case SLOW:
-            status_str = "SLOW";
-            break;
-        case STANDARD:
-            status_str = "STANDARD";
-            break;
-        case FAST:
-            status_str = "FAST";
-            break;
-        default:
-            status_str = "UNKNOWN";
-            break;
+            perror("Failed to create manager shard thread");
+            manager->simulation_running = 0;
+            for (int j = 0; j < i; j++)
+            {
+                event_queue_wake(&manager->shards[j].event_queue);
+                pthread_join(manager->shards[j].thread, NULL);
+            }
+            return 1;
         }
-
-        printf(ANSI_LN_CLR "%-20s: %-10s\n", system->name, status_str);
     }
+    return 0;
+}
 
-    printf(ANSI_LN_CLR "\n");
+/**
+ * Waits for the threads of the shards once the simulation ended.
+ *
+ * @param[in,out] manager  Pointer to the root `Manager`.
+ */
+void manager_join_shards(Manager *manager)
+{
+    for (int i = 0; i < manager->shard_count - 1; i++)
+        pthread_join(manager->shards[i].thread, NULL);
+}
 
-    last_display_time = current_time;
-    // Flush the output to ensure it appears immediately
-    fflush(stdout);
+/**
+ * Gives the manager of a shard.
+ *
+ * @param[in] root   Pointer to the root `Manager`.
+ * @param[in] shard  Index of the shard, 0 for the root itself.
+ * @return           Pointer to the `Manager` of the shard.
+ */
+static Manager *manager_get_shard(Manager *root, int shard)
+{
+    return (shard == 0) ? root : &root->shards[shard - 1];
 }
 
 /**
@@ -228,6 +903,7 @@ void display_simulation_state(Manager *manager)
  *
  * This function is passed to pthread_create and executes the Manager's
  * run function in a loop until the simulation_running flag is set to 0.
+ * Shards run it too and stop with their root.
  *
  * @param manager Pointer to the Manager to run (cast from void*)
  * @return Always returns NULL
@@ -235,7 +911,7 @@ void display_simulation_state(Manager *manager)
 void *manager_thread(void *arg)
 {
     Manager *manager = (Manager *)arg;
-    while (manager->simulation_running)
+    while (manager->root->simulation_running)
     {
         manager_run(manager);
     }
@@ -0,0 +1,480 @@
+#include "defs.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+// Helper functions just used by this C file to clean up our code
+
+static void *pool_worker_thread(void *arg);
+static long long pool_now(void);
+static int pool_worker_init(PoolWorker *worker, Pool *pool, int index, int capacity);
+static void pool_worker_clean(PoolWorker *worker);
+static void pool_push_ready(PoolWorker *worker, System *system);
+static System *pool_take_ready(PoolWorker *worker, int steal);
+static void pool_push_timer(PoolWorker *worker, System *system, long long due);
+static long long pool_release_timers(PoolWorker *worker, long long now);
+static System *pool_steal(Pool *pool, int thief);
+static PoolWorker *pool_home_worker(Pool *pool, const System *system);
+static void pool_sleep(PoolWorker *worker, long long until);
+
+/**
+ * Initializes the `Pool`.
+ *
+ * Sets up `worker_count` workers, each with its own ready deque and timer heap.
+ * A `worker_count` of 0 or less uses one worker per online CPU core.
+ *
+ * @param[out] pool          Pointer to the `Pool` to initialize.
+ * @param[in]  worker_count  Number of worker threads to use.
+ * @param[in]  task_count    Number of systems the pool will run, used to size the queues.
+ */
+void pool_init(Pool *pool, int worker_count, int task_count)
+{
+    if (worker_count <= 0)
+    {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        worker_count = (cores > 0) ? (int)cores : 1;
+    }
+
+    pool->worker_count = 0;
+    atomic_init(&pool->live_tasks, 0);
+    pool->affinity = NULL;
+
+    pool->workers = malloc(sizeof(PoolWorker) * worker_count);
+    if (pool->workers == NULL)
+    {
+        perror("Failed to allocate memory for pool workers");
+        return;
+    }
+
+    // Any worker may end up holding every task once stealing kicks in
+    for (int i = 0; i < worker_count; i++)
+    {
+        if (pool_worker_init(&pool->workers[i], pool, i, task_count) != 0)
+            break;
+        pool->worker_count++;
+    }
+}
+
+/**
+ * Cleans up the `Pool`.
+ *
+ * Frees the workers and their queues. The pool must not be running.
+ *
+ * @param[in,out] pool  Pointer to the `Pool` to clean.
+ */
+void pool_clean(Pool *pool)
+{
+    if (pool == NULL || pool->workers == NULL)
+        return;
+
+    for (int i = 0; i < pool->worker_count; i++)
+    {
+        pool_worker_clean(&pool->workers[i]);
+    }
+    free(pool->workers);
+    pool->workers = NULL;
+    pool->worker_count = 0;
+}
+
+/**
+ * Runs every system of the `SystemArray` on the pool until all of them have terminated.
+ *
+ * Systems are handed out round-robin and then run as tasks: a worker ticks a system with
+ * `system_tick` and re-queues it on its own timer heap for the delay the tick returned,
+ * instead of a thread sleeping for it. Idle workers steal ready systems from the others.
+ * Blocks until every system has reached `TERMINATE`.
+ *
+ * @param[in,out] pool     Pointer to an initialized `Pool`.
+ * @param[in]     systems  Pointer to the `SystemArray` holding the systems to run.
+ */
+void pool_run(Pool *pool, SystemArray *systems)
+{
+    if (pool->worker_count == 0)
+        return;
+
+    // Worker i is pinned to CPU i of the list, and so belongs to that CPU's node
+    for (int i = 0; i < pool->worker_count; i++)
+        pool->workers[i].numa_node = (pool->affinity != NULL) ? pool->affinity->cpu_nodes[i % pool->affinity->cpu_count] : 0;
+
+    atomic_store(&pool->live_tasks, systems->size);
+    for (int i = 0; i < systems->size; i++)
+    {
+        pool_push_ready(pool_home_worker(pool, systems->systems[i]), systems->systems[i]);
+    }
+
+    for (int i = 0; i < pool->worker_count; i++)
+    {
+        if (pthread_create(&pool->workers[i].thread, NULL, pool_worker_thread, &pool->workers[i]) != 0)
+        {
+            perror("Failed to create pool worker thread");
+            pool->workers[i].started = 0;
+            continue;
+        }
+        pool->workers[i].started = 1;
+        if (pool->affinity != NULL)
+            affinity_pin_cpu(pool->affinity, pool->workers[i].thread, i);
+    }
+
+    for (int i = 0; i < pool->worker_count; i++)
+    {
+        if (pool->workers[i].started)
+            pthread_join(pool->workers[i].thread, NULL);
+    }
+}
+
+/**
+ * Hands a re-enabled system back to the pool, used as `Manager.unpark`.
+ *
+ * The system goes to the ready deque of its home worker, the one it is spread to at start,
+ * which is woken up in case it is sleeping.
+ *
+ * @param[in,out] context  Pointer to the running `Pool` (cast from void*)
+ * @param[in]     system   Pointer to the unparked `System`.
+ */
+void pool_unpark(void *context, System *system)
+{
+    Pool *pool = (Pool *)context;
+    PoolWorker *worker = pool_home_worker(pool, system);
+
+    pool_push_ready(worker, system);
+    sem_post(&worker->wakeup);
+}
+
+/**
+ * Thread function for a pool worker.
+ *
+ * Moves its due timers to its ready deque, runs one ready system (its own or a stolen one),
+ * and sleeps until its next timer when there is nothing to do.
+ *
+ * @param arg Pointer to the PoolWorker to run (cast from void*)
+ * @return Always returns NULL
+ */
+static void *pool_worker_thread(void *arg)
+{
+    PoolWorker *worker = (PoolWorker *)arg;
+    Pool *pool = worker->pool;
+
+    while (atomic_load(&pool->live_tasks) > 0)
+    {
+        long long now = pool_now();
+        long long next_due = pool_release_timers(worker, now);
+
+        System *system = pool_take_ready(worker, 0);
+        if (system == NULL)
+            system = pool_steal(pool, worker->index);
+
+        if (system == NULL)
+        {
+            pool_sleep(worker, next_due);
+            continue;
+        }
+
+        // Terminated systems leave the pool, like their threads would exit
+        int status = system_get_status(system);
+        if (status == TERMINATE)
+        {
+            if (atomic_fetch_sub(&pool->live_tasks, 1) == 1)
+            {
+                // Last task gone, wake everyone so they can exit
+                for (int i = 0; i < pool->worker_count; i++)
+                    sem_post(&pool->workers[i].wakeup);
+            }
+            continue;
+        }
+
+        // Disabled systems are set aside until `pool_unpark` hands them back
+        if (status == DISABLED && system_park(system))
+            continue;
+
+        int delay = system_tick(system);
+        pool_push_timer(worker, system, pool_now() + delay);
+    }
+
+    return NULL;
+}
+
+/**
+ * Reads the monotonic clock in milliseconds.
+ *
+ * @return Current monotonic time in milliseconds.
+ */
+static long long pool_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/**
+ * Initializes a `PoolWorker` with room for `capacity` tasks in each of its queues.
+ *
+ * @param[out] worker    Pointer to the `PoolWorker` to initialize.
+ * @param[in]  pool      Pointer to the owning `Pool`.
+ * @param[in]  index     Index of the worker in the pool.
+ * @param[in]  capacity  Number of tasks the queues must be able to hold.
+ * @return               0 on success, -1 if memory could not be allocated.
+ */
+static int pool_worker_init(PoolWorker *worker, Pool *pool, int index, int capacity)
+{
+    if (capacity < 1)
+        capacity = 1;
+
+    worker->pool = pool;
+    worker->index = index;
+    worker->started = 0;
+    worker->numa_node = 0;
+    worker->ready_head = 0;
+    worker->ready_count = 0;
+    worker->timer_count = 0;
+    worker->capacity = capacity;
+
+    worker->ready = malloc(sizeof(System *) * capacity);
+    worker->timers = malloc(sizeof(PoolTimer) * capacity);
+    if (worker->ready == NULL || worker->timers == NULL)
+    {
+        perror("Failed to allocate memory for pool worker queues");
+        free(worker->ready);
+        free(worker->timers);
+        return -1;
+    }
+
+    sem_init(&worker->mutex, 0, 1);
+    sem_init(&worker->wakeup, 0, 0);
+    return 0;
+}
+
+/**
+ * Frees the queues of a `PoolWorker`.
+ *
+ * @param[in,out] worker  Pointer to the `PoolWorker` to clean.
+ */
+static void pool_worker_clean(PoolWorker *worker)
+{
+    sem_destroy(&worker->mutex);
+    sem_destroy(&worker->wakeup);
+    free(worker->ready);
+    free(worker->timers);
+    worker->ready = NULL;
+    worker->timers = NULL;
+}
+
+/**
+ * Appends a system to the bottom of a worker's ready deque.
+ *
+ * @param[in,out] worker  Pointer to the `PoolWorker`.
+ * @param[in]     system  Pointer to the `System` that is ready to tick.
+ */
+static void pool_push_ready(PoolWorker *worker, System *system)
+{
+    sem_wait(&worker->mutex);
+    worker->ready[(worker->ready_head + worker->ready_count) % worker->capacity] = system;
+    worker->ready_count++;
+    sem_post(&worker->mutex);
+}
+
+/**
+ * Takes a system out of a worker's ready deque.
+ *
+ * The owner takes from the bottom (most recently readied, still warm in its cache),
+ * thieves take from the top (the one that has waited longest).
+ *
+ * @param[in,out] worker  Pointer to the `PoolWorker` to take from.
+ * @param[in]     steal   Non-zero when called by another worker.
+ * @return                The system taken, or NULL if the deque was empty.
+ */
+static System *pool_take_ready(PoolWorker *worker, int steal)
+{
+    System *system = NULL;
+
+    sem_wait(&worker->mutex);
+    if (worker->ready_count > 0)
+    {
+        if (steal)
+        {
+            system = worker->ready[worker->ready_head];
+            worker->ready_head = (worker->ready_head + 1) % worker->capacity;
+        }
+        else
+        {
+            system = worker->ready[(worker->ready_head + worker->ready_count - 1) % worker->capacity];
+        }
+        worker->ready_count--;
+    }
+    sem_post(&worker->mutex);
+
+    return system;
+}
+
+/**
+ * Puts a system on a worker's timer heap until `due`.
+ *
+ * @param[in,out] worker  Pointer to the `PoolWorker`.
+ * @param[in]     system  Pointer to the `System` to re-queue.
+ * @param[in]     due     Monotonic time in milliseconds when the system wants its next tick.
+ */
+static void pool_push_timer(PoolWorker *worker, System *system, long long due)
+{
+    sem_wait(&worker->mutex);
+
+    int index = worker->timer_count++;
+    worker->timers[index].due = due;
+    worker->timers[index].system = system;
+
+    // Sift up to keep the earliest timer on top
+    while (index > 0)
+    {
+        int parent = (index - 1) / 2;
+        if (worker->timers[parent].due <= worker->timers[index].due)
+            break;
+        PoolTimer temp = worker->timers[parent];
+        worker->timers[parent] = worker->timers[index];
+        worker->timers[index] = temp;
+        index = parent;
+    }
+
+    sem_post(&worker->mutex);
+}
+
+/**
+ * Moves every timer due by `now` onto the worker's ready deque.
+ *
+ * @param[in,out] worker  Pointer to the `PoolWorker`.
+ * @param[in]     now     Current monotonic time in milliseconds.
+ * @return                Due time of the earliest timer left, or -1 if there is none.
+ */
+static long long pool_release_timers(PoolWorker *worker, long long now)
+{
+    long long next_due;
+
+    sem_wait(&worker->mutex);
+    while (worker->timer_count > 0 && worker->timers[0].due <= now)
+    {
+        worker->ready[(worker->ready_head + worker->ready_count) % worker->capacity] = worker->timers[0].system;
+        worker->ready_count++;
+
+        // Pop the top of the heap and sift the last entry down
+        worker->timers[0] = worker->timers[--worker->timer_count];
+        int index = 0;
+        while (1)
+        {
+            int smallest = index;
+            int left = index * 2 + 1;
+            int right = left + 1;
+            if (left < worker->timer_count && worker->timers[left].due < worker->timers[smallest].due)
+                smallest = left;
+            if (right < worker->timer_count && worker->timers[right].due < worker->timers[smallest].due)
+                smallest = right;
+            if (smallest == index)
+                break;
+            PoolTimer temp = worker->timers[smallest];
+            worker->timers[smallest] = worker->timers[index];
+            worker->timers[index] = temp;
+            index = smallest;
+        }
+    }
+    next_due = (worker->timer_count > 0) ? worker->timers[0].due : -1;
+    int surplus = worker->ready_count > 1;
+    sem_post(&worker->mutex);
+
+    // More work than this worker can start right now, nudge a neighbour to steal it
+    if (surplus && worker->pool->worker_count > 1)
+    {
+        sem_post(&worker->pool->workers[(worker->index + 1) % worker->pool->worker_count].wakeup);
+    }
+
+    return next_due;
+}
+
+/**
+ * Steals a ready system from another worker, visiting them starting after the thief.
+ *
+ * With an affinity, workers on the thief's node are visited first, so systems only leave
+ * their node when it has nothing left to steal.
+ *
+ * @param[in,out] pool   Pointer to the `Pool`.
+ * @param[in]     thief  Index of the worker looking for work.
+ * @return               The stolen system, or NULL if every other deque was empty.
+ */
+static System *pool_steal(Pool *pool, int thief)
+{
+    int node = pool->workers[thief].numa_node;
+
+    for (int remote = 0; remote <= (pool->affinity != NULL); remote++)
+    {
+        for (int n = 1; n < pool->worker_count; n++)
+        {
+            PoolWorker *victim = &pool->workers[(thief + n) % pool->worker_count];
+            if (pool->affinity != NULL && (victim->numa_node != node) != remote)
+                continue;
+            System *system = pool_take_ready(victim, 1);
+            if (system != NULL)
+                return system;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Picks the worker a system starts on and returns to when it is unparked.
+ *
+ * Systems are spread by id over the workers, only over those on the system's node when it
+ * was placed and the node has any.
+ *
+ * @param[in] pool    Pointer to the `Pool`.
+ * @param[in] system  Pointer to the `System`.
+ * @return            The home worker of the system.
+ */
+static PoolWorker *pool_home_worker(Pool *pool, const System *system)
+{
+    int local_count = 0;
+
+    if (pool->affinity != NULL && system->numa_node >= 0)
+    {
+        for (int i = 0; i < pool->worker_count; i++)
+            local_count += pool->workers[i].numa_node == system->numa_node;
+    }
+    if (local_count == 0)
+        return &pool->workers[system->id % pool->worker_count];
+
+    int skip = system->id % local_count;
+    for (int i = 0; i < pool->worker_count; i++)
+    {
+        if (pool->workers[i].numa_node != system->numa_node)
+            continue;
+        if (skip-- == 0)
+            return &pool->workers[i];
+    }
+    return &pool->workers[0];
+}
+
+/**
+ * Sleeps until `until`, or for `SYSTEM_WAIT_TIME` when there is no timer, unless woken early.
+ *
+ * @param[in,out] worker  Pointer to the idle `PoolWorker`.
+ * @param[in]     until   Monotonic time in milliseconds of the next timer, or -1 if none.
+ */
+static void pool_sleep(PoolWorker *worker, long long until)
+{
+    long long now = pool_now();
+    long long wait_ms = (until < 0) ? SYSTEM_WAIT_TIME : until - now;
+    if (wait_ms <= 0)
+        return;
+    if (wait_ms > SYSTEM_WAIT_TIME)
+        wait_ms = SYSTEM_WAIT_TIME; // Wake up now and then to look for work to steal
+
+    // sem_timedwait takes an absolute CLOCK_REALTIME deadline
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += wait_ms / 1000;
+    deadline.tv_nsec += (wait_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    while (sem_timedwait(&worker->wakeup, &deadline) != 0 && errno == EINTR)
+        ;
+}
@@ -2,87 +2,598 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <sched.h>
 
 /* Resource functions */
 
+static int resource_watch(const Resource *resource, int before, int after);
+static unsigned long long resource_begin(Resource *resource);
+static int resource_finish(Resource *resource, unsigned long long *word, unsigned long long next);
+static unsigned long long resource_lock(Resource *resource);
+static void resource_unlock(Resource *resource, unsigned long long word);
+#ifndef RESOURCE_USE_SEMAPHORE
+static unsigned long long resource_wait(const Resource *resource);
+#endif
+static unsigned long long resource_word(int amount, int reserved);
+static int resource_word_amount(unsigned long long word);
+static int resource_word_reserved(unsigned long long word);
+
 /**
  * Creates a new `Resource` object.
  *
- * Allocates memory for a new `Resource` and initializes its fields.
- * The `name` is dynamically allocated.
+ * Carves a new `Resource` and a copy of its name out of `arena` and initializes its fields.
+ * The memory is released all at once when the arena is cleaned.
  *
  * @param[out] resource      Pointer to the `Resource*` to be allocated and initialized.
  * @param[in]  name          Name of the resource (the string is copied).
  * @param[in]  amount        Initial amount of the resource.
  * @param[in]  max_capacity  Maximum capacity of the resource.
+ * @param[in]  arena         Pointer to the `Arena` owning the memory.
  */
-void resource_create(Resource **resource, const char *name, int amount, int max_capacity)
+void resource_create(Resource **resource, const char *name, int amount, int max_capacity, Arena *arena)
 {
     // allocate the memory
-    *resource = malloc(sizeof(Resource));
+    *resource = arena_alloc(arena, sizeof(Resource), _Alignof(Resource));
     if (*resource == NULL)
     {
-        perror("Failed to allocate memory for Resource struct");
         return;
     }
 
-    // allocate the memory for name and copy it
-    (*resource)->name = malloc(strlen(name) + 1);
-    if ((*resource)->name == NULL)
+    // copy the name next to it
+    char *copy = arena_strndup(arena, name, strlen(name));
+    if (copy == NULL || resource_init(*resource, copy, amount, max_capacity) != 0)
     {
-        perror("Failed to allocate memory for name");
-        free(*resource); //  for memory leak
+        *resource = NULL;
         return;
     }
-    strcpy((*resource)->name, name);
+}
 
-    (*resource)->amount = amount;
-    (*resource)->max_capacity = max_capacity;
+/**
+ * Initializes a `Resource` in memory owned by the caller.
+ *
+ * Used by `resource_create` and by loaders that allocate many resources in one block.
+ * The `name` is not copied, it must outlive the resource.
+ *
+ * @param[out] resource      Pointer to the `Resource` to initialize.
+ * @param[in]  name          Name of the resource.
+ * @param[in]  amount        Initial amount of the resource.
+ * @param[in]  max_capacity  Maximum capacity of the resource.
+ * @return                   0 on success, -1 if the mutex could not be initialized.
+ */
+int resource_init(Resource *resource, char *name, int amount, int max_capacity)
+{
+    resource->name = name;
+    resource->id = -1; // Assigned when the resource is added to a ResourceArray
+    atomic_init(&resource->local_amount.value, resource_word(amount, 0));
+    resource->amount = &resource->local_amount.value; // Moved into a ResourceTable by resource_table_build
+    resource->max_capacity = max_capacity;
+    resource->low_threshold = (int)(THRESHOLD_RESOURCE_LOW * max_capacity);
+    resource->flags = 0;
+    resource->event_queue = NULL;
+    resource->numa_node = -1;
 
     // Initialize the semaphore with an initial value of 1
-    if (sem_init(&(*resource)->mutex, 0, 1) != 0)
+    if (sem_init(&resource->mutex, 0, 1) != 0)
     {
         perror("Failed to initialize resource mutex");
-        free((*resource)->name);
-        free(*resource);
-        *resource = NULL;
-        return;
+        return -1;
     }
 
-    return;
+    return 0;
 }
 
 /**
  * Destroys a `Resource` object.
  *
- * Frees all memory associated with the `Resource`.
+ * Releases the semaphore of the `Resource`. Its memory belongs to the arena it was
+ * created from and is freed with it.
  *
  * @param[in,out] resource  Pointer to the `Resource` to be destroyed.
  */
 void resource_destroy(Resource *resource)
 {
-    if (resource != NULL)
+    if (resource == NULL)
+        return;
+
+    // Destroy the semaphore
+    sem_destroy(&resource->mutex);
+}
+
+/**
+ * Reads the current amount of a `Resource`.
+ *
+ * The amount is atomic, so no lock is needed to read a consistent value. While a multi-input
+ * consumer holds the resource, this is the amount from before it started.
+ *
+ * @param[in] resource  Pointer to the `Resource`.
+ * @return              The amount currently held by the resource.
+ */
+int resource_get_amount(Resource *resource)
+{
+    return resource_word_amount(atomic_load_explicit(resource->amount, memory_order_acquire));
+}
+
+/**
+ * Sets the amount of a `Resource` and drops its reservations.
+ *
+ * Only for loaders and replays, while no system runs.
+ *
+ * @param[in,out] resource  Pointer to the `Resource`.
+ * @param[in]     amount    New amount, between 0 and the capacity.
+ */
+void resource_set_amount(Resource *resource, int amount)
+{
+    atomic_store(resource->amount, resource_word(amount, 0));
+}
+
+/**
+ * Takes `amount` units out of a `Resource`, all or nothing.
+ *
+ * Uses a compare-and-swap loop so concurrent consumers and producers never block each other.
+ * The word replaced by the successful compare-and-swap holds exactly the amount before this
+ * call, so only the one consumer that actually crosses the low threshold sees the crossing.
+ * Building with `RESOURCE_USE_SEMAPHORE` falls back to taking the resource's mutex instead.
+ *
+ * @param[in,out] resource  Pointer to the `Resource` to consume from.
+ * @param[in]     amount    Number of units required.
+ * @param[out]    crossed   Set to `STATUS_LOW` if this call took the resource below its low threshold, `STATUS_OK` otherwise.
+ * @return                  `STATUS_OK` if consumed, `STATUS_EMPTY` or `STATUS_INSUFFICIENT` otherwise.
+ */
+int resource_consume(Resource *resource, int amount, int *crossed)
+{
+    unsigned long long word = resource_begin(resource);
+    int current, status;
+
+    do
+    {
+        current = resource_word_amount(word);
+        status = (current >= amount) ? STATUS_OK : (current == 0) ? STATUS_EMPTY : STATUS_INSUFFICIENT;
+        // On failure `word` is reloaded with the value another thread wrote
+    } while (!resource_finish(resource, &word, (status == STATUS_OK) ? word - amount : word));
+
+    *crossed = (status == STATUS_OK) ? resource_watch(resource, current, current - amount) : STATUS_OK;
+    return status;
+}
+
+/**
+ * Stores as much of `*amount_stored` into a `Resource` as its capacity allows.
+ *
+ * The part that fits is added to the resource and the remainder is left in `*amount_stored`,
+ * using a compare-and-swap loop (or the resource's mutex with `RESOURCE_USE_SEMAPHORE`).
+ *
+ * Capacity reserved by producers still processing does not count as free.
+ *
+ * @param[in,out] resource       Pointer to the `Resource` to store into.
+ * @param[in,out] amount_stored  Units waiting to be stored, updated with the amount that did not fit.
+ * @param[out]    crossed        Set to `STATUS_CAPACITY` if this call filled the resource, `STATUS_PRODUCED` if
+ *                               it was empty before, `STATUS_OK` otherwise.
+ * @return                       `STATUS_OK` if everything was stored, `STATUS_CAPACITY` otherwise.
+ */
+int resource_store(Resource *resource, int *amount_stored, int *crossed)
+{
+    return resource_commit(resource, 0, amount_stored, crossed);
+}
+
+/**
+ * Stores the output of a producer that reserved `reserved` units of it with `resource_reserve`.
+ *
+ * The reserved units turn into amount in the same update that stores as much of the rest as
+ * the unreserved capacity allows, so the reserved part always fits. With `reserved` 0 this is
+ * `resource_store`.
+ *
+ * @param[in,out] resource       Pointer to the `Resource` to store into.
+ * @param[in]     reserved       Units the caller reserved, at most `*amount_stored`.
+ * @param[in,out] amount_stored  Units waiting to be stored, updated with the amount that did not fit.
+ * @param[out]    crossed        Set to `STATUS_CAPACITY` if this call filled the resource, `STATUS_PRODUCED` if
+ *                               it was empty before, `STATUS_OK` otherwise.
+ * @return                       `STATUS_OK` if everything was stored, `STATUS_CAPACITY` otherwise.
+ */
+int resource_commit(Resource *resource, int reserved, int *amount_stored, int *crossed)
+{
+    int amount_to_store = *amount_stored - reserved;
+    unsigned long long moved = (unsigned long long)reserved << RESOURCE_RESERVED_SHIFT;
+    unsigned long long word = resource_begin(resource);
+    int current, stored;
+
+    do
+    {
+        // Store everything if it fits, otherwise as much as possible
+        current = resource_word_amount(word);
+        int available_space = resource->max_capacity - current - resource_word_reserved(word);
+        stored = (available_space >= amount_to_store) ? amount_to_store : (available_space > 0 ? available_space : 0);
+    } while (!resource_finish(resource, &word, word - moved + reserved + stored));
+
+    *crossed = resource_watch(resource, current, current + reserved + stored);
+    *amount_stored = amount_to_store - stored;
+    return (*amount_stored == 0) ? STATUS_OK : STATUS_CAPACITY;
+}
+
+/**
+ * Consumes every `ResourceAmount` in `amounts`, or none of them.
+ *
+ * The involved resources are locked in increasing `id` order, which is the same global order
+ * for every caller, so systems reserving several inputs can neither deadlock nor keep knocking
+ * each other's reservations back. Every input is checked while all of them are held, and only
+ * then are the new amounts written, so nothing is ever taken and given back. Single-resource
+ * consumers and producers wait for the lock instead of updating a held resource.
+ *
+ * @param[in]  amounts       Array of resources and the amount required of each.
+ * @param[in]  count         Number of entries in `amounts`, at most `SYSTEM_MAX_RESOURCES`.
+ * @param[out] failed_index  Set to the index in `amounts` of the first missing input on failure.
+ * @param[out] crossed       Receives, for each entry of `amounts`, `STATUS_LOW` if it took its resource below the low
+ *                           threshold. A resource listed twice reports on its first entry.
+ * @return                   `STATUS_OK` if all were consumed, `STATUS_EMPTY` or `STATUS_INSUFFICIENT` otherwise.
+ */
+int resource_consume_all(const ResourceAmount *amounts, int count, int *failed_index, int *crossed)
+{
+    int order[SYSTEM_MAX_RESOURCES];
+    int first[SYSTEM_MAX_RESOURCES];                // Entry holding the lock of each entry's resource
+    unsigned long long held[SYSTEM_MAX_RESOURCES]; // Word when locked, kept by the entry holding the lock
+    int left[SYSTEM_MAX_RESOURCES];                 // Amount once the entries checked so far are taken
+    int status = STATUS_OK;
+
+    // Insertion sort of the indexes by resource id, count is tiny
+    for (int i = 0; i < count; i++)
     {
-        // Free the dynamically allocated name field
-        if (resource->name != NULL)
+        crossed[i] = STATUS_OK;
+        int j = i;
+        while (j > 0 && amounts[order[j - 1]].resource->id > amounts[i].resource->id)
         {
-            free(resource->name);
+            order[j] = order[j - 1];
+            j--;
         }
-        else
+        order[j] = i;
+    }
+
+    // Lock in global order, a resource listed twice is only locked once
+    for (int i = 0; i < count; i++)
+    {
+        int entry = order[i];
+        if (i > 0 && amounts[entry].resource == amounts[order[i - 1]].resource)
         {
-            return;
+            first[entry] = first[order[i - 1]];
+            continue;
+        }
+        first[entry] = entry;
+        held[entry] = resource_lock(amounts[entry].resource);
+        left[entry] = resource_word_amount(held[entry]);
+    }
+
+    // Check every input before anything is taken
+    for (int i = 0; i < count; i++)
+    {
+        int holder = first[i];
+        if (left[holder] < amounts[i].amount)
+        {
+            status = (resource_word_amount(held[holder]) == 0) ? STATUS_EMPTY : STATUS_INSUFFICIENT;
+            *failed_index = i;
+            break;
         }
+        left[holder] -= amounts[i].amount;
+    }
+
+    // Unlock in reverse order, writing the new amounts only if everything was there
+    for (int i = count - 1; i >= 0; i--)
+    {
+        int entry = order[i];
+        if (first[entry] != entry)
+            continue;
+        int before = resource_word_amount(held[entry]);
+        int after = (status == STATUS_OK) ? left[entry] : before;
+        resource_unlock(amounts[entry].resource, held[entry] - before + after);
+        crossed[entry] = resource_watch(amounts[entry].resource, before, after);
+    }
+
+    return status;
+}
+
+/**
+ * Consumes the inputs of as many identical conversions as are available, up to `*units`.
+ *
+ * Used by system groups: the number of conversions every input can supply is worked out
+ * first, and then the whole lot is taken with a single update per resource, the same way
+ * `resource_consume` and `resource_consume_all` take one conversion. If another consumer
+ * wins the race in between, nothing is taken and the group retries later.
+ *
+ * @param[in]     amounts       Array of resources and the amount one conversion requires of each.
+ * @param[in]     count         Number of entries in `amounts`, at most `SYSTEM_MAX_RESOURCES`.
+ * @param[in,out] units         Conversions wanted, set to the number reserved (0 on failure).
+ * @param[out]    failed_index  Set to the index in `amounts` of the input that limited the group.
+ * @param[out]    crossed       Receives, for each entry of `amounts`, `STATUS_LOW` if it took its resource below the low threshold.
+ * @return                      `STATUS_OK` if at least one conversion was reserved, `STATUS_EMPTY` or `STATUS_INSUFFICIENT` otherwise.
+ */
+int resource_consume_units(const ResourceAmount *amounts, int count, int *units, int *failed_index, int *crossed)
+{
+    ResourceAmount scaled[SYSTEM_MAX_RESOURCES];
+    int wanted = *units;
+    int status;
 
-        // Destroy the semaphore
-        sem_destroy(&resource->mutex);
+    *failed_index = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (amounts[i].amount <= 0)
+            continue;
+        int available = resource_get_amount(amounts[i].resource) / amounts[i].amount;
+        if (available < wanted)
+        {
+            wanted = available;
+            *failed_index = i;
+        }
+    }
 
-        // Free the Resource structure itself
-        free(resource);
+    if (wanted <= 0)
+    {
+        *units = 0;
+        return (resource_get_amount(amounts[*failed_index].resource) == 0) ? STATUS_EMPTY : STATUS_INSUFFICIENT;
     }
+
+    for (int i = 0; i < count; i++)
+        resource_amount_init(&scaled[i], amounts[i].resource, amounts[i].amount * wanted);
+
+    if (count == 1)
+        status = resource_consume(scaled[0].resource, scaled[0].amount, &crossed[0]);
     else
+        status = resource_consume_all(scaled, count, failed_index, crossed);
+
+    *units = (status == STATUS_OK) ? wanted : 0;
+    return status;
+}
+
+/**
+ * Reserves up to `amount` units of free capacity in a `Resource`.
+ *
+ * Reserved capacity is left alone by every `resource_store`, so a producer that reserves
+ * before converting knows its output will fit, and stores it with `resource_commit`. The
+ * reservation and the amount share one word, so stores and reservations racing each other
+ * never promise more than the capacity.
+ *
+ * @param[in,out] resource  Pointer to the `Resource`.
+ * @param[in]     amount    Units wanted.
+ * @return                  Units reserved, less than `amount` if the resource is nearly full, 0 if it is full.
+ */
+int resource_reserve(Resource *resource, int amount)
+{
+    unsigned long long word = resource_begin(resource);
+    int taken;
+
+    do
     {
+        int free_space = resource->max_capacity - resource_word_amount(word) - resource_word_reserved(word);
+        taken = (free_space >= amount) ? amount : (free_space > 0 ? free_space : 0);
+    } while (!resource_finish(resource, &word, word + ((unsigned long long)taken << RESOURCE_RESERVED_SHIFT)));
+
+    return taken;
+}
+
+/**
+ * Gives back capacity reserved with `resource_reserve`.
+ *
+ * @param[in,out] resource  Pointer to the `Resource`.
+ * @param[in]     amount    Units to give back, at most what the caller reserved.
+ */
+void resource_release(Resource *resource, int amount)
+{
+    if (amount <= 0)
         return;
+
+    unsigned long long word = resource_begin(resource);
+    while (!resource_finish(resource, &word, word - ((unsigned long long)amount << RESOURCE_RESERVED_SHIFT)))
+        ;
+}
+
+/**
+ * Watches an update of a `Resource` for threshold crossings.
+ *
+ * Only the update that moves the amount across a threshold reports it, so every crossing is
+ * seen exactly once no matter how many systems share the resource.
+ *
+ * @param[in] resource  Pointer to the updated `Resource`.
+ * @param[in] before    Amount before the update.
+ * @param[in] after     Amount after the update.
+ * @return              `STATUS_LOW` when dropping below the low threshold, `STATUS_CAPACITY`
+ *                      when reaching the capacity, `STATUS_PRODUCED` when it stops being
+ *                      empty, `STATUS_OK` otherwise.
+ */
+static int resource_watch(const Resource *resource, int before, int after)
+{
+    if (before >= resource->low_threshold && after < resource->low_threshold)
+        return STATUS_LOW;
+    if (before < resource->max_capacity && after >= resource->max_capacity)
+        return STATUS_CAPACITY;
+    if (before == 0 && after > 0)
+        return STATUS_PRODUCED;
+    return STATUS_OK;
+}
+
+
+/**
+ * Loads the word of a `Resource` to start an update with `resource_finish`.
+ *
+ * Waits while a multi-input consumer holds the resource. Building with
+ * `RESOURCE_USE_SEMAPHORE` takes the resource's mutex until the update is finished.
+ *
+ * @param[in,out] resource  Pointer to the `Resource` to update.
+ * @return                  The current word of the resource.
+ */
+static unsigned long long resource_begin(Resource *resource)
+{
+#ifdef RESOURCE_USE_SEMAPHORE
+    return resource_lock(resource);
+#else
+    unsigned long long word = atomic_load_explicit(resource->amount, memory_order_relaxed);
+    return (word & RESOURCE_LOCKED) ? resource_wait(resource) : word;
+#endif
+}
+
+/**
+ * Replaces the word of a `Resource` loaded by `resource_begin` with `next`.
+ *
+ * The compare-and-swap fails if another thread changed the word meanwhile, `*word` then holds
+ * the new one to work out `next` again from. An unchanged word is not written at all.
+ *
+ * @param[in,out] resource  Pointer to the `Resource` being updated.
+ * @param[in,out] word      Word the update was worked out from, reloaded on failure.
+ * @param[in]     next      Word to write.
+ * @return                  1 once the update is done, 0 to retry it.
+ */
+static int resource_finish(Resource *resource, unsigned long long *word, unsigned long long next)
+{
+#ifdef RESOURCE_USE_SEMAPHORE
+    (void)word;
+    resource_unlock(resource, next);
+    return 1;
+#else
+    if (next == *word ||
+        atomic_compare_exchange_weak_explicit(resource->amount, word, next, memory_order_acq_rel, memory_order_relaxed))
+        return 1;
+    if (*word & RESOURCE_LOCKED)
+        *word = resource_wait(resource);
+    return 0;
+#endif
+}
+
+/**
+ * Locks the word of a `Resource` against every other update, recording how long it had to
+ * wait in INSTRUMENT builds.
+ *
+ * Sets `RESOURCE_LOCKED` in the word itself, which every compare-and-swap on it waits for.
+ * Building with `RESOURCE_USE_SEMAPHORE` takes the resource's mutex instead, which every
+ * other update takes as well.
+ *
+ * @param[in,out] resource  Pointer to the `Resource` to lock.
+ * @return                  The word of the resource, which stays put until `resource_unlock`.
+ */
+static unsigned long long resource_lock(Resource *resource)
+{
+    STATS_START(start);
+#ifdef RESOURCE_USE_SEMAPHORE
+    sem_wait(&resource->mutex);
+    unsigned long long word = atomic_load_explicit(resource->amount, memory_order_relaxed);
+#else
+    unsigned long long word = atomic_load_explicit(resource->amount, memory_order_relaxed);
+    do
+    {
+        if (word & RESOURCE_LOCKED)
+            word = resource_wait(resource);
+    } while (!atomic_compare_exchange_weak_explicit(resource->amount, &word, word | RESOURCE_LOCKED,
+                                                    memory_order_acquire, memory_order_relaxed));
+#endif
+    STATS_RECORD(STATS_LOCK_WAIT, start);
+    return word;
+}
+
+/**
+ * Writes the new word of a `Resource` locked with `resource_lock` and unlocks it.
+ *
+ * @param[in,out] resource  Pointer to the locked `Resource`.
+ * @param[in]     word      Word to leave in the resource, without `RESOURCE_LOCKED`.
+ */
+static void resource_unlock(Resource *resource, unsigned long long word)
+{
+#ifdef RESOURCE_USE_SEMAPHORE
+    atomic_store_explicit(resource->amount, word, memory_order_relaxed);
+    sem_post(&resource->mutex);
+#else
+    atomic_store_explicit(resource->amount, word, memory_order_release);
+#endif
+}
+
+#ifndef RESOURCE_USE_SEMAPHORE
+/**
+ * Waits for a multi-input consumer to unlock a `Resource`.
+ *
+ * The lock is only held while a handful of amounts are checked and written, so the waiting
+ * thread just yields until it is gone.
+ *
+ * @param[in] resource  Pointer to the `Resource`.
+ * @return              The unlocked word, to retry the compare-and-swap with.
+ */
+static unsigned long long resource_wait(const Resource *resource)
+{
+    unsigned long long word;
+    while ((word = atomic_load_explicit(resource->amount, memory_order_relaxed)) & RESOURCE_LOCKED)
+        sched_yield();
+    return word;
+}
+#endif
+
+/**
+ * Packs an amount and a reservation into the word of a `Resource`.
+ *
+ * @param[in] amount    Units held, between 0 and the capacity.
+ * @param[in] reserved  Units reserved, at most the capacity left free by `amount`.
+ * @return              The packed word, unlocked.
+ */
+static unsigned long long resource_word(int amount, int reserved)
+{
+    return (unsigned long long)amount | ((unsigned long long)reserved << RESOURCE_RESERVED_SHIFT);
+}
+
+/**
+ * Unpacks the amount from the word of a `Resource`.
+ *
+ * @param[in] word  Word of the resource.
+ * @return          Units held.
+ */
+static int resource_word_amount(unsigned long long word)
+{
+    return (int)(word & RESOURCE_FIELD_MASK);
+}
+
+/**
+ * Unpacks the reservations from the word of a `Resource`.
+ *
+ * @param[in] word  Word of the resource.
+ * @return          Units reserved.
+ */
+static int resource_word_reserved(unsigned long long word)
+{
+    return (int)((word >> RESOURCE_RESERVED_SHIFT) & RESOURCE_FIELD_MASK);
+}
+
+/* ResourceTable functions */
+
+/**
+ * Initializes an empty `ResourceTable`.
+ *
+ * @param[out] table  Pointer to the `ResourceTable` to initialize.
+ */
+void resource_table_init(ResourceTable *table)
+{
+    table->amounts = NULL;
+    table->size = 0;
+}
+
+/**
+ * Moves the amounts of every resource into one contiguous `ResourceTable`.
+ *
+ * The amounts are indexed by resource id and each sits on its own cache line, so producers
+ * and consumers of different resources never share one. Each `Resource` keeps working as a
+ * handle: its `amount` pointer is redirected into the table. Must be called before the
+ * simulation starts.
+ *
+ * @param[in,out] table      Pointer to an empty `ResourceTable`.
+ * @param[in,out] resources  Pointer to the `ResourceArray` holding every resource.
+ * @param[in]     arena      Pointer to the `Arena` owning the table memory.
+ */
+void resource_table_build(ResourceTable *table, ResourceArray *resources, Arena *arena)
+{
+    int count = resources->size;
+
+    table->amounts = arena_alloc(arena, sizeof(ResourceCounter) * ALLOC_COUNT(count), CACHE_LINE_SIZE);
+    if (table->amounts == NULL)
+    {
+        resource_table_init(table);
+        return;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        Resource *resource = resources->resources[i];
+        atomic_init(&table->amounts[i].value, atomic_load_explicit(resource->amount, memory_order_relaxed));
+        resource->amount = &table->amounts[i].value;
     }
+    table->size = count;
 }
 
 /* ResourceAmount functions */
@@ -128,7 +639,7 @@ void resource_array_init(ResourceArray *array)
  * Cleans up the `ResourceArray` by destroying all resources and freeing memory.
  *
  * Iterates through the array, calls `resource_destroy` on each `Resource`,
- * and frees the array memory.
+ * and frees the array memory. The resources themselves are freed with their arena.
  *
  * @param[in,out] array  Pointer to the `ResourceArray` to clean.
  */
@@ -186,7 +697,8 @@ void resource_array_add(ResourceArray *array, Resource *resource)
         array->capacity = new_capacity;
     }
 
-    // Add the new resource to the end of the array
+    // Add the new resource to the end of the array, its index doubles as its id
+    resource->id = array->size;
     array->resources[array->size] = resource;
     // increase the size of the array to reflect the added resource
     array->size++;
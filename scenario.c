@@ -0,0 +1,555 @@
+#include "defs.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * Scenario files describe resources and systems one per line:
+ *
+ *     # comment
+ *     resource <name> <amount> <max_capacity> [life_support] [destination]
+ *     system <name> <processing_time> [count <members>] [reserve] [consume <resource> <amount>]... [produce <resource> <amount>]...
+ *     rule <resource> <empty|low|insufficient|capacity|produced> <terminate|fast|slow|standard|disable|enable> [hold <ms>]
+ *
+ * `life_support` ends the simulation when the resource runs out and `destination` ends it
+ * when the resource reaches its capacity. `count` makes the system a group of that many
+ * identical members ticked together, e.g. a whole crew. `reserve` makes the system reserve
+ * room for its outputs before it takes its inputs. Names containing spaces are written in double quotes. A resource must be declared
+ * before the first system or rule that uses it, with a capacity of at least 1 and an amount no larger than it. What
+ * all members of a system consume or produce of a resource in one conversion must fit in its capacity.
+ *
+ * Without rules the manager reacts to the events of a resource as it always did, see
+ * `manager_default_rule`. The rules of a resource and status replace that reaction and run
+ * in file order. `fast`, `slow` and `standard` change the speed of the producers of the
+ * resource, which then keep it for `hold` milliseconds (default `RULE_DEFAULT_HOLD`).
+ * `disable` parks the consumers of an empty resource and `enable` brings them back.
+ */
+
+// A slice of the mapped file, not null terminated
+typedef struct Token
+{
+    const char *start;
+    int length;
+} Token;
+
+// Cursor over the mapped file
+typedef struct Reader
+{
+    const char *data;
+    size_t size;
+    size_t position;
+    int line;
+    const char *path;
+} Reader;
+
+// Blocks holding every resource, system and name of the scenario, carved from the manager's arena
+typedef struct ScenarioBlocks
+{
+    Resource *resources;
+    int resource_count;
+    System *systems;
+    int system_count;
+    char *names; // Interned names, each stored once
+    size_t names_used;
+} ScenarioBlocks;
+
+// Open addressing table interning names into the scenario's name block
+typedef struct InternTable
+{
+    char **names;     // Interned string for each slot, NULL if the slot is free
+    int *resource_id; // Index in the resource block, -1 if the name is only used by systems
+    int capacity;     // Power of two
+} InternTable;
+
+static int scenario_next_line(Reader *reader);
+static int scenario_next_token(Reader *reader, Token *token);
+static int scenario_token_is(const Token *token, const char *word);
+static int scenario_token_int(Reader *reader, const Token *token, int *value);
+static int scenario_token_find(const Token *token, const char *const *words, int count);
+static int intern_init(InternTable *table, int entries);
+static int intern_lookup(InternTable *table, ScenarioBlocks *scenario, const Token *token, int insert);
+
+/**
+ * Loads a scenario file into the `Manager`.
+ *
+ * The file is memory-mapped and scanned twice: once to count the resources, systems and
+ * name bytes, then to build them. All resources, all systems and all names are each carved
+ * from one block of the manager's arena instead of one allocation per object, and identical
+ * names are stored once. On failure the entities already added stay in the manager and go
+ * away with `manager_clean`.
+ *
+ * @param[in,out] manager  Pointer to an initialized, empty `Manager`.
+ * @param[in]     path     Path of the scenario file.
+ * @return                 0 on success, -1 if the file could not be read or parsed.
+ */
+int scenario_load(Manager *manager, const char *path)
+{
+    ScenarioBlocks blocks;
+    ScenarioBlocks *scenario = &blocks;
+    Reader reader;
+    Token token;
+    InternTable table = {NULL, NULL, 0};
+    struct stat info;
+    int result = -1;
+    int resource_count = 0, system_count = 0;
+    size_t name_bytes = 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        perror("Failed to open scenario file");
+        return -1;
+    }
+    if (fstat(fd, &info) != 0 || info.st_size == 0)
+    {
+        fprintf(stderr, "%s: empty or unreadable scenario file\n", path);
+        close(fd);
+        return -1;
+    }
+
+    char *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        perror("Failed to map scenario file");
+        return -1;
+    }
+    madvise(data, info.st_size, MADV_SEQUENTIAL);
+
+    // First pass, count everything so the blocks can be allocated once
+    reader = (Reader){data, (size_t)info.st_size, 0, 0, path};
+    while (scenario_next_line(&reader))
+    {
+        if (!scenario_next_token(&reader, &token))
+            continue;
+        if (scenario_token_is(&token, "resource"))
+            resource_count++;
+        else if (scenario_token_is(&token, "system"))
+            system_count++;
+        else
+            continue;
+
+        // Every name on the line fits in the line itself
+        Token name;
+        while (scenario_next_token(&reader, &name))
+            name_bytes += name.length + 1;
+    }
+
+    scenario->resources =
+        arena_alloc(&manager->arena, sizeof(Resource) * ALLOC_COUNT(resource_count), _Alignof(Resource));
+    scenario->systems = arena_alloc(&manager->arena, sizeof(System) * ALLOC_COUNT(system_count), _Alignof(System));
+    scenario->names = arena_alloc(&manager->arena, name_bytes + 1, 1);
+    scenario->names_used = 0;
+    scenario->resource_count = 0;
+    scenario->system_count = 0;
+    if (scenario->resources == NULL || scenario->systems == NULL || scenario->names == NULL ||
+        intern_init(&table, resource_count + system_count) != 0)
+    {
+        fprintf(stderr, "%s: not enough memory for the scenario\n", path);
+        goto done;
+    }
+
+    // Second pass, build the resources and systems in place
+    reader = (Reader){data, (size_t)info.st_size, 0, 0, path};
+    while (scenario_next_line(&reader))
+    {
+        Token name;
+        if (!scenario_next_token(&reader, &token))
+            continue; // Blank or comment line
+
+        if (scenario_token_is(&token, "resource"))
+        {
+            Token amount_token, capacity_token;
+            int amount, max_capacity;
+            if (!scenario_next_token(&reader, &name) || !scenario_next_token(&reader, &amount_token) ||
+                !scenario_next_token(&reader, &capacity_token))
+            {
+                fprintf(stderr, "%s:%d: expected resource <name> <amount> <max_capacity>\n", path, reader.line);
+                goto done;
+            }
+            if (scenario_token_int(&reader, &amount_token, &amount) != 0 ||
+                scenario_token_int(&reader, &capacity_token, &max_capacity) != 0)
+                goto done;
+            if (max_capacity < 1)
+            {
+                fprintf(stderr, "%s:%d: resource %.*s needs a capacity of at least 1\n", path, reader.line, name.length,
+                        name.start);
+                goto done;
+            }
+            if (amount > max_capacity)
+            {
+                fprintf(stderr, "%s:%d: resource %.*s starts with %d, more than its capacity of %d\n", path, reader.line,
+                        name.length, name.start, amount, max_capacity);
+                goto done;
+            }
+
+            int slot = intern_lookup(&table, scenario, &name, 1);
+            if (table.resource_id[slot] >= 0)
+            {
+                fprintf(stderr, "%s:%d: resource %s declared twice\n", path, reader.line, table.names[slot]);
+                goto done;
+            }
+
+            Resource *resource = &scenario->resources[scenario->resource_count];
+            if (resource_init(resource, table.names[slot], amount, max_capacity) != 0)
+                goto done;
+
+            Token flag;
+            while (scenario_next_token(&reader, &flag))
+            {
+                if (scenario_token_is(&flag, "life_support"))
+                    resource->flags |= RESOURCE_FLAG_LIFE_SUPPORT;
+                else if (scenario_token_is(&flag, "destination"))
+                    resource->flags |= RESOURCE_FLAG_DESTINATION;
+                else
+                {
+                    fprintf(stderr, "%s:%d: unknown resource flag %.*s\n", path, reader.line, flag.length, flag.start);
+                    resource_destroy(resource);
+                    goto done;
+                }
+            }
+            table.resource_id[slot] = scenario->resource_count++;
+            resource_array_add(&manager->resource_array, resource);
+        }
+        else if (scenario_token_is(&token, "system"))
+        {
+            ResourceAmount consumed[SYSTEM_MAX_RESOURCES], produced[SYSTEM_MAX_RESOURCES];
+            int consumed_count = 0, produced_count = 0, processing_time, member_count = 1, reserve_outputs = 0;
+            Token time_token, keyword;
+
+            if (!scenario_next_token(&reader, &name) || !scenario_next_token(&reader, &time_token))
+            {
+                fprintf(stderr, "%s:%d: expected system <name> <processing_time> ...\n", path, reader.line);
+                goto done;
+            }
+            if (scenario_token_int(&reader, &time_token, &processing_time) != 0)
+                goto done;
+
+            // An optional `count <members>`, `reserve` and any number of `consume <resource> <amount>` and `produce <resource> <amount>` clauses
+            while (scenario_next_token(&reader, &keyword))
+            {
+                Token resource_token, amount_token;
+                int amount, is_consume = scenario_token_is(&keyword, "consume");
+                if (scenario_token_is(&keyword, "count"))
+                {
+                    Token count_token;
+                    if (!scenario_next_token(&reader, &count_token) ||
+                        scenario_token_int(&reader, &count_token, &member_count) != 0 || member_count < 1)
+                    {
+                        fprintf(stderr, "%s:%d: expected a positive <members> after count\n", path, reader.line);
+                        goto done;
+                    }
+                    continue;
+                }
+                if (scenario_token_is(&keyword, "reserve"))
+                {
+                    reserve_outputs = 1;
+                    continue;
+                }
+                if (!is_consume && !scenario_token_is(&keyword, "produce"))
+                {
+                    fprintf(stderr, "%s:%d: expected consume or produce, found %.*s\n", path, reader.line, keyword.length, keyword.start);
+                    goto done;
+                }
+                if (!scenario_next_token(&reader, &resource_token) || !scenario_next_token(&reader, &amount_token) ||
+                    scenario_token_int(&reader, &amount_token, &amount) != 0)
+                {
+                    fprintf(stderr, "%s:%d: expected <resource> <amount> after %.*s\n", path, reader.line, keyword.length, keyword.start);
+                    goto done;
+                }
+
+                int slot = intern_lookup(&table, scenario, &resource_token, 0);
+                if (slot < 0 || table.resource_id[slot] < 0)
+                {
+                    fprintf(stderr, "%s:%d: unknown resource %.*s\n", path, reader.line, resource_token.length, resource_token.start);
+                    goto done;
+                }
+
+                int *count = is_consume ? &consumed_count : &produced_count;
+                if (*count >= SYSTEM_MAX_RESOURCES)
+                {
+                    fprintf(stderr, "%s:%d: more than %d resources to %.*s\n", path, reader.line, SYSTEM_MAX_RESOURCES, keyword.length, keyword.start);
+                    goto done;
+                }
+                resource_amount_init(is_consume ? &consumed[*count] : &produced[*count],
+                                     &scenario->resources[table.resource_id[slot]], amount);
+                (*count)++;
+            }
+
+            // A whole group converts at once, what it moves must fit in the resource, and in an int on the way
+            for (int i = 0; i < consumed_count + produced_count; i++)
+            {
+                const ResourceAmount *link = (i < consumed_count) ? &consumed[i] : &produced[i - consumed_count];
+                if ((long long)link->amount * member_count > link->resource->max_capacity)
+                {
+                    fprintf(stderr, "%s:%d: system %.*s moves %lld %s per conversion, more than its capacity of %d\n", path,
+                            reader.line, name.length, name.start, (long long)link->amount * member_count,
+                            link->resource->name, link->resource->max_capacity);
+                    goto done;
+                }
+            }
+
+            int slot = intern_lookup(&table, scenario, &name, 1);
+            System *system = &scenario->systems[scenario->system_count++];
+            system_init(system, table.names[slot], consumed, consumed_count, produced, produced_count, processing_time, &manager->event_queue);
+            system->member_count = member_count;
+            system->reserve_outputs = reserve_outputs;
+            system_array_add(&manager->system_array, system);
+        }
+        else if (scenario_token_is(&token, "rule"))
+        {
+            static const char *const status_names[] = {"empty", "low", "insufficient", "capacity", "produced"};
+            static const int statuses[] = {STATUS_EMPTY, STATUS_LOW, STATUS_INSUFFICIENT, STATUS_CAPACITY, STATUS_PRODUCED};
+            static const char *const action_names[RULE_ACTION_COUNT] = {"terminate", "fast", "slow", "standard", "disable", "enable"};
+            Token status_token, action_token, keyword;
+            int hold_ms = RULE_DEFAULT_HOLD;
+
+            if (!scenario_next_token(&reader, &name) || !scenario_next_token(&reader, &status_token) ||
+                !scenario_next_token(&reader, &action_token))
+            {
+                fprintf(stderr, "%s:%d: expected rule <resource> <status> <action>\n", path, reader.line);
+                goto done;
+            }
+
+            int slot = intern_lookup(&table, scenario, &name, 0);
+            if (slot < 0 || table.resource_id[slot] < 0)
+            {
+                fprintf(stderr, "%s:%d: unknown resource %.*s\n", path, reader.line, name.length, name.start);
+                goto done;
+            }
+            int status = scenario_token_find(&status_token, status_names, 5);
+            int action = scenario_token_find(&action_token, action_names, RULE_ACTION_COUNT);
+            if (status < 0 || action < 0)
+            {
+                fprintf(stderr, "%s:%d: unknown rule %.*s %.*s\n", path, reader.line, status_token.length,
+                        status_token.start, action_token.length, action_token.start);
+                goto done;
+            }
+
+            if (scenario_next_token(&reader, &keyword))
+            {
+                Token hold_token;
+                if (!scenario_token_is(&keyword, "hold") || !scenario_next_token(&reader, &hold_token) ||
+                    scenario_token_int(&reader, &hold_token, &hold_ms) != 0 || hold_ms < 0)
+                {
+                    fprintf(stderr, "%s:%d: expected hold <ms> after the rule action\n", path, reader.line);
+                    goto done;
+                }
+            }
+
+            if (manager_add_rule(manager, &scenario->resources[table.resource_id[slot]], statuses[status], action, hold_ms) != 0)
+            {
+                fprintf(stderr, "%s:%d: more than %d rules for %s %.*s\n", path, reader.line, RULE_MAX_ACTIONS,
+                        table.names[slot], status_token.length, status_token.start);
+                goto done;
+            }
+        }
+        else
+        {
+            fprintf(stderr, "%s:%d: unknown entry %.*s\n", path, reader.line, token.length, token.start);
+            goto done;
+        }
+    }
+
+    result = 0;
+
+done:
+    free(table.names);
+    free(table.resource_id);
+    munmap(data, info.st_size);
+    return result;
+}
+
+/**
+ * Moves the reader to the start of the next line.
+ *
+ * @param[in,out] reader  Pointer to the `Reader`.
+ * @return                Non-zero while there is a line left to read.
+ */
+static int scenario_next_line(Reader *reader)
+{
+    // Skip whatever is left of the current line
+    if (reader->line > 0)
+    {
+        while (reader->position < reader->size && reader->data[reader->position] != '\n')
+            reader->position++;
+        if (reader->position < reader->size)
+            reader->position++;
+    }
+
+    if (reader->position >= reader->size)
+        return 0;
+
+    reader->line++;
+    return 1;
+}
+
+/**
+ * Reads the next token of the current line.
+ *
+ * Tokens are separated by spaces or tabs, a `#` starts a comment that runs to the end of
+ * the line, and a token starting with `"` runs to the closing quote.
+ *
+ * @param[in,out] reader  Pointer to the `Reader`.
+ * @param[out]    token   Receives the token.
+ * @return                Non-zero if a token was read, zero at the end of the line.
+ */
+static int scenario_next_token(Reader *reader, Token *token)
+{
+    const char *data = reader->data;
+
+    while (reader->position < reader->size && (data[reader->position] == ' ' || data[reader->position] == '\t' || data[reader->position] == '\r'))
+        reader->position++;
+
+    if (reader->position >= reader->size || data[reader->position] == '\n' || data[reader->position] == '#')
+        return 0;
+
+    if (data[reader->position] == '"')
+    {
+        reader->position++;
+        token->start = &data[reader->position];
+        while (reader->position < reader->size && data[reader->position] != '"' && data[reader->position] != '\n')
+            reader->position++;
+        token->length = (int)(&data[reader->position] - token->start);
+        if (reader->position < reader->size && data[reader->position] == '"')
+            reader->position++;
+        return 1;
+    }
+
+    token->start = &data[reader->position];
+    while (reader->position < reader->size && data[reader->position] != ' ' && data[reader->position] != '\t' &&
+           data[reader->position] != '\r' && data[reader->position] != '\n' && data[reader->position] != '#')
+        reader->position++;
+    token->length = (int)(&data[reader->position] - token->start);
+    return 1;
+}
+
+/**
+ * Compares a token with a keyword.
+ *
+ * @param[in] token  Pointer to the `Token`.
+ * @param[in] word   Null terminated keyword.
+ * @return           Non-zero if they are equal.
+ */
+static int scenario_token_is(const Token *token, const char *word)
+{
+    return (int)strlen(word) == token->length && strncmp(token->start, word, token->length) == 0;
+}
+
+/**
+ * Looks a token up in a list of keywords.
+ *
+ * @param[in] token  Pointer to the `Token`.
+ * @param[in] words  Null terminated keywords to compare against.
+ * @param[in] count  Number of entries in `words`.
+ * @return           Index of the matching keyword, or -1 if none matches.
+ */
+static int scenario_token_find(const Token *token, const char *const *words, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (scenario_token_is(token, words[i]))
+            return i;
+    }
+    return -1;
+}
+
+/**
+ * Parses a token as a non-negative decimal integer.
+ *
+ * @param[in]  reader  Pointer to the `Reader`, used for error messages.
+ * @param[in]  token   Pointer to the `Token`.
+ * @param[out] value   Receives the parsed value.
+ * @return             0 on success, -1 if the token is not a number.
+ */
+static int scenario_token_int(Reader *reader, const Token *token, int *value)
+{
+    long result = 0;
+
+    for (int i = 0; i < token->length; i++)
+    {
+        if (token->start[i] < '0' || token->start[i] > '9' || result > 100000000L)
+        {
+            fprintf(stderr, "%s:%d: expected a number, found %.*s\n", reader->path, reader->line, token->length, token->start);
+            return -1;
+        }
+        result = result * 10 + (token->start[i] - '0');
+    }
+
+    if (token->length == 0)
+    {
+        fprintf(stderr, "%s:%d: expected a number\n", reader->path, reader->line);
+        return -1;
+    }
+
+    *value = (int)result;
+    return 0;
+}
+
+/**
+ * Initializes an `InternTable` large enough for `entries` distinct names.
+ *
+ * @param[out] table    Pointer to the `InternTable`.
+ * @param[in]  entries  Upper bound of distinct names.
+ * @return              0 on success, -1 if memory could not be allocated.
+ */
+static int intern_init(InternTable *table, int entries)
+{
+    // Keep the table at most half full
+    table->capacity = 16;
+    while (table->capacity < entries * 2)
+        table->capacity *= 2;
+
+    table->names = calloc(table->capacity, sizeof(char *));
+    table->resource_id = malloc(sizeof(int) * table->capacity);
+    if (table->names == NULL || table->resource_id == NULL)
+        return -1;
+
+    for (int i = 0; i < table->capacity; i++)
+        table->resource_id[i] = -1;
+    return 0;
+}
+
+/**
+ * Finds a name in the `InternTable`, optionally copying it into the name block.
+ *
+ * @param[in,out] table     Pointer to the `InternTable`.
+ * @param[in,out] scenario  Pointer to the `ScenarioBlocks` owning the name block.
+ * @param[in]     token     Name to look up.
+ * @param[in]     insert    Non-zero to intern the name when it is missing.
+ * @return                  Slot of the name, or -1 if missing and `insert` is zero.
+ */
+static int intern_lookup(InternTable *table, ScenarioBlocks *scenario, const Token *token, int insert)
+{
+    // FNV-1a hash of the name
+    unsigned int hash = 2166136261u;
+    for (int i = 0; i < token->length; i++)
+    {
+        hash ^= (unsigned char)token->start[i];
+        hash *= 16777619u;
+    }
+
+    unsigned int mask = table->capacity - 1;
+    for (unsigned int slot = hash & mask;; slot = (slot + 1) & mask)
+    {
+        char *name = table->names[slot];
+        if (name == NULL)
+        {
+            if (!insert)
+                return -1;
+
+            name = &scenario->names[scenario->names_used];
+            memcpy(name, token->start, token->length);
+            name[token->length] = '\0';
+            scenario->names_used += token->length + 1;
+            table->names[slot] = name;
+            return (int)slot;
+        }
+        if ((int)strlen(name) == token->length && strncmp(name, token->start, token->length) == 0)
+            return (int)slot;
+    }
+}
@@ -0,0 +1,304 @@
+#include "defs.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+// Helper functions just used by this C file to keep the heap logic in one place
+
+static int simulation_entry_before(const SimulationEntry *a, const SimulationEntry *b);
+static void simulation_sift_up(Simulation *simulation, int index);
+static void simulation_sift_down(Simulation *simulation, int index);
+static int simulation_pop(Simulation *simulation, SimulationEntry *entry);
+
+/**
+ * Initializes the `Simulation` scheduler.
+ *
+ * Allocates the heap of pending ticks and starts the virtual clock at 0.
+ *
+ * @param[out] simulation  Pointer to the `Simulation` to initialize.
+ * @param[in]  capacity    Initial number of pending ticks to make room for, normally the number of systems.
+ */
+void simulation_init(Simulation *simulation, int capacity)
+{
+    if (capacity < 1)
+        capacity = 1;
+
+    simulation->clock = 0;
+    simulation->next_sequence = 0;
+    simulation->tick_count = 0;
+    simulation->event_count = 0;
+    simulation->wall_ms = 0;
+    simulation->time_limit = -1;
+    simulation->checkpoint_path = NULL;
+    simulation->checkpoint_interval = 0;
+    simulation->next_checkpoint = 0;
+    simulation->size = 0;
+    simulation->capacity = 0;
+
+    simulation->heap = malloc(sizeof(SimulationEntry) * capacity);
+    if (simulation->heap == NULL)
+    {
+        perror("Failed to allocate memory for simulation heap");
+        return;
+    }
+    simulation->capacity = capacity;
+}
+
+/**
+ * Cleans up the `Simulation` scheduler.
+ *
+ * Frees the heap of pending ticks.
+ *
+ * @param[in,out] simulation  Pointer to the `Simulation` to clean.
+ */
+void simulation_clean(Simulation *simulation)
+{
+    if (simulation == NULL)
+        return;
+
+    free(simulation->heap);
+    simulation->heap = NULL;
+    simulation->size = 0;
+    simulation->capacity = 0;
+}
+
+/**
+ * Schedules a tick of `system` at virtual time `time`.
+ *
+ * Ticks due at the same time run in the order they were scheduled.
+ * Resizes the heap (doubling the size) when the capacity is reached.
+ *
+ * @param[in,out] simulation  Pointer to the `Simulation`.
+ * @param[in]     system      Pointer to the `System` to tick.
+ * @param[in]     time        Virtual time in milliseconds when the tick is due.
+ */
+void simulation_schedule(Simulation *simulation, System *system, long long time)
+{
+    if (simulation->size >= simulation->capacity)
+    {
+        int new_capacity = simulation->capacity * 2;
+        SimulationEntry *new_heap = malloc(sizeof(SimulationEntry) * new_capacity);
+        if (new_heap == NULL)
+        {
+            perror("Failed to allocate memory for simulation heap");
+            return;
+        }
+
+        for (int i = 0; i < simulation->size; i++)
+        {
+            new_heap[i] = simulation->heap[i];
+        }
+
+        free(simulation->heap);
+        simulation->heap = new_heap;
+        simulation->capacity = new_capacity;
+    }
+
+    SimulationEntry *entry = &simulation->heap[simulation->size];
+    entry->time = time;
+    entry->sequence = simulation->next_sequence++;
+    entry->system = system;
+
+    simulation->size++;
+    simulation_sift_up(simulation, simulation->size - 1);
+}
+
+/**
+ * Runs the whole simulation on a virtual clock.
+ *
+ * Every system is ticked with `system_tick`, which returns how long the system would have
+ * slept, and is rescheduled that far in the virtual future instead of sleeping. Events are
+ * handled by the manager right after the tick that produced them, so status changes take
+ * effect at the same virtual time. Runs until the manager stops the simulation, every
+ * system has terminated or the clock passes `time_limit`, as fast as the CPU allows.
+ * With a `checkpoint_path` the state is saved every `checkpoint_interval` of virtual time,
+ * and a `Simulation` restored with `checkpoint_load` carries on where the checkpoint was
+ * taken. A telemetry stream gets its snapshots and timestamps from the virtual clock.
+ * See `simulation_report` for the outcome.
+ *
+ * @param[in,out] simulation  Pointer to an initialized `Simulation`.
+ * @param[in,out] manager     Pointer to the `Manager` holding the loaded systems.
+ */
+void simulation_run(Simulation *simulation, Manager *manager)
+{
+    SimulationEntry entry;
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    manager->unpark = simulation_unpark;
+    manager->unpark_context = simulation;
+    if (manager->telemetry != NULL)
+        manager->telemetry->clock = &simulation->clock;
+
+    // Every system starts at virtual time 0, in the order they were loaded, unless a checkpoint was restored
+    int fresh = (simulation->size == 0 && simulation->tick_count == 0);
+    for (int i = 0; fresh && i < manager->system_array.size; i++)
+    {
+        simulation_schedule(simulation, manager->system_array.systems[i], 0);
+    }
+
+    while (manager->simulation_running && simulation_pop(simulation, &entry))
+    {
+        System *system = entry.system;
+
+        // Terminated systems drop out of the schedule, like their threads would exit
+        int status = system_get_status(system);
+        if (status == TERMINATE)
+            continue;
+
+        // Disabled systems drop out until `simulation_unpark` schedules them again
+        if (status == DISABLED && system_park(system))
+            continue;
+
+        if (simulation->time_limit >= 0 && entry.time > simulation->time_limit)
+            break;
+
+        simulation->clock = entry.time;
+        int delay = system_tick(system);
+        simulation->tick_count++;
+
+        manager->now = simulation->clock;
+        simulation->event_count += manager_process_events(manager);
+        if (manager->telemetry != NULL)
+            telemetry_snapshot(manager->telemetry, manager);
+
+        simulation_schedule(simulation, system, simulation->clock + delay);
+
+        // Between two ticks nothing else runs, the state is consistent as it is
+        if (simulation->checkpoint_path != NULL && simulation->clock >= simulation->next_checkpoint)
+        {
+            checkpoint_save(manager, simulation, simulation->checkpoint_path);
+            simulation->next_checkpoint = simulation->clock + simulation->checkpoint_interval;
+        }
+    }
+
+    manager->unpark = NULL;
+    manager->unpark_context = NULL;
+    if (manager->telemetry != NULL)
+        manager->telemetry->clock = NULL;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    simulation->wall_ms = (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0;
+}
+
+/**
+ * Schedules a re-enabled system again, used as `Manager.unpark`.
+ *
+ * Called by the manager while it handles the events of a tick, so the system is due
+ * right away at the current virtual time.
+ *
+ * @param[in,out] context  Pointer to the running `Simulation` (cast from void*)
+ * @param[in]     system   Pointer to the unparked `System`.
+ */
+void simulation_unpark(void *context, System *system)
+{
+    Simulation *simulation = (Simulation *)context;
+    simulation_schedule(simulation, system, simulation->clock);
+}
+
+/**
+ * Prints where and when the last `simulation_run` ended, and the final resource amounts.
+ *
+ * Goes to standard error when a telemetry stream is written, which may be standard output.
+ *
+ * @param[in] simulation  Pointer to the finished `Simulation`.
+ * @param[in] manager     Pointer to the `Manager` it ran.
+ */
+void simulation_report(const Simulation *simulation, Manager *manager)
+{
+    FILE *out = (manager->telemetry != NULL) ? stderr : stdout;
+
+    fprintf(out, "\nSimulation finished at virtual time %lld ms after %lld ticks (%.1f ms real time)\n",
+            simulation->clock, simulation->tick_count, simulation->wall_ms);
+    for (int i = 0; i < manager->resource_array.size; i++)
+    {
+        Resource *resource = manager->resource_array.resources[i];
+        fprintf(out, "%s: %d / %d\n", resource->name, resource_get_amount(resource), resource->max_capacity);
+    }
+}
+
+/**
+ * Orders two heap entries, earliest time first and then earliest scheduled.
+ *
+ * @param[in] a  First entry.
+ * @param[in] b  Second entry.
+ * @return       Non-zero if `a` must run before `b`.
+ */
+static int simulation_entry_before(const SimulationEntry *a, const SimulationEntry *b)
+{
+    if (a->time != b->time)
+        return a->time < b->time;
+    return a->sequence < b->sequence;
+}
+
+/**
+ * Moves the entry at `index` up the heap until its parent runs before it.
+ *
+ * @param[in,out] simulation  Pointer to the `Simulation`.
+ * @param[in]     index       Index of the entry to move.
+ */
+static void simulation_sift_up(Simulation *simulation, int index)
+{
+    SimulationEntry *heap = simulation->heap;
+    while (index > 0)
+    {
+        int parent = (index - 1) / 2;
+        if (!simulation_entry_before(&heap[index], &heap[parent]))
+            break;
+
+        SimulationEntry temp = heap[parent];
+        heap[parent] = heap[index];
+        heap[index] = temp;
+        index = parent;
+    }
+}
+
+/**
+ * Moves the entry at `index` down the heap until both children run after it.
+ *
+ * @param[in,out] simulation  Pointer to the `Simulation`.
+ * @param[in]     index       Index of the entry to move.
+ */
+static void simulation_sift_down(Simulation *simulation, int index)
+{
+    SimulationEntry *heap = simulation->heap;
+    while (1)
+    {
+        int smallest = index;
+        int left = index * 2 + 1;
+        int right = left + 1;
+
+        if (left < simulation->size && simulation_entry_before(&heap[left], &heap[smallest]))
+            smallest = left;
+        if (right < simulation->size && simulation_entry_before(&heap[right], &heap[smallest]))
+            smallest = right;
+        if (smallest == index)
+            break;
+
+        SimulationEntry temp = heap[smallest];
+        heap[smallest] = heap[index];
+        heap[index] = temp;
+        index = smallest;
+    }
+}
+
+/**
+ * Removes the earliest pending tick from the heap.
+ *
+ * @param[in,out] simulation  Pointer to the `Simulation`.
+ * @param[out]    entry       Receives the removed entry.
+ * @return                    Non-zero if an entry was removed, zero if nothing is scheduled.
+ */
+static int simulation_pop(Simulation *simulation, SimulationEntry *entry)
+{
+    if (simulation->size == 0)
+        return 0;
+
+    *entry = simulation->heap[0];
+    simulation->size--;
+    if (simulation->size > 0)
+    {
+        simulation->heap[0] = simulation->heap[simulation->size];
+        simulation_sift_down(simulation, 0);
+    }
+    return 1;
+}
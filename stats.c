@@ -0,0 +1,351 @@
+#include "defs.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <signal.h>
+#include <time.h>
+#include <errno.h>
+
+/*
+ * Counters and histograms for the hot paths, recorded through the STATS_* macros of
+ * defs.h when built with `make DEFINES=-DINSTRUMENT` and compiled out otherwise.
+ *
+ * Every thread records into a block of its own, so recording never contends. The blocks
+ * are merged when the report is printed, at manager_clean or after a SIGUSR1.
+ */
+
+// Every block ever handed out, merged when dumping
+typedef struct StatsRegistry
+{
+    Stats **blocks;
+    int size;
+    int capacity;
+    sem_t mutex; // Guards registration, recording itself is lock free
+    int ready;
+} StatsRegistry;
+
+static StatsRegistry registry; // Zeroed, set up by stats_init
+static _Thread_local Stats *local_stats = NULL;
+static atomic_int dump_requested; // Lock-free, so it may be set from the signal handler
+
+static Stats *stats_local(void);
+static int stats_bucket(unsigned long long value);
+static unsigned long long stats_bucket_value(int bucket);
+static void stats_print_histogram(FILE *out, const char *name, const char *unit, const StatsHistogram *histogram);
+static void stats_signal_handler(int signal_number);
+
+static const char *counter_names[STATS_COUNTER_COUNT] = {
+    "convert ok", "convert empty", "convert insufficient", "store capacity",
+    "events pushed", "events merged", "events dropped", "events popped"};
+
+/**
+ * Prepares the registry and installs the SIGUSR1 handler requesting a report.
+ *
+ * Must be called once before any thread records.
+ */
+void stats_init(void)
+{
+    struct sigaction action;
+
+    if (sem_init(&registry.mutex, 0, 1) != 0)
+    {
+        perror("Failed to initialize stats mutex");
+        return;
+    }
+    registry.ready = 1;
+
+    action.sa_handler = stats_signal_handler;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    if (sigaction(SIGUSR1, &action, NULL) != 0)
+        perror("Failed to install SIGUSR1 handler");
+}
+
+/**
+ * Frees every thread's block.
+ *
+ * No thread may record anymore.
+ */
+void stats_clean(void)
+{
+    if (!registry.ready)
+        return;
+
+    for (int i = 0; i < registry.size; i++)
+    {
+        free(registry.blocks[i]);
+    }
+    free(registry.blocks);
+    registry.blocks = NULL;
+    registry.size = 0;
+    registry.capacity = 0;
+    sem_destroy(&registry.mutex);
+    registry.ready = 0;
+}
+
+/**
+ * Reads a monotonic clock in nanoseconds.
+ *
+ * @return  Nanoseconds since an arbitrary fixed point.
+ */
+long long stats_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/**
+ * Adds to a counter of the calling thread.
+ *
+ * @param[in] counter  One of the `STATS_*` counters.
+ * @param[in] amount   Number to add.
+ */
+void stats_count(int counter, long long amount)
+{
+    Stats *stats = stats_local();
+    if (stats != NULL)
+        atomic_fetch_add_explicit(&stats->counters[counter], amount, memory_order_relaxed);
+}
+
+/**
+ * Records a value in a histogram of the calling thread.
+ *
+ * @param[in] histogram  One of the `STATS_*` histograms.
+ * @param[in] value      Value to record, negative values count as 0.
+ */
+void stats_record(int histogram, long long value)
+{
+    Stats *stats = stats_local();
+    if (stats == NULL)
+        return;
+
+    stats_histogram_add(&stats->histograms[histogram], value);
+}
+
+/**
+ * Records a value in a histogram.
+ *
+ * Only one thread at a time may record into a given histogram, readers may run concurrently.
+ *
+ * @param[in,out] histogram  Pointer to the `StatsHistogram`.
+ * @param[in]     value      Value to record, negative values count as 0.
+ */
+void stats_histogram_add(StatsHistogram *histogram, long long value)
+{
+    unsigned long long v = (value > 0) ? (unsigned long long)value : 0;
+
+    atomic_fetch_add_explicit(&histogram->buckets[stats_bucket(v)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->sum, v, memory_order_relaxed);
+    if (v > atomic_load_explicit(&histogram->max, memory_order_relaxed))
+        atomic_store_explicit(&histogram->max, v, memory_order_relaxed);
+}
+
+/**
+ * Checks whether a SIGUSR1 asked for a report since the last call.
+ *
+ * @return  Non-zero once per signal received.
+ */
+int stats_dump_pending(void)
+{
+    return atomic_exchange(&dump_requested, 0);
+}
+
+/**
+ * Prints the merged counters and histograms of every thread, and the processing time of each system.
+ *
+ * @param[in] out      Stream to print to.
+ * @param[in] manager  Pointer to the `Manager` whose systems are reported.
+ */
+void stats_dump(FILE *out, Manager *manager)
+{
+    static Stats merged;
+    unsigned long long counters[STATS_COUNTER_COUNT] = {0};
+
+    if (!registry.ready)
+        return;
+
+    for (int h = 0; h < STATS_HISTOGRAM_COUNT; h++)
+    {
+        StatsHistogram *histogram = &merged.histograms[h];
+        for (int b = 0; b < STATS_BUCKETS; b++)
+            atomic_store(&histogram->buckets[b], 0);
+        atomic_store(&histogram->count, 0);
+        atomic_store(&histogram->sum, 0);
+        atomic_store(&histogram->max, 0);
+    }
+
+    // Sum up the blocks, the threads may still be recording so the totals are approximate
+    sem_wait(&registry.mutex);
+    for (int i = 0; i < registry.size; i++)
+    {
+        Stats *stats = registry.blocks[i];
+        for (int c = 0; c < STATS_COUNTER_COUNT; c++)
+            counters[c] += atomic_load_explicit(&stats->counters[c], memory_order_relaxed);
+
+        for (int h = 0; h < STATS_HISTOGRAM_COUNT; h++)
+        {
+            StatsHistogram *from = &stats->histograms[h], *to = &merged.histograms[h];
+            for (int b = 0; b < STATS_BUCKETS; b++)
+                atomic_fetch_add(&to->buckets[b], atomic_load_explicit(&from->buckets[b], memory_order_relaxed));
+            atomic_fetch_add(&to->count, atomic_load_explicit(&from->count, memory_order_relaxed));
+            atomic_fetch_add(&to->sum, atomic_load_explicit(&from->sum, memory_order_relaxed));
+            unsigned long long max = atomic_load_explicit(&from->max, memory_order_relaxed);
+            if (max > atomic_load(&to->max))
+                atomic_store(&to->max, max);
+        }
+    }
+    int thread_count = registry.size;
+    sem_post(&registry.mutex);
+
+    fprintf(out, "\n=== Instrumentation (%d threads) ===\n", thread_count);
+    for (int c = 0; c < STATS_COUNTER_COUNT; c++)
+        fprintf(out, "%-22s %llu\n", counter_names[c], counters[c]);
+
+    fprintf(out, "\n%-22s %10s %10s %10s %10s %10s\n", "histogram", "count", "p50", "p90", "p99", "max");
+    stats_print_histogram(out, "lock wait", "ns", &merged.histograms[STATS_LOCK_WAIT]);
+    stats_print_histogram(out, "processing overrun", "us", &merged.histograms[STATS_PROCESSING_OVERRUN]);
+    stats_print_histogram(out, "event push", "ns", &merged.histograms[STATS_PUSH_LATENCY]);
+    stats_print_histogram(out, "event pop batch", "ns", &merged.histograms[STATS_POP_LATENCY]);
+    stats_print_histogram(out, "queue depth", "", &merged.histograms[STATS_QUEUE_DEPTH]);
+
+    // Nominal is the processing time asked for at the current speed, actual is what it took
+    fprintf(out, "\n%-22s %10s %12s %12s %12s\n", "system", "runs", "nominal us", "actual us", "max us");
+    for (int i = 0; i < manager->system_array.size; i++)
+    {
+        if (i == STATS_SYSTEM_LINES)
+        {
+            fprintf(out, "... %d more systems\n", manager->system_array.size - i);
+            break;
+        }
+
+        SystemStats *stats = &manager->system_array.systems[i]->stats;
+        long long runs = atomic_load(&stats->runs);
+        if (runs == 0)
+        {
+            fprintf(out, "%-22.22s %10d\n", manager->system_array.systems[i]->name, 0);
+            continue;
+        }
+        fprintf(out, "%-22.22s %10lld %12lld %12lld %12lld\n", manager->system_array.systems[i]->name, runs,
+                atomic_load(&stats->nominal_us) / runs, atomic_load(&stats->actual_us) / runs,
+                atomic_load(&stats->max_us));
+    }
+    fflush(out);
+}
+
+/**
+ * Finds the block of the calling thread, registering a new one on first use.
+ *
+ * @return  Pointer to the thread's `Stats`, or NULL if it could not be allocated.
+ */
+static Stats *stats_local(void)
+{
+    if (local_stats != NULL || !registry.ready)
+        return local_stats;
+
+    Stats *stats = calloc(1, sizeof(Stats));
+    if (stats == NULL)
+        return NULL;
+
+    sem_wait(&registry.mutex);
+    if (registry.size >= registry.capacity)
+    {
+        // Resize the registry (doubling the size)
+        int new_capacity = registry.capacity ? registry.capacity * 2 : 16;
+        Stats **new_blocks = malloc(sizeof(Stats *) * new_capacity);
+        if (new_blocks == NULL)
+        {
+            sem_post(&registry.mutex);
+            free(stats);
+            return NULL;
+        }
+        for (int i = 0; i < registry.size; i++)
+            new_blocks[i] = registry.blocks[i];
+        free(registry.blocks);
+        registry.blocks = new_blocks;
+        registry.capacity = new_capacity;
+    }
+    registry.blocks[registry.size++] = stats;
+    sem_post(&registry.mutex);
+
+    local_stats = stats;
+    return stats;
+}
+
+/**
+ * Maps a value onto its histogram bucket.
+ *
+ * Values below `2^STATS_SUB_BITS` get a bucket each, above that every power of two is split
+ * into `2^STATS_SUB_BITS` buckets, so the relative error stays below 1 / 2^STATS_SUB_BITS.
+ *
+ * @param[in] value  Value to bucket.
+ * @return           Bucket index between 0 and `STATS_BUCKETS - 1`.
+ */
+static int stats_bucket(unsigned long long value)
+{
+    if (value < (1ULL << STATS_SUB_BITS))
+        return (int)value;
+
+    int exponent = 63 - __builtin_clzll(value);
+    int sub = (int)(value >> (exponent - STATS_SUB_BITS)) & ((1 << STATS_SUB_BITS) - 1);
+    return ((exponent - STATS_SUB_BITS + 1) << STATS_SUB_BITS) + sub;
+}
+
+/**
+ * Gives the smallest value falling into a histogram bucket.
+ *
+ * @param[in] bucket  Bucket index.
+ * @return            Lower bound of the bucket.
+ */
+static unsigned long long stats_bucket_value(int bucket)
+{
+    if (bucket < (1 << STATS_SUB_BITS))
+        return (unsigned long long)bucket;
+
+    int exponent = (bucket >> STATS_SUB_BITS) + STATS_SUB_BITS - 1;
+    unsigned long long sub = bucket & ((1 << STATS_SUB_BITS) - 1);
+    return ((1ULL << STATS_SUB_BITS) + sub) << (exponent - STATS_SUB_BITS);
+}
+
+/**
+ * Prints one line with the count, percentiles and maximum of a histogram.
+ *
+ * @param[in] out        Stream to print to.
+ * @param[in] name       Label of the histogram.
+ * @param[in] unit       Unit of the values.
+ * @param[in] histogram  Pointer to the `StatsHistogram`.
+ */
+static void stats_print_histogram(FILE *out, const char *name, const char *unit, const StatsHistogram *histogram)
+{
+    static const double percentiles[3] = {0.50, 0.90, 0.99};
+    unsigned long long values[3] = {0, 0, 0};
+    unsigned long long count = atomic_load(&histogram->count);
+    unsigned long long seen = 0;
+    int p = 0;
+
+    for (int b = 0; b < STATS_BUCKETS && p < 3 && count > 0; b++)
+    {
+        seen += atomic_load(&histogram->buckets[b]);
+        while (p < 3 && seen >= percentiles[p] * count && seen > 0)
+            values[p++] = stats_bucket_value(b);
+    }
+
+    char label[64];
+    snprintf(label, sizeof(label), "%s%s%s%s", name, unit[0] ? " (" : "", unit, unit[0] ? ")" : "");
+    fprintf(out, "%-22s %10llu %10llu %10llu %10llu %10llu\n", label, count, values[0], values[1], values[2],
+            (unsigned long long)atomic_load(&histogram->max));
+}
+
+/**
+ * Asks the manager for a report, the printing happens outside of the signal handler.
+ *
+ * @param[in] signal_number  Number of the received signal.
+ */
+static void stats_signal_handler(int signal_number)
+{
+    int saved_errno = errno;
+
+    (void)signal_number;
+    atomic_store(&dump_requested, 1);
+    errno = saved_errno;
+}
@@ -3,19 +3,33 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
 
 // Helper functions just used by this C file to clean up our code
 // Using static means they can't get linked into other files
 
-static int system_convert(System *);
-static void system_simulate_process_time(System *);
+static int system_convert(System *, int, int *);
+static int system_reserve_outputs(System *);
+static void system_trim_reservations(System *, int);
+static int system_processing_time(System *);
 static int system_store_resources(System *);
+static int system_has_stored(const System *);
+static void system_report(System *, Resource *, int, int);
+static void system_sleep(System *, int);
+static void system_wait_enabled(System *);
+static int system_backoff(System *);
+#ifdef INSTRUMENT
+static void system_record_processing(System *);
+#endif
 
 /**
- * Creates a new `System` object.
+ * Creates a new `System` object with a single input and a single output.
  *
- * Allocates memory for a new `System` and initializes its fields.
- * The `name` is dynamically allocated.
+ * Convenience wrapper around `system_create_multi`. A `ResourceAmount` with a NULL
+ * resource means the system consumes or produces nothing.
  *
  * @param[out] system          Pointer to the `System*` to be allocated and initialized.
  * @param[in]  name            Name of the system (the string is copied).
@@ -23,199 +37,542 @@ static int system_store_resources(System *);
  * @param[in]  produced        `ResourceAmount` representing the resource produced.
  * @param[in]  processing_time Processing time in milliseconds.
  * @param[in]  event_queue     Pointer to the `EventQueue` for event handling.
+ * @param[in]  arena           Pointer to the `Arena` owning the memory.
+ */
+void system_create(System **system, const char *name, ResourceAmount consumed, ResourceAmount produced, int processing_time, EventQueue *event_queue, Arena *arena)
+{
+    system_create_multi(system, name,
+                        &consumed, consumed.resource != NULL ? 1 : 0,
+                        &produced, produced.resource != NULL ? 1 : 0,
+                        processing_time, event_queue, arena);
+}
+
+/**
+ * Creates a new `System` object.
+ *
+ * Carves a new `System` and a copy of its name out of `arena` and initializes its fields.
+ * The resource amounts are copied. The memory is released all at once when the arena is cleaned.
+ *
+ * @param[out] system          Pointer to the `System*` to be allocated and initialized.
+ * @param[in]  name            Name of the system (the string is copied).
+ * @param[in]  consumed        Array of `ResourceAmount`s consumed by every conversion.
+ * @param[in]  consumed_count  Number of entries in `consumed`, at most `SYSTEM_MAX_RESOURCES`.
+ * @param[in]  produced        Array of `ResourceAmount`s produced by every conversion.
+ * @param[in]  produced_count  Number of entries in `produced`, at most `SYSTEM_MAX_RESOURCES`.
+ * @param[in]  processing_time Processing time in milliseconds.
+ * @param[in]  event_queue     Pointer to the `EventQueue` for event handling.
+ * @param[in]  arena           Pointer to the `Arena` owning the memory.
  */
-void system_create(System **system, const char *name, ResourceAmount consumed, ResourceAmount produced, int processing_time, EventQueue *event_queue)
+void system_create_multi(System **system, const char *name, const ResourceAmount *consumed, int consumed_count, const ResourceAmount *produced, int produced_count, int processing_time, EventQueue *event_queue, Arena *arena)
 {
-    *system = (System *)malloc(sizeof(System));
+    if (consumed_count > SYSTEM_MAX_RESOURCES || produced_count > SYSTEM_MAX_RESOURCES)
+    {
+        fprintf(stderr, "System %s uses more than %d inputs or outputs\n", name, SYSTEM_MAX_RESOURCES);
+        *system = NULL;
+        return;
+    }
+
+    *system = arena_alloc(arena, sizeof(System), _Alignof(System));
     if (*system == NULL)
     {
-        perror("Failed to allocate memory for System struct");
         return;
     }
 
-    (*system)->name = malloc(strlen(name) + 1);
-    if ((*system)->name == NULL)
+    // copies the name string next to it
+    char *copy = arena_strndup(arena, name, strlen(name));
+    if (copy == NULL)
     {
-        perror("Failed to allocate memory for name");
+        *system = NULL;
         return;
     }
 
-    // copies the name string into allocated memory
-    strcpy((*system)->name, name);
+    system_init(*system, copy, consumed, consumed_count, produced, produced_count, processing_time, event_queue);
+}
 
-    (*system)->consumed = consumed;
-    (*system)->produced = produced;
-    (*system)->processing_time = processing_time;
-    (*system)->event_queue = event_queue;
-    (*system)->amount_stored = 0;
-    (*system)->status = STANDARD;
+/**
+ * Initializes a `System` in memory owned by the caller.
+ *
+ * Used by `system_create_multi` and by loaders that allocate many systems in one block.
+ * The `name` is not copied, it must outlive the system. The counts must already be
+ * checked against `SYSTEM_MAX_RESOURCES`.
+ *
+ * @param[out] system          Pointer to the `System` to initialize.
+ * @param[in]  name            Name of the system.
+ * @param[in]  consumed        Array of `ResourceAmount`s consumed by every conversion.
+ * @param[in]  consumed_count  Number of entries in `consumed`.
+ * @param[in]  produced        Array of `ResourceAmount`s produced by every conversion.
+ * @param[in]  produced_count  Number of entries in `produced`.
+ * @param[in]  processing_time Processing time in milliseconds.
+ * @param[in]  event_queue     Pointer to the `EventQueue` for event handling.
+ */
+void system_init(System *system, char *name, const ResourceAmount *consumed, int consumed_count, const ResourceAmount *produced, int produced_count, int processing_time, EventQueue *event_queue)
+{
+    system->id = -1; // Assigned when the system is added to a SystemArray
+    system->name = name;
 
-    // Initializes the status mutex
-    sem_init(&(*system)->status_mutex, 0, 1);
+    for (int i = 0; i < consumed_count; i++)
+    {
+        system->consumed[i] = consumed[i];
+    }
+    for (int i = 0; i < produced_count; i++)
+    {
+        system->produced[i] = produced[i];
+        system->amount_stored[i] = 0;
+        system->amount_reserved[i] = 0;
+    }
+    system->consumed_count = consumed_count;
+    system->produced_count = produced_count;
+    system->processing_time = processing_time;
+    system->member_count = 1;
+    system->active_members = 0;
+    system->reserve_outputs = 0;
+    system->event_queue = event_queue;
+    atomic_init(&system->status, STANDARD);
+    system->phase = SYSTEM_IDLE;
+    system->consume_reported = 0;
+    system->store_reported = 0;
+    atomic_init(&system->parked, 0);
+    system->backoff = SYSTEM_BACKOFF_MIN;
+    system->jitter = 0;
+    system->speed_held_until = LLONG_MIN;
+    system->held_speed = -1;
+    system->held_hold_ms = 0;
+    system->shard = 0;
+    system->numa_node = -1;
+    system->stats = (SystemStats){0};
 }
 
 /**
  * Destroys a `System` object.
  *
- * Frees all memory associated with the `System`.
+ * A system holds no resources of its own. Its memory belongs to the arena it was
+ * created from and is freed with it.
  *
  * @param[in,out] system  Pointer to the `System` to be destroyed.
  */
 void system_destroy(System *system)
 {
-    if (system == NULL)
-        return;
+    (void)system;
+}
 
-    // Destroy the status mutex before the memoery is freed
-    sem_destroy(&system->status_mutex);
+/**
+ * Reads the current status of a `System`.
+ *
+ * @param[in] system  Pointer to the `System`.
+ * @return            Its status, e.g. `FAST` or `TERMINATE`.
+ */
+int system_get_status(System *system)
+{
+    return atomic_load_explicit(&system->status, memory_order_acquire);
+}
 
-    free(system->name);  // Free the dynamically allocated name field
-    system->name = NULL; // Set to NULL to avoid dangling pointer
-    free(system);        // Free the System struct itself
-    system = NULL;       // Set to NULL to avoid dangling pointer
-    return;
+/**
+ * Changes the status of a `System` and wakes it if it is sleeping.
+ *
+ * A system sleeping in `system_run` sees a `TERMINATE` or `DISABLED` right away
+ * instead of once its current delay is over. `TERMINATE` is final, so a manager shard
+ * still handling an older event cannot bring a terminated system back.
+ *
+ * @param[in,out] system  Pointer to the `System` to update.
+ * @param[in]     status  New status, e.g. `FAST` or `TERMINATE`.
+ */
+void system_set_status(System *system, int status)
+{
+    int current = atomic_load_explicit(&system->status, memory_order_relaxed);
+
+    do
+    {
+        if (current == status || current == TERMINATE)
+            return; // Nothing changed, nobody needs waking
+    } while (!atomic_compare_exchange_weak_explicit(&system->status, &current, status, memory_order_release,
+                                                    memory_order_relaxed));
+
+    syscall(SYS_futex, (int *)&system->status, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/**
+ * Parks a disabled `System` that a pool worker or the scheduler is about to drop.
+ *
+ * Parked systems are not ticked at all until the manager re-enables them, which hands them
+ * back through `Manager.unpark`. If the system was re-enabled while it was being parked,
+ * whichever side clears the flag first keeps it, so it is never lost nor queued twice.
+ *
+ * @param[in,out] system  Pointer to the disabled `System`.
+ * @return                Non-zero if the caller must drop the system, zero if it should tick it.
+ */
+int system_park(System *system)
+{
+    // Failures from before the pause are reported again once it runs
+    system->consume_reported = 0;
+
+    atomic_store(&system->parked, 1);
+    if (system_get_status(system) == DISABLED)
+        return 1;
+    return atomic_exchange(&system->parked, 0) == 0;
+}
+
+/**
+ * Takes a `System` out of the parked state after it was re-enabled.
+ *
+ * @param[in,out] system  Pointer to the `System`, whose status is no longer `DISABLED`.
+ * @return                Non-zero if the system was parked and the caller must requeue it.
+ */
+int system_unpark(System *system)
+{
+    return atomic_exchange(&system->parked, 0);
+}
+
+/**
+ * Checks whether a `System` produces the given resource.
+ *
+ * @param[in] system    Pointer to the `System`.
+ * @param[in] resource  Pointer to the `Resource` to look for.
+ * @return              Non-zero if `resource` is one of the system's outputs, zero otherwise.
+ */
+int system_produces(const System *system, const Resource *resource)
+{
+    for (int i = 0; i < system->produced_count; i++)
+    {
+        if (system->produced[i].resource == resource)
+            return 1;
+    }
+    return 0;
 }
 
 /**
  * Runs the main loop for a `System`.
  *
- * This function manages the lifecycle of a system, including resource conversion,
- * processing time simulation, and resource storage. It generates events based on
- * the success or failure of these operations.
+ * Performs one step of the system with `system_tick` and then sleeps for as long as the
+ * step asked for, which is how the threaded mode turns ticks into real time.
  *
  * @param[in,out] system  Pointer to the `System` to run.
  */
 void system_run(System *system)
 {
-    Event event;
-    int result_status;
+    system_sleep(system, system_tick(system));
+}
+
+/**
+ * Sleeps for `delay_ms` milliseconds, or until the system is terminated or disabled.
+ *
+ * Waits on the status word itself with a futex, so `system_set_status` can cut the
+ * sleep short. Speed changes keep sleeping, they apply from the next tick on.
+ *
+ * @param[in] system    Pointer to the sleeping `System`.
+ * @param[in] delay_ms  Milliseconds to sleep.
+ */
+static void system_sleep(System *system, int delay_ms)
+{
+    struct timespec now, deadline, remaining;
 
-    if (system->amount_stored == 0)
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += delay_ms / 1000;
+    deadline.tv_nsec += (long)(delay_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
     {
-        // Need to convert resources 
-        result_status = system_convert(system);
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
 
-        if (result_status != STATUS_OK)
+    while (1)
+    {
+        int status = system_get_status(system);
+        if (status == TERMINATE || status == DISABLED)
+            return;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        remaining.tv_sec = deadline.tv_sec - now.tv_sec;
+        remaining.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+        if (remaining.tv_nsec < 0)
         {
-            // Lock before accessing resources for event creation
-            Resource *res = system->consumed.resource;
-            if (res != NULL)
-            {
-                sem_wait(&res->mutex);
-                event_init(&event, system, res, result_status, PRIORITY_HIGH, res->amount);
-                sem_post(&res->mutex);
-            }
-            else
+            remaining.tv_sec--;
+            remaining.tv_nsec += 1000000000L;
+        }
+        if (remaining.tv_sec < 0)
+            return;
+
+        // Returns early when the status no longer is `status`, or was changed while waiting
+        if (syscall(SYS_futex, (int *)&system->status, FUTEX_WAIT_PRIVATE, status, &remaining, NULL, 0) != 0 &&
+            errno == ETIMEDOUT)
+            return;
+    }
+}
+
+/**
+ * Blocks the thread of a disabled `System` until its status changes.
+ *
+ * Waits on the status word without a timeout, so a disabled system takes no CPU at all.
+ *
+ * @param[in,out] system  Pointer to the disabled `System`.
+ */
+static void system_wait_enabled(System *system)
+{
+    // Failures from before the pause are reported again once it runs
+    system->consume_reported = 0;
+
+    while (system_get_status(system) == DISABLED)
+    {
+        syscall(SYS_futex, (int *)&system->status, FUTEX_WAIT_PRIVATE, DISABLED, NULL, NULL, 0);
+    }
+}
+
+/**
+ * Advances a `System` by one step without sleeping.
+ *
+ * This function manages the lifecycle of a system, including resource conversion,
+ * processing time simulation, and resource storage. It generates events when a resource
+ * it uses crosses its low threshold or fills up, and once when it starts failing to
+ * reserve its inputs or to store its outputs, not on every retry. Instead of sleeping
+ * itself it returns how long the caller should wait before the next step, so the same
+ * logic drives both the threaded mode and the discrete-event scheduler.
+ *
+ * @param[in,out] system  Pointer to the `System` to advance.
+ * @return                Milliseconds until the system wants its next tick.
+ */
+int system_tick(System *system)
+{
+    int result_status, failed_index;
+    int delay = SYSTEM_WAIT_TIME;
+
+    if (system->phase == SYSTEM_PROCESSING)
+    {
+        // The processing time has passed, the conversion produces its outputs
+        system->phase = SYSTEM_IDLE;
+#ifdef INSTRUMENT
+        system_record_processing(system);
+#endif
+        for (int i = 0; i < system->produced_count; i++)
+        {
+            system->amount_stored[i] += system->produced[i].amount * system->active_members;
+        }
+        // The reservations are kept until the store below fills them
+    }
+    else if (!system_has_stored(system))
+    {
+        int wanted = system->member_count;
+
+        // Skip the conversion altogether while there is nowhere to put its outputs
+        if (system->reserve_outputs)
+        {
+            wanted = system_reserve_outputs(system);
+            if (wanted == 0)
             {
-                event_init(&event, system, NULL, result_status, PRIORITY_HIGH, 0);
+                STATS_COUNT(STATS_STORE_CAPACITY);
+                return system_backoff(system);
             }
-            event_queue_push(system->event_queue, &event);
-            // Sleep to prevent looping too frequently and spamming with events
-            usleep(SYSTEM_WAIT_TIME * 5000);
         }
+
+        // Need to convert resources
+        result_status = system_convert(system, wanted, &failed_index);
+        if (system->reserve_outputs)
+            system_trim_reservations(system, result_status == STATUS_OK ? system->active_members : 0);
+        STATS_COUNT(result_status == STATUS_OK ? STATS_CONVERT_OK
+                    : result_status == STATUS_EMPTY ? STATS_CONVERT_EMPTY : STATS_CONVERT_INSUFFICIENT);
+
+        if (result_status == STATUS_OK)
+        {
+            // Come back once the processing time is over
+            int processing_time = system_processing_time(system);
+            system->consume_reported = 0;
+            system->backoff = SYSTEM_BACKOFF_MIN;
+            system->phase = SYSTEM_PROCESSING;
+#ifdef INSTRUMENT
+            system->stats.started = stats_now();
+            system->stats.requested_us = processing_time * 1000LL;
+#endif
+            return processing_time;
+        }
+
+        // Report the first input that could not be reserved, retries stay quiet
+        if (!system->consume_reported)
+        {
+            system_report(system, system->consumed[failed_index].resource, result_status, PRIORITY_HIGH);
+            system->consume_reported = 1;
+        }
+        return system_backoff(system);
     }
 
-    if (system->amount_stored > 0)
+    if (system_has_stored(system))
     {
         // Attempt to store the produced resources
         result_status = system_store_resources(system);
 
         if (result_status != STATUS_OK)
         {
-            // locka before accessing resources for event creation
-            Resource *res = system->produced.resource;
-            if (res != NULL)
-            {
-                sem_wait(&res->mutex);
-                event_init(&event, system, res, result_status, PRIORITY_LOW, res->amount);
-                sem_post(&res->mutex);
-            }
-            else
-            {
-                event_init(&event, system, NULL, result_status, PRIORITY_LOW, 0);
-            }
-            event_queue_push(system->event_queue, &event);
-            // Sleep to prevent looping too frequently and spamming with events
-            usleep(SYSTEM_WAIT_TIME * 5000);
+            STATS_COUNT(STATS_STORE_CAPACITY);
+            delay = system_backoff(system);
+        }
+        else
+        {
+            system->backoff = SYSTEM_BACKOFF_MIN;
         }
     }
-    usleep(SYSTEM_WAIT_TIME * 1000);
+
+    return delay;
 }
 
 /**
- * Converts resources in a `System`.
+ * Computes the delay before a `System` retries a failed convert or store.
  *
- * Handles the consumption of required resources and simulates processing time.
- * Updates the amount of produced resources based on the system's configuration.
+ * The retry window doubles with every failure in a row, up to `SYSTEM_BACKOFF_MAX`, so a
+ * resource that refills is picked up quickly while one that stays empty is polled rarely.
+ * The delay is drawn from the upper half of the window so systems sharing a resource do
+ * not all retry at the same moment. The generator is seeded from the id, keeping
+ * discrete-event runs reproducible.
  *
- * @param[in,out] system           Pointer to the `System` performing the conversion.
- * @param[out]    amount_produced  Pointer to the integer tracking the amount of produced resources.
- * @return                         `STATUS_OK` if successful, or an error status code.
+ * @param[in,out] system  Pointer to the `System` that failed.
+ * @return                Milliseconds to wait before the retry.
  */
-static int system_convert(System *system)
+static int system_backoff(System *system)
 {
-    int status;
-    Resource *consumed_resource = system->consumed.resource;
-    int amount_consumed = system->consumed.amount;
+    int window = system->backoff;
+
+    if (system->jitter == 0)
+        system->jitter = (unsigned int)system->id * 2654435761u + 1;
+
+    // xorshift32
+    system->jitter ^= system->jitter << 13;
+    system->jitter ^= system->jitter >> 17;
+    system->jitter ^= system->jitter << 5;
+
+    if (system->backoff < SYSTEM_BACKOFF_MAX)
+        system->backoff = (system->backoff * 2 < SYSTEM_BACKOFF_MAX) ? system->backoff * 2 : SYSTEM_BACKOFF_MAX;
 
+    return window / 2 + (int)(system->jitter % (unsigned int)(window / 2 + 1));
+}
+
+/**
+ * Consumes the inputs of a `System` for one conversion.
+ *
+ * Reserves every required input at once. The outputs appear once the processing
+ * time has passed, see `system_tick`. Inputs taken below their low threshold are reported.
+ * A group reserves the inputs of as many of its members as it can in one go, and the
+ * members left without inputs sit the conversion out.
+ *
+ * @param[in,out] system        Pointer to the `System` performing the conversion.
+ * @param[in]     wanted        Members to convert for, at most `member_count`.
+ * @param[out]    failed_index  Set to the index of the input that was missing on failure.
+ * @return                      `STATUS_OK` if successful, or an error status code.
+ */
+static int system_convert(System *system, int wanted, int *failed_index)
+{
     // We can convert without consuming anything
-    if (consumed_resource == NULL)
+    if (system->consumed_count == 0)
+    {
+        system->active_members = wanted;
+        return STATUS_OK;
+    }
+
+    int crossed[SYSTEM_MAX_RESOURCES];
+    int status;
+
+    system->active_members = 1;
+    if (system->member_count > 1)
+    {
+        // One update per input for the whole group instead of one per member
+        system->active_members = wanted;
+        status = resource_consume_units(system->consumed, system->consumed_count, &system->active_members,
+                                        failed_index, crossed);
+    }
+    else if (system->consumed_count == 1)
     {
-        status = STATUS_OK;
+        // A single input needs no ordering, consume it directly
+        *failed_index = 0;
+        status = resource_consume(system->consumed[0].resource, system->consumed[0].amount, &crossed[0]);
     }
     else
     {
-        // forces to wait for access to the resource
-        sem_wait(&consumed_resource->mutex);
-
-        // Attempt to consume the required resources
-        if (consumed_resource->amount >= amount_consumed)
-        {
-            consumed_resource->amount -= amount_consumed;
-            status = STATUS_OK;
-        }
-        else
-        {
-            status = (consumed_resource->amount == 0) ? STATUS_EMPTY : STATUS_INSUFFICIENT;
-        }
+        // Attempt to consume all of the required resources, or none of them
+        status = resource_consume_all(system->consumed, system->consumed_count, failed_index, crossed);
+    }
 
-        sem_post(&consumed_resource->mutex); // releases the Lock
+    // Warn the manager before the consumers of the resource run dry
+    for (int i = 0; status == STATUS_OK && i < system->consumed_count; i++)
+    {
+        if (crossed[i] == STATUS_LOW)
+            system_report(system, system->consumed[i].resource, STATUS_LOW, PRIORITY_MED);
     }
-    // as long as the status passed we can start the process time
-    if (status == STATUS_OK)
+
+    return status;
+}
+
+/**
+ * Reserves the output capacity of a conversion before its inputs are taken.
+ *
+ * A conversion goes ahead as long as some of every output fits, like a store keeps what
+ * fits, so a nearly full destination still fills up. A group gets as many members as the
+ * reserved capacity covers. An output without any free capacity is reported once, until
+ * a reservation on it succeeds again.
+ *
+ * @param[in,out] system  Pointer to the `System` that reserves.
+ * @return                Members the reservations cover, 0 if an output is full and nothing is reserved.
+ */
+static int system_reserve_outputs(System *system)
+{
+    int members = system->member_count;
+
+    for (int i = 0; i < system->produced_count; i++)
     {
-        system_simulate_process_time(system);
+        Resource *resource = system->produced[i].resource;
+        int unit = system->produced[i].amount;
 
-        if (system->produced.resource != NULL)
+        system->amount_reserved[i] = resource_reserve(resource, unit * system->member_count);
+        if (system->amount_reserved[i] == 0 && unit > 0)
         {
-            system->amount_stored += system->produced.amount;
+            if (!(system->store_reported & (1 << i)))
+            {
+                system_report(system, resource, STATUS_CAPACITY, PRIORITY_LOW);
+                system->store_reported |= (1 << i);
+            }
+            members = 0;
+            continue;
         }
-        else
+        system->store_reported &= ~(1 << i);
+
+        // The last member may only fit in part
+        int covered = (unit > 0) ? (system->amount_reserved[i] + unit - 1) / unit : system->member_count;
+        if (covered < members)
+            members = covered;
+    }
+
+    if (members == 0)
+        system_trim_reservations(system, 0);
+    return members;
+}
+
+/**
+ * Gives back the reserved output capacity that `members` conversions do not need.
+ *
+ * @param[in,out] system   Pointer to the `System` holding the reservations.
+ * @param[in]     members  Members still converting, 0 to give back everything.
+ */
+static void system_trim_reservations(System *system, int members)
+{
+    for (int i = 0; i < system->produced_count; i++)
+    {
+        int needed = system->produced[i].amount * members;
+        if (system->amount_reserved[i] > needed)
         {
-            system->amount_stored = 0;
+            resource_release(system->produced[i].resource, system->amount_reserved[i] - needed);
+            system->amount_reserved[i] = needed;
         }
     }
-
-    return status;
 }
 
 /**
- * Simulates the processing time for a `System`.
+ * Computes the processing time of a `System` for its current status.
  *
- * Adjusts the processing time based on the system's current status (e.g., SLOW, FAST)
- * and sleeps for the adjusted time to simulate processing.
+ * Adjusts the processing time based on the system's current status (e.g., SLOW, FAST).
  *
  * @param[in] system  Pointer to the `System` whose processing time is being simulated.
+ * @return            Processing time in milliseconds.
  */
-static void system_simulate_process_time(System *system)
+static int system_processing_time(System *system)
 {
     int adjusted_processing_time;
     int current_status;
 
-    // Get current status with mutex protection
-    sem_wait(&system->status_mutex);
-    current_status = system->status;
-    sem_post(&system->status_mutex);
+    current_status = system_get_status(system);
 
     // Adjust based on the current system status modifier
     switch (current_status)
@@ -230,63 +587,117 @@ static void system_simulate_process_time(System *system)
         adjusted_processing_time = system->processing_time;
     }
 
-    // Sleep
-    usleep(adjusted_processing_time * 1000);
+    return adjusted_processing_time;
 }
 
 /**
  * Stores produced resources in a `System`.
  *
- * Attempts to add the produced resources to the corresponding resource's amount,
- * considering the maximum capacity. Updates the `produced_resource_count` to reflect
- * any leftover resources that couldn't be stored.
+ * Attempts to add each produced resource to the corresponding resource's amount,
+ * considering the maximum capacity. Updates `amount_stored` to reflect any leftover
+ * resources that couldn't be stored. Outputs are independent, one being full does
+ * not stop the others from being stored. An output is reported once when it fills up
+ * its resource or first fails to fit, and again only after it was completely stored.
+ * Output capacity reserved by the conversion is filled in the same update.
  *
- * @param[in,out] system                   Pointer to the `System` storing resources.
- * @param[in,out] produced_resource_count  Pointer to the integer value of how many resources need to be stored, updated with the amount that could not be stored.
- * @return                                 `STATUS_OK` if all resources were stored, or `STATUS_CAPACITY` if not all could be stored.
+ * @param[in,out] system  Pointer to the `System` storing resources.
+ * @return                `STATUS_OK` if all resources were stored, or `STATUS_CAPACITY` if not all could be stored.
  */
 static int system_store_resources(System *system)
 {
-    Resource *produced_resource = system->produced.resource;
-    int available_space, amount_to_store;
+    int status = STATUS_OK;
+    int crossed;
 
-    // We can always proceed if there's nothing to store
-    if (produced_resource == NULL || system->amount_stored == 0)
+    for (int i = 0; i < system->produced_count; i++)
     {
-        system->amount_stored = 0;
-        return STATUS_EMPTY;
-    }
+        // Nothing waiting for this output
+        if (system->amount_stored[i] == 0)
+            continue;
+
+        // The reserved part goes in with the rest, whatever does not fit stays in amount_stored
+        int result = resource_commit(system->produced[i].resource, system->amount_reserved[i], &system->amount_stored[i],
+                                     &crossed);
+        system->amount_reserved[i] = 0;
+        if (result != STATUS_OK)
+        {
+            status = STATUS_CAPACITY;
+        }
 
-    amount_to_store = system->amount_stored;
+        // Consumers parked on the empty resource can run again
+        if (crossed == STATUS_PRODUCED)
+        {
+            system_report(system, system->produced[i].resource, STATUS_PRODUCED, PRIORITY_MED);
+        }
 
-    // wait for access to the resource
-    sem_wait(&produced_resource->mutex);
+        int reported = system->store_reported & (1 << i);
+        if (system->amount_stored[i] == 0 && crossed != STATUS_CAPACITY)
+        {
+            system->store_reported &= ~(1 << i);
+        }
+        else if (!reported)
+        {
+            system_report(system, system->produced[i].resource, STATUS_CAPACITY, PRIORITY_LOW);
+            system->store_reported |= (1 << i);
+        }
+    }
 
-    // find the available space
-    available_space = produced_resource->max_capacity - produced_resource->amount;
+    return status;
+}
 
-    if (available_space >= amount_to_store)
-    {
-        // Store all produced resources
-        produced_resource->amount += amount_to_store;
-        system->amount_stored = 0;
-    }
-    else if (available_space > 0)
+/**
+ * Checks whether a `System` still holds produced resources that were not stored.
+ *
+ * @param[in] system  Pointer to the `System`.
+ * @return            Non-zero if any output has units waiting, zero otherwise.
+ */
+static int system_has_stored(const System *system)
+{
+    for (int i = 0; i < system->produced_count; i++)
     {
-        // Store as much as poassibel
-        produced_resource->amount += available_space;
-        system->amount_stored = amount_to_store - available_space;
+        if (system->amount_stored[i] > 0)
+            return 1;
     }
+    return 0;
+}
 
-    sem_post(&produced_resource->mutex);
+/**
+ * Pushes an event about one of the resources of a `System` onto the queue reacting to it.
+ *
+ * @param[in,out] system    Pointer to the reporting `System`.
+ * @param[in]     resource  Pointer to the `Resource` the event is about.
+ * @param[in]     status    Status to report, e.g. `STATUS_LOW` or `STATUS_CAPACITY`.
+ * @param[in]     priority  Priority of the event.
+ */
+static void system_report(System *system, Resource *resource, int status, int priority)
+{
+    Event event;
 
-    if (system->amount_stored != 0)
-    {
-        return STATUS_CAPACITY;
-    }
+    event_init(&event, system, resource, status, priority, resource_get_amount(resource));
+    // A split manager reacts to each resource on the shard it belongs to
+    event_queue_push(resource->event_queue != NULL ? resource->event_queue : system->event_queue, &event);
+}
 
-    return STATUS_OK;
+#ifdef INSTRUMENT
+/**
+ * Records how long the conversion that just finished took compared to its processing time.
+ *
+ * In the discrete-event mode no real time passes, so every conversion looks instant there.
+ *
+ * @param[in,out] system  Pointer to the `System` whose conversion finished.
+ */
+static void system_record_processing(System *system)
+{
+    long long actual_us = (stats_now() - system->stats.started) / 1000;
+
+    atomic_fetch_add_explicit(&system->stats.runs, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&system->stats.nominal_us, system->stats.requested_us, memory_order_relaxed);
+    atomic_fetch_add_explicit(&system->stats.actual_us, actual_us, memory_order_relaxed);
+    if (actual_us > atomic_load_explicit(&system->stats.max_us, memory_order_relaxed))
+        atomic_store_explicit(&system->stats.max_us, actual_us, memory_order_relaxed);
+
+    STATS_VALUE(STATS_PROCESSING_OVERRUN, actual_us - system->stats.requested_us);
 }
+#endif
 
 /**
  * Initializes the `SystemArray`.
@@ -311,6 +722,7 @@ void system_array_init(SystemArray *array)
  * Cleans up the `SystemArray` by destroying all systems and freeing memory.
  *
  * Iterates through the array, cleaning any memory for each System pointed to by the array.
+ * The systems themselves are freed with their arena.
  *
  * @param[in,out] array  Pointer to the `SystemArray` to clean.
  */
@@ -368,7 +780,8 @@ void system_array_add(SystemArray *array, System *system)
         array->capacity = new_capacity;
     }
 
-    // Add the new resource to the end of the array
+    // Add the new system to the end of the array, its index doubles as its id
+    system->id = array->size;
     array->systems[array->size] = system;
     // increase the size of the array to reflect the added system
     array->size++;
@@ -379,6 +792,7 @@ void system_array_add(SystemArray *array, System *system)
  *
  * This function is passed to pthread_create and executes the System's
  * run function in a loop until the System's status is set to TERMINATE.
+ * While the System is DISABLED the thread blocks instead of running it.
  *
  * @param system Pointer to the System to run (cast from void*)
  * @return Always returns NULL
@@ -389,10 +803,7 @@ void *system_thread(void *arg)
     int current_status;
     while (1)
     {
-        // Check status with mutex protection
-        sem_wait(&system->status_mutex);
-        current_status = system->status; // SAVE the status while holding the mutex
-        sem_post(&system->status_mutex);
+        current_status = system_get_status(system);
 
         // Exit condition
         if (current_status == TERMINATE)
@@ -400,6 +811,12 @@ void *system_thread(void *arg)
             break;
         }
 
+        if (current_status == DISABLED)
+        {
+            system_wait_enabled(system);
+            continue;
+        }
+
         system_run(system);
     }
 
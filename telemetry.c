@@ -0,0 +1,376 @@
+#include "defs.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static long long telemetry_now(void);
+static long long telemetry_elapsed(const Telemetry *telemetry);
+static int telemetry_append(Telemetry *telemetry, int type, const void *payload, uint32_t length);
+static void telemetry_flush(Telemetry *telemetry);
+
+/**
+ * Opens a telemetry stream and starts the thread writing it out.
+ *
+ * The stream starts with `TELEMETRY_MAGIC` and `TELEMETRY_VERSION`. Every record after that
+ * is a `TelemetryHeader` followed by `length` bytes of payload, see the `TELEMETRY_*` types.
+ *
+ * @param[out] telemetry    Pointer to the `Telemetry` to open.
+ * @param[in]  path         File to write, or "-" for standard output.
+ * @param[in]  interval_ms  Milliseconds between two snapshots, also the longest a record waits to be written.
+ * @return                  0 on success, -1 if the file, buffer or thread could not be set up.
+ */
+int telemetry_open(Telemetry *telemetry, const char *path, int interval_ms)
+{
+    uint32_t preamble[2] = {TELEMETRY_MAGIC, TELEMETRY_VERSION};
+
+    telemetry->interval_ms = (interval_ms > 0) ? interval_ms : MANAGER_DISPLAY_INTERVAL;
+    telemetry->start_ms = telemetry_now();
+    telemetry->last_snapshot_ms = -telemetry->interval_ms;
+    telemetry->clock = NULL;
+    telemetry->snapshot = NULL;
+    telemetry->snapshot_size = 0;
+    atomic_init(&telemetry->head, 0);
+    atomic_init(&telemetry->tail, 0);
+    atomic_init(&telemetry->dropped, 0);
+    atomic_init(&telemetry->flush_requested, 0);
+
+    if (strcmp(path, "-") == 0)
+        telemetry->fd = STDOUT_FILENO;
+    else
+        telemetry->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (telemetry->fd < 0)
+    {
+        perror("Failed to open telemetry file");
+        return -1;
+    }
+
+    telemetry->buffer = malloc(TELEMETRY_BUFFER_SIZE);
+    if (telemetry->buffer == NULL)
+    {
+        perror("Failed to allocate memory for the telemetry buffer");
+        if (telemetry->fd != STDOUT_FILENO)
+            close(telemetry->fd);
+        return -1;
+    }
+
+    if (sem_init(&telemetry->wakeup, 0, 0) != 0)
+    {
+        perror("Failed to initialize telemetry semaphore");
+        telemetry_clean(telemetry);
+        return -1;
+    }
+    atomic_init(&telemetry->stopping, 0);
+
+    // Nothing else is running yet, so the preamble goes straight to the file
+    if (write(telemetry->fd, preamble, sizeof(preamble)) != (ssize_t)sizeof(preamble))
+    {
+        perror("Failed to write telemetry preamble");
+        sem_destroy(&telemetry->wakeup);
+        telemetry_clean(telemetry);
+        return -1;
+    }
+
+    if (pthread_create(&telemetry->thread, NULL, telemetry_thread, telemetry) != 0)
+    {
+        perror("Failed to create telemetry thread");
+        sem_destroy(&telemetry->wakeup);
+        telemetry_clean(telemetry);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Stops the telemetry thread, writes out everything still buffered and closes the stream.
+ *
+ * @param[in,out] telemetry  Pointer to an open `Telemetry`.
+ */
+void telemetry_close(Telemetry *telemetry)
+{
+    atomic_store(&telemetry->stopping, 1);
+    sem_post(&telemetry->wakeup);
+    pthread_join(telemetry->thread, NULL);
+    sem_destroy(&telemetry->wakeup);
+
+    int dropped = atomic_load(&telemetry->dropped);
+    if (dropped > 0)
+        fprintf(stderr, "Telemetry dropped %d records, the buffer was full\n", dropped);
+
+    telemetry_clean(telemetry);
+}
+
+/**
+ * Frees the buffers of a `Telemetry` and closes its file.
+ *
+ * @param[in,out] telemetry  Pointer to the `Telemetry` to clean.
+ */
+void telemetry_clean(Telemetry *telemetry)
+{
+    if (telemetry == NULL)
+        return;
+
+    free(telemetry->buffer);
+    free(telemetry->snapshot);
+    telemetry->buffer = NULL;
+    telemetry->snapshot = NULL;
+    if (telemetry->fd >= 0 && telemetry->fd != STDOUT_FILENO)
+        close(telemetry->fd);
+    telemetry->fd = -1;
+}
+
+/**
+ * Records the names and ids of every resource and system.
+ *
+ * Events and snapshots only carry ids, the decoder maps them back with these records.
+ * Must be called by the manager thread before the simulation starts.
+ *
+ * @param[in,out] telemetry  Pointer to an open `Telemetry`.
+ * @param[in]     manager    Pointer to the loaded `Manager`.
+ */
+void telemetry_describe(Telemetry *telemetry, Manager *manager)
+{
+    unsigned char payload[2 * sizeof(int32_t) + TELEMETRY_NAME_MAX];
+
+    for (int i = 0; i < manager->resource_array.size; i++)
+    {
+        Resource *resource = manager->resource_array.resources[i];
+        int32_t fields[2] = {resource->id, resource->max_capacity};
+        size_t length = strnlen(resource->name, TELEMETRY_NAME_MAX);
+        memcpy(payload, fields, sizeof(fields));
+        memcpy(payload + sizeof(fields), resource->name, length);
+        telemetry_append(telemetry, TELEMETRY_RESOURCE, payload, sizeof(fields) + length);
+    }
+
+    for (int i = 0; i < manager->system_array.size; i++)
+    {
+        System *system = manager->system_array.systems[i];
+        int32_t id = system->id;
+        size_t length = strnlen(system->name, TELEMETRY_NAME_MAX);
+        memcpy(payload, &id, sizeof(id));
+        memcpy(payload + sizeof(id), system->name, length);
+        telemetry_append(telemetry, TELEMETRY_SYSTEM, payload, sizeof(id) + length);
+    }
+}
+
+/**
+ * Records an event handled by the manager.
+ *
+ * @param[in,out] telemetry  Pointer to an open `Telemetry`.
+ * @param[in]     event      Pointer to the `Event`.
+ */
+void telemetry_event(Telemetry *telemetry, const Event *event)
+{
+    int32_t payload[4] = {event->system->id, event->resource->id, event->status, event->amount};
+    telemetry_append(telemetry, TELEMETRY_EVENT, payload, sizeof(payload));
+}
+
+/**
+ * Records that the manager terminated the simulation because of a resource.
+ *
+ * @param[in,out] telemetry  Pointer to an open `Telemetry`.
+ * @param[in]     resource   Pointer to the `Resource` that ended the simulation.
+ * @param[in]     status     Status of the resource, e.g. `STATUS_EMPTY`.
+ */
+void telemetry_terminate(Telemetry *telemetry, const Resource *resource, int status)
+{
+    int32_t payload[2] = {resource->id, status};
+    telemetry_append(telemetry, TELEMETRY_TERMINATE, payload, sizeof(payload));
+}
+
+/**
+ * Records the amount of every resource and the status of every system if a snapshot is due.
+ *
+ * Called by the manager on every wakeup, snapshots are taken at most once per `interval_ms`.
+ * In discrete mode it is called after every tick and the interval is virtual time.
+ *
+ * @param[in,out] telemetry  Pointer to an open `Telemetry`.
+ * @param[in]     manager    Pointer to the `Manager`.
+ * @return                   Milliseconds until the next snapshot is due.
+ */
+int telemetry_snapshot(Telemetry *telemetry, Manager *manager)
+{
+    long long now = telemetry_elapsed(telemetry);
+    if (now - telemetry->last_snapshot_ms < telemetry->interval_ms)
+        return (int)(telemetry->interval_ms - (now - telemetry->last_snapshot_ms));
+
+    int resource_count = manager->resource_array.size;
+    int system_count = manager->system_array.size;
+    size_t size = sizeof(int32_t) * (2 + resource_count + system_count);
+
+    // Sized once, the number of resources and systems does not change while running
+    if (telemetry->snapshot == NULL)
+    {
+        telemetry->snapshot = malloc(size);
+        if (telemetry->snapshot == NULL)
+        {
+            perror("Failed to allocate memory for the telemetry snapshot");
+            return telemetry->interval_ms;
+        }
+        telemetry->snapshot_size = size;
+    }
+
+    int32_t *payload = telemetry->snapshot;
+    int n = 0;
+    payload[n++] = resource_count;
+    for (int i = 0; i < resource_count; i++)
+    {
+        payload[n++] = resource_get_amount(manager->resource_array.resources[i]);
+    }
+    payload[n++] = system_count;
+    for (int i = 0; i < system_count; i++)
+    {
+        System *system = manager->system_array.systems[i];
+        payload[n++] = system_get_status(system);
+    }
+
+    telemetry_append(telemetry, TELEMETRY_SNAPSHOT, payload, telemetry->snapshot_size);
+    telemetry->last_snapshot_ms = now;
+    return telemetry->interval_ms;
+}
+
+/**
+ * Thread function writing the telemetry buffer out.
+ *
+ * Wakes up every `interval_ms`, or earlier once the buffer is half full, and writes all
+ * buffered records with as few `write` calls as the ring allows. Only this thread touches
+ * the file, so recording never waits for I/O.
+ *
+ * @param arg Pointer to the `Telemetry` to write (cast from void*)
+ * @return Always returns NULL
+ */
+void *telemetry_thread(void *arg)
+{
+    Telemetry *telemetry = (Telemetry *)arg;
+    struct timespec deadline;
+
+    while (!atomic_load(&telemetry->stopping))
+    {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += telemetry->interval_ms / 1000;
+        deadline.tv_nsec += (long)(telemetry->interval_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        while (sem_timedwait(&telemetry->wakeup, &deadline) != 0 && errno == EINTR)
+            ;
+
+        atomic_store(&telemetry->flush_requested, 0);
+        telemetry_flush(telemetry);
+    }
+
+    // Whatever was recorded before the stop still goes out
+    telemetry_flush(telemetry);
+    return NULL;
+}
+
+/**
+ * Reads the time records are stamped with.
+ *
+ * @param[in] telemetry  Pointer to an open `Telemetry`.
+ * @return               Milliseconds since the stream was opened, or the virtual clock if one is set.
+ */
+static long long telemetry_elapsed(const Telemetry *telemetry)
+{
+    return (telemetry->clock != NULL) ? *telemetry->clock : telemetry_now() - telemetry->start_ms;
+}
+
+/**
+ * Reads a monotonic clock in milliseconds.
+ *
+ * @return  Milliseconds since an arbitrary fixed point.
+ */
+static long long telemetry_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/**
+ * Copies a record into the ring buffer.
+ *
+ * Only the manager thread records, which keeps the ring single-producer. A record that
+ * does not fit is dropped and counted instead of blocking the manager.
+ *
+ * @param[in,out] telemetry  Pointer to the `Telemetry`.
+ * @param[in]     type       One of the `TELEMETRY_*` record types.
+ * @param[in]     payload    Bytes following the header.
+ * @param[in]     length     Number of payload bytes.
+ * @return                   0 if the record was buffered, -1 if it was dropped.
+ */
+static int telemetry_append(Telemetry *telemetry, int type, const void *payload, uint32_t length)
+{
+    TelemetryHeader header = {length, (uint32_t)type, (uint32_t)telemetry_elapsed(telemetry)};
+    size_t tail = atomic_load_explicit(&telemetry->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&telemetry->head, memory_order_acquire);
+    size_t total = sizeof(header) + length;
+
+    if (TELEMETRY_BUFFER_SIZE - (tail - head) < total)
+    {
+        atomic_fetch_add(&telemetry->dropped, 1);
+        return -1;
+    }
+
+    // Copy the header and payload, wrapping around the end of the ring when needed
+    const unsigned char *parts[2] = {(const unsigned char *)&header, payload};
+    size_t sizes[2] = {sizeof(header), length};
+    size_t position = tail;
+    for (int p = 0; p < 2; p++)
+    {
+        size_t offset = position & (TELEMETRY_BUFFER_SIZE - 1);
+        size_t first = TELEMETRY_BUFFER_SIZE - offset;
+        if (first > sizes[p])
+            first = sizes[p];
+        memcpy(telemetry->buffer + offset, parts[p], first);
+        memcpy(telemetry->buffer, parts[p] + first, sizes[p] - first);
+        position += sizes[p];
+    }
+    atomic_store_explicit(&telemetry->tail, position, memory_order_release);
+
+    // Batch writes, only wake the writer early once half the ring is in use
+    if (position - head >= TELEMETRY_BUFFER_SIZE / 2 && !atomic_exchange(&telemetry->flush_requested, 1))
+        sem_post(&telemetry->wakeup);
+    return 0;
+}
+
+/**
+ * Writes every buffered byte to the telemetry file.
+ *
+ * At most two `write` calls per flush, one up to the end of the ring and one after wrapping.
+ *
+ * @param[in,out] telemetry  Pointer to the `Telemetry`.
+ */
+static void telemetry_flush(Telemetry *telemetry)
+{
+    size_t head = atomic_load_explicit(&telemetry->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&telemetry->tail, memory_order_acquire);
+
+    while (head != tail)
+    {
+        size_t offset = head & (TELEMETRY_BUFFER_SIZE - 1);
+        size_t chunk = TELEMETRY_BUFFER_SIZE - offset;
+        if (chunk > tail - head)
+            chunk = tail - head;
+
+        ssize_t written = write(telemetry->fd, telemetry->buffer + offset, chunk);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("Failed to write telemetry");
+            head = tail; // Drop the data rather than spin on a broken stream
+        }
+        else
+        {
+            head += (size_t)written;
+        }
+        atomic_store_explicit(&telemetry->head, head, memory_order_release);
+    }
+}
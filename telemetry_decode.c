@@ -0,0 +1,283 @@
+#include "defs.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Turns a telemetry stream written by `p2 -t` back into text:
+ *
+ *     ./p2 -t run.bin
+ *     ./p2_decode run.bin
+ *
+ * Reads standard input when no file is given, so `./p2 -t - | ./p2_decode` works too.
+ */
+
+// Names of the resources and systems, indexed by id
+typedef struct NameTable
+{
+    char **names;
+    int size;
+    int capacity;
+} NameTable;
+
+static void name_table_set(NameTable *table, int id, const char *name, size_t length);
+static const char *name_table_get(const NameTable *table, int id);
+static int decode_min_fields(uint32_t type);
+static const char *decode_event_status(int status);
+static const char *decode_system_status(int status);
+
+int main(int argc, char *argv[])
+{
+    FILE *input = stdin;
+    NameTable resources = {NULL, 0, 0}, systems = {NULL, 0, 0};
+    uint32_t preamble[2];
+    TelemetryHeader header;
+    unsigned char *payload = NULL;
+    size_t payload_capacity = 0;
+    int status = 0;
+
+    if (argc > 1 && strcmp(argv[1], "-") != 0)
+    {
+        input = fopen(argv[1], "rb");
+        if (input == NULL)
+        {
+            perror("Failed to open telemetry file");
+            return 1;
+        }
+    }
+
+    if (fread(preamble, sizeof(preamble), 1, input) != 1 || preamble[0] != TELEMETRY_MAGIC)
+    {
+        fprintf(stderr, "Not a telemetry stream\n");
+        return 1;
+    }
+    if (preamble[1] != TELEMETRY_VERSION)
+    {
+        fprintf(stderr, "Unsupported telemetry version %u\n", preamble[1]);
+        return 1;
+    }
+
+    while (fread(&header, sizeof(header), 1, input) == 1)
+    {
+        // Grow the payload buffer (doubling the size) for the largest record so far
+        if (header.length > payload_capacity)
+        {
+            size_t new_capacity = payload_capacity ? payload_capacity : 64;
+            while (new_capacity < header.length)
+                new_capacity *= 2;
+            free(payload);
+            payload = malloc(new_capacity);
+            if (payload == NULL)
+            {
+                perror("Failed to allocate memory for a telemetry record");
+                status = 1;
+                break;
+            }
+            payload_capacity = new_capacity;
+        }
+
+        if (header.length > 0 && fread(payload, header.length, 1, input) != 1)
+        {
+            fprintf(stderr, "Telemetry stream ends in the middle of a record\n");
+            status = 1;
+            break;
+        }
+
+        int32_t *fields = (int32_t *)payload;
+        int field_count = header.length / sizeof(int32_t);
+        printf("[%8u ms] ", header.time);
+        if (field_count < decode_min_fields(header.type))
+        {
+            printf("Truncated record type %u\n", header.type);
+            continue;
+        }
+
+        switch (header.type)
+        {
+        case TELEMETRY_RESOURCE:
+            name_table_set(&resources, fields[0], (char *)payload + 2 * sizeof(int32_t), header.length - 2 * sizeof(int32_t));
+            printf("Resource %d: %s (capacity %d)\n", fields[0], name_table_get(&resources, fields[0]), fields[1]);
+            break;
+        case TELEMETRY_SYSTEM:
+            name_table_set(&systems, fields[0], (char *)payload + sizeof(int32_t), header.length - sizeof(int32_t));
+            printf("System %d: %s\n", fields[0], name_table_get(&systems, fields[0]));
+            break;
+        case TELEMETRY_EVENT:
+            printf("Event: [%s] Reported Resource [%s : %d] Status [%s]\n", name_table_get(&systems, fields[0]),
+                   name_table_get(&resources, fields[1]), fields[3], decode_event_status(fields[2]));
+            break;
+        case TELEMETRY_SNAPSHOT:
+        {
+            int resource_count = fields[0];
+            if (resource_count < 0 || 2 + resource_count > field_count ||
+                fields[1 + resource_count] < 0 || 2 + resource_count + fields[1 + resource_count] > field_count)
+            {
+                printf("Truncated snapshot\n");
+                break;
+            }
+            int system_count = fields[1 + resource_count];
+
+            printf("Snapshot:");
+            for (int i = 0; i < resource_count; i++)
+                printf(" %s=%d", name_table_get(&resources, i), fields[1 + i]);
+            printf(" |");
+            for (int i = 0; i < system_count; i++)
+                printf(" %s=%s", name_table_get(&systems, i), decode_system_status(fields[2 + resource_count + i]));
+            printf("\n");
+            break;
+        }
+        case TELEMETRY_TERMINATE:
+            printf("Terminated: %s %s\n", name_table_get(&resources, fields[0]), decode_event_status(fields[1]));
+            break;
+        default:
+            // Newer record types are skipped, their length is all we need
+            printf("Unknown record type %u (%u bytes)\n", header.type, header.length);
+            break;
+        }
+    }
+
+    free(payload);
+    for (int i = 0; i < resources.size; i++)
+        free(resources.names[i]);
+    for (int i = 0; i < systems.size; i++)
+        free(systems.names[i]);
+    free(resources.names);
+    free(systems.names);
+    if (input != stdin)
+        fclose(input);
+    return status;
+}
+
+/**
+ * Gives the number of int32 fields a record type needs at least.
+ *
+ * @param[in] type  One of the `TELEMETRY_*` record types.
+ * @return          Minimum number of fields in the payload.
+ */
+static int decode_min_fields(uint32_t type)
+{
+    switch (type)
+    {
+    case TELEMETRY_RESOURCE:
+    case TELEMETRY_TERMINATE:
+        return 2;
+    case TELEMETRY_SYSTEM:
+    case TELEMETRY_SNAPSHOT:
+        return 1;
+    case TELEMETRY_EVENT:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * Stores the name of an id, growing the table (doubling the size) when needed.
+ *
+ * @param[in,out] table   Pointer to the `NameTable`.
+ * @param[in]     id      Id of the resource or system.
+ * @param[in]     name    Name bytes, not null terminated.
+ * @param[in]     length  Number of name bytes.
+ */
+static void name_table_set(NameTable *table, int id, const char *name, size_t length)
+{
+    if (id < 0)
+        return;
+
+    if (id >= table->capacity)
+    {
+        int new_capacity = table->capacity ? table->capacity : 8;
+        while (new_capacity <= id)
+            new_capacity *= 2;
+
+        char **new_names = malloc(sizeof(char *) * new_capacity);
+        if (new_names == NULL)
+        {
+            perror("Failed to allocate memory for names");
+            return;
+        }
+        for (int i = 0; i < new_capacity; i++)
+            new_names[i] = (i < table->size) ? table->names[i] : NULL;
+
+        free(table->names);
+        table->names = new_names;
+        table->capacity = new_capacity;
+    }
+
+    char *copy = malloc(length + 1);
+    if (copy == NULL)
+        return;
+    memcpy(copy, name, length);
+    copy[length] = '\0';
+
+    free(table->names[id]);
+    table->names[id] = copy;
+    if (id >= table->size)
+        table->size = id + 1;
+}
+
+/**
+ * Looks up the name of an id.
+ *
+ * @param[in] table  Pointer to the `NameTable`.
+ * @param[in] id     Id of the resource or system.
+ * @return           The name, or "?" for an id the stream never described.
+ */
+static const char *name_table_get(const NameTable *table, int id)
+{
+    if (id < 0 || id >= table->size || table->names[id] == NULL)
+        return "?";
+    return table->names[id];
+}
+
+/**
+ * Maps an event status code to a human-readable string.
+ *
+ * @param[in] status  One of the `STATUS_*` codes.
+ * @return            Name of the status.
+ */
+static const char *decode_event_status(int status)
+{
+    switch (status)
+    {
+    case STATUS_OK:
+        return "OK";
+    case STATUS_EMPTY:
+        return "EMPTY";
+    case STATUS_LOW:
+        return "LOW";
+    case STATUS_INSUFFICIENT:
+        return "INSUFFICIENT";
+    case STATUS_CAPACITY:
+        return "CAPACITY";
+    case STATUS_PRODUCED:
+        return "PRODUCED";
+    default:
+        return "UNKNOWN";
+    }
+}
+
+/**
+ * Maps a system status code to a human-readable string.
+ *
+ * @param[in] status  Status of a system, e.g. `FAST`.
+ * @return            Name of the status.
+ */
+static const char *decode_system_status(int status)
+{
+    switch (status)
+    {
+    case TERMINATE:
+        return "TERMINATE";
+    case DISABLED:
+        return "DISABLED";
+    case SLOW:
+        return "SLOW";
+    case STANDARD:
+        return "STANDARD";
+    case FAST:
+        return "FAST";
+    default:
+        return "UNKNOWN";
+    }
+}
@@ -0,0 +1,302 @@
+#include "defs.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Position of a record in the file and its time, sorted to replay the threads' chunks in order
+typedef struct TraceEntry
+{
+    long long time;
+    int index;
+} TraceEntry;
+
+// Chunk of the trace the calling thread is filling
+static _Thread_local Trace *trace_owner;
+static _Thread_local TraceRecord *trace_cursor;
+static _Thread_local TraceRecord *trace_end;
+
+// Helper functions just used by this C file to clean up our code
+
+static long long trace_now(void);
+static int trace_claim(Trace *trace);
+static int trace_compare_entries(const void *a, const void *b);
+
+/**
+ * Creates a trace file and maps it to record the events of the loaded scenario.
+ *
+ * The file is sized for `TRACE_CAPACITY` records up front, the pages only take space once
+ * written. Threads recording events claim `TRACE_CHUNK_RECORDS` slots at a time and fill
+ * them without any lock.
+ *
+ * @param[out] trace    Pointer to the `Trace` to open.
+ * @param[in]  path     File to write.
+ * @param[in]  manager  Pointer to the loaded `Manager`, for the counts and fingerprint of the scenario.
+ * @return              0 on success, -1 if the file could not be created or mapped.
+ */
+int trace_open(Trace *trace, const char *path, Manager *manager)
+{
+    trace->map_size = sizeof(TraceHeader) + sizeof(TraceRecord) * (size_t)TRACE_CAPACITY;
+    trace->start_ns = trace_now();
+    atomic_init(&trace->claimed, 0);
+    atomic_init(&trace->dropped, 0);
+
+    trace->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (trace->fd < 0)
+    {
+        perror("Failed to open trace file");
+        return -1;
+    }
+    if (ftruncate(trace->fd, trace->map_size) != 0)
+    {
+        perror("Failed to size trace file");
+        close(trace->fd);
+        return -1;
+    }
+
+    void *map = mmap(NULL, trace->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, trace->fd, 0);
+    if (map == MAP_FAILED)
+    {
+        perror("Failed to map trace file");
+        close(trace->fd);
+        return -1;
+    }
+
+    trace->header = map;
+    trace->records = (TraceRecord *)(trace->header + 1);
+    *trace->header = (TraceHeader){TRACE_MAGIC, TRACE_VERSION, manager->resource_array.size,
+                                   manager->system_array.size, TRACE_CAPACITY, TRACE_CHUNK_RECORDS,
+                                   cluster_fingerprint(manager), 0};
+    return 0;
+}
+
+/**
+ * Unmaps a trace and cuts the file down to the chunks that were handed out.
+ *
+ * Must only be called once no thread pushes events into a traced queue anymore.
+ *
+ * @param[in,out] trace  Pointer to the open `Trace`.
+ */
+void trace_close(Trace *trace)
+{
+    int claimed = atomic_load(&trace->claimed);
+    int used = (claimed < TRACE_CAPACITY) ? claimed : TRACE_CAPACITY;
+
+    munmap(trace->header, trace->map_size);
+    if (ftruncate(trace->fd, sizeof(TraceHeader) + sizeof(TraceRecord) * (size_t)used) != 0)
+        perror("Failed to truncate trace file");
+    close(trace->fd);
+
+    if (atomic_load(&trace->dropped) > 0)
+        fprintf(stderr, "Trace full, %d events were not recorded\n", atomic_load(&trace->dropped));
+
+    trace_owner = NULL;
+}
+
+/**
+ * Appends an event to the chunk of the calling thread, claiming a new chunk when it is full.
+ *
+ * @param[in,out] trace  Pointer to the open `Trace`.
+ * @param[in]     event  Pointer to the `Event` being pushed.
+ */
+void trace_record(Trace *trace, const Event *event)
+{
+    if ((trace_owner != trace || trace_cursor == trace_end) && !trace_claim(trace))
+    {
+        atomic_fetch_add_explicit(&trace->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    TraceRecord *record = trace_cursor++;
+    record->time = trace_now() - trace->start_ns;
+    record->system_id = event->system->id;
+    record->resource_id = event->resource->id;
+    record->status = event->status;
+    record->priority = event->priority;
+    record->amount = event->amount;
+    record->used = 1;
+}
+
+/**
+ * Feeds a recorded trace through the manager, with no system running.
+ *
+ * The events are replayed one at a time in the order they were pushed, across all
+ * recording threads, and none of them is merged away. Each one first sets its resource to
+ * the amount it reported, so the manager sees the amounts it saw while recording. Rule holds
+ * follow the recorded wall clock. Stops once the manager ends the simulation, then prints
+ * how fast the events went through.
+ *
+ * @param[in,out] manager  Pointer to the loaded `Manager` of the recorded scenario, with its index built.
+ * @param[in]     path     Trace file written with `trace_open`.
+ * @return                 0 on success, 1 if the trace could not be read or belongs to another scenario.
+ */
+int trace_replay(Manager *manager, const char *path)
+{
+    struct stat info;
+    void *map = MAP_FAILED;
+    TraceEntry *entries = NULL;
+    Event *events = NULL;
+    long long *times = NULL;
+    int result = 1, count = 0, invalid = 0, pushed = 0, handled = 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        perror("Failed to open trace file");
+        return 1;
+    }
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(TraceHeader))
+    {
+        fprintf(stderr, "Not a trace file\n");
+        goto done;
+    }
+    map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        perror("Failed to map trace file");
+        goto done;
+    }
+
+    const TraceHeader *header = map;
+    const TraceRecord *records = (const TraceRecord *)(header + 1);
+    int slot_count = (int)((info.st_size - sizeof(TraceHeader)) / sizeof(TraceRecord));
+    if (header->magic != TRACE_MAGIC || header->version != TRACE_VERSION)
+    {
+        fprintf(stderr, "Not a trace file of this version\n");
+        goto done;
+    }
+    if (header->resource_count != manager->resource_array.size || header->system_count != manager->system_array.size)
+    {
+        fprintf(stderr, "Trace was recorded with %d resources and %d systems, the scenario has %d and %d\n",
+                header->resource_count, header->system_count, manager->resource_array.size, manager->system_array.size);
+        goto done;
+    }
+    if (header->fingerprint != cluster_fingerprint(manager))
+    {
+        fprintf(stderr, "Trace was recorded with another scenario or other options\n");
+        goto done;
+    }
+
+    // Chunks of different threads interleave in time, put the records back in push order
+    entries = malloc(sizeof(TraceEntry) * ALLOC_COUNT(slot_count));
+    if (entries == NULL)
+    {
+        perror("Failed to allocate memory for the trace");
+        goto done;
+    }
+    for (int i = 0; i < slot_count; i++)
+    {
+        const TraceRecord *record = &records[i];
+        if (!record->used)
+            continue;
+        if (record->system_id < 0 || record->system_id >= manager->system_array.size ||
+            record->resource_id < 0 || record->resource_id >= manager->resource_array.size)
+        {
+            invalid++;
+            continue;
+        }
+        entries[count++] = (TraceEntry){record->time, i};
+    }
+    qsort(entries, count, sizeof(TraceEntry), trace_compare_entries);
+
+    // Resolve the ids up front, so the timed loop is the manager's work and nothing else
+    events = malloc(sizeof(Event) * ALLOC_COUNT(count));
+    times = malloc(sizeof(long long) * ALLOC_COUNT(count));
+    if (events == NULL || times == NULL)
+    {
+        perror("Failed to allocate memory for the trace");
+        goto done;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        const TraceRecord *record = &records[entries[i].index];
+        event_init(&events[i], manager->system_array.systems[record->system_id],
+                   manager->resource_array.resources[record->resource_id], record->status, record->priority, record->amount);
+        times[i] = record->time / 1000000;
+    }
+
+    long long start = trace_now();
+    for (; pushed < count && manager->simulation_running; pushed++)
+    {
+        Resource *resource = events[pushed].resource;
+        int amount = events[pushed].amount;
+
+        resource_set_amount(resource, (amount < 0) ? 0 : (amount > resource->max_capacity) ? resource->max_capacity : amount);
+        event_queue_push(&manager->event_queue, &events[pushed]);
+        manager->now = times[pushed];
+        handled += manager_process_events(manager);
+    }
+    double wall_ms = (trace_now() - start) / 1000000.0;
+
+    printf("\nReplayed %d of %d events in %.1f ms (%.0f events/s), the manager handled %d\n", pushed, count, wall_ms,
+           (wall_ms > 0) ? pushed / wall_ms * 1000.0 : 0.0, handled);
+    if (invalid > 0)
+        fprintf(stderr, "Skipped %d records with ids outside of the scenario\n", invalid);
+    result = 0;
+
+done:
+    free(entries);
+    free(events);
+    free(times);
+    if (map != MAP_FAILED)
+        munmap(map, info.st_size);
+    close(fd);
+    return result;
+}
+
+/**
+ * Reads the monotonic clock in nanoseconds.
+ *
+ * @return Current monotonic time in nanoseconds.
+ */
+static long long trace_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/**
+ * Hands the calling thread the next chunk of record slots, the last one may be shorter.
+ *
+ * @param[in,out] trace  Pointer to the open `Trace`.
+ * @return               1 if the thread has room to record into, 0 once the file is full.
+ */
+static int trace_claim(Trace *trace)
+{
+    // Checked first so a full trace does not keep pushing the counter towards overflow
+    if (atomic_load_explicit(&trace->claimed, memory_order_relaxed) >= TRACE_CAPACITY)
+        return 0;
+
+    int first = atomic_fetch_add_explicit(&trace->claimed, TRACE_CHUNK_RECORDS, memory_order_relaxed);
+    if (first >= TRACE_CAPACITY)
+        return 0;
+
+    int last = (first + TRACE_CHUNK_RECORDS < TRACE_CAPACITY) ? first + TRACE_CHUNK_RECORDS : TRACE_CAPACITY;
+    trace_owner = trace;
+    trace_cursor = &trace->records[first];
+    trace_end = &trace->records[last];
+    return 1;
+}
+
+/**
+ * Orders trace entries by time, then by position in the file.
+ *
+ * A thread's own records sit in file order, so pushes of one thread landing on the same
+ * nanosecond keep their order.
+ *
+ * @param[in] a  Pointer to the first `TraceEntry`.
+ * @param[in] b  Pointer to the second `TraceEntry`.
+ * @return       Negative, zero or positive as for `qsort`.
+ */
+static int trace_compare_entries(const void *a, const void *b)
+{
+    const TraceEntry *first = a, *second = b;
+    if (first->time != second->time)
+        return (first->time < second->time) ? -1 : 1;
+    return first->index - second->index;
+}